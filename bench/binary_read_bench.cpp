@@ -0,0 +1,134 @@
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// reads 10k stored songs back, from the binary pack store and from the
+// per-song JSON files. Warm reads reuse one serializer with the files in
+// the page cache; cold reads open a fresh serializer after the files have
+// been dropped from the page cache
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  const int SONG_COUNT = 10000;
+
+  alsong::song_info sample_song(int n) {
+    alsong::song_info song;
+    song.lyric_id = std::to_string(n);
+    song.title = "Title " + std::to_string(n);
+    song.artist = "Artist " + std::to_string(n % 300);
+    song.album = "Album";
+    song.written_by = "tester";
+    for (int line = 0; line < 40; ++line) {
+      std::string time = std::to_string(10 + line / 2) + ":0" + std::to_string(line % 10)
+        + ".50";
+      song.add_lyrics(time, "line " + std::to_string(line)
+          + " of a moderately long lyric text");
+    }
+    return song;
+  }
+
+  // both stores written once for the process
+  struct stores
+  {
+    test::temp_dir dir{"alsong-binary-read-bench"};
+    std::string binary = dir.str() + "/binary";
+    std::string json = dir.str() + "/json";
+
+    stores() {
+      alsong::song_cache cache(0);
+      alsong::lyrics_serializer b(binary, 10);
+      b.set_song_cache(cache);
+      alsong::lyrics_serializer j(json, 10);
+      j.set_song_cache(cache);
+      j.set_lyrics_format(alsong::lyrics_format::json);
+      for (int n = 0; n < SONG_COUNT; ++n) {
+        b.song_collection = {sample_song(n)};
+        b.write();
+        j.song_collection = b.song_collection;
+        j.write();
+      }
+      ::sync();
+    }
+  };
+
+  stores& shared_stores() {
+    static stores instance;
+    return instance;
+  }
+
+  // asks the kernel to forget the cached pages of every file in folder
+  void drop_page_cache(const std::string& folder) {
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(folder)) {
+      if (!entry.is_regular_file())
+        continue;
+      int fd = ::open(entry.path().c_str(), O_RDONLY);
+      if (fd < 0)
+        continue;
+      ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      ::close(fd);
+    }
+  }
+
+  void read_all(alsong::lyrics_serializer& serializer) {
+    for (int n = 0; n < SONG_COUNT; ++n) {
+      serializer.read("Title " + std::to_string(n),
+          "Artist " + std::to_string(n % 300));
+      benchmark::DoNotOptimize(serializer.song_collection.data());
+    }
+  }
+
+  void warm_reads(benchmark::State& state, const std::string& folder,
+      alsong::lyrics_format format) {
+    alsong::song_cache cache(0);
+    alsong::lyrics_serializer serializer(folder, 10);
+    serializer.set_song_cache(cache);
+    serializer.set_lyrics_format(format);
+    read_all(serializer);
+    for (auto _ : state)
+      read_all(serializer);
+    state.SetItemsProcessed(state.iterations() * SONG_COUNT);
+  }
+
+  void cold_reads(benchmark::State& state, const std::string& folder,
+      alsong::lyrics_format format) {
+    for (auto _ : state) {
+      state.PauseTiming();
+      drop_page_cache(folder);
+      state.ResumeTiming();
+      alsong::song_cache cache(0);
+      alsong::lyrics_serializer serializer(folder, 10);
+      serializer.set_song_cache(cache);
+      serializer.set_lyrics_format(format);
+      read_all(serializer);
+    }
+    state.SetItemsProcessed(state.iterations() * SONG_COUNT);
+  }
+}
+
+static void BM_read_binary_warm(benchmark::State& state) {
+  warm_reads(state, shared_stores().binary, alsong::lyrics_format::binary);
+}
+BENCHMARK(BM_read_binary_warm)->Unit(benchmark::kMillisecond);
+
+static void BM_read_json_warm(benchmark::State& state) {
+  warm_reads(state, shared_stores().json, alsong::lyrics_format::json);
+}
+BENCHMARK(BM_read_json_warm)->Unit(benchmark::kMillisecond);
+
+static void BM_read_binary_cold(benchmark::State& state) {
+  cold_reads(state, shared_stores().binary, alsong::lyrics_format::binary);
+}
+BENCHMARK(BM_read_binary_cold)->Unit(benchmark::kMillisecond)->Iterations(5);
+
+static void BM_read_json_cold(benchmark::State& state) {
+  cold_reads(state, shared_stores().json, alsong::lyrics_format::json);
+}
+BENCHMARK(BM_read_json_cold)->Unit(benchmark::kMillisecond)->Iterations(5);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,66 @@
+#include <benchmark/benchmark.h>
+
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// one lookup (search plus lyric fetch) against a local stand-in server,
+// through the pooled fetcher and through a fresh handle and header list
+// per request as _fetch used to do
+
+namespace
+{
+  size_t collect(char *buffer, size_t size, size_t nmemb, void *data) {
+    static_cast<std::string *>(data)->append(buffer, size * nmemb);
+    return size * nmemb;
+  }
+
+  CURLcode fresh_handle_request(const std::string& url, const std::string& soap,
+      std::string& output) {
+    CURL *curl = curl_easy_init();
+    curl_slist *headers = nullptr;
+    headers = curl_slist_append(headers,
+        "Content-Type: application/soap+xml; charset=utf-8");
+    headers = curl_slist_append(headers, "Accept: text/plain");
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, soap.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, collect);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &output);
+    CURLcode result = curl_easy_perform(curl);
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    return result;
+  }
+
+  test::stand_in_server& server() {
+    static test::stand_in_server instance;
+    return instance;
+  }
+}
+
+static void BM_lookup_pooled(benchmark::State& state) {
+  moonk5::alsong::lyrics_fetcher fetcher(server().url());
+  for (auto _ : state) {
+    std::string list, lyric;
+    fetcher.fetch_lyric_list("dead boy's poem", "nightwish", list);
+    fetcher.fetch_lyric("1", lyric);
+    benchmark::DoNotOptimize(lyric.data());
+  }
+  state.counters["reused"] = double(fetcher.connection_reuse_count());
+}
+BENCHMARK(BM_lookup_pooled)->UseRealTime();
+
+static void BM_lookup_fresh_handle(benchmark::State& state) {
+  std::string list_soap = "<ns1:GetResembleLyricList2/>" + std::string(900, ' ');
+  std::string lyric_soap = "<ns1:GetLyricByID2/>" + std::string(900, ' ');
+  for (auto _ : state) {
+    std::string list, lyric;
+    fresh_handle_request(server().url(), list_soap, list);
+    fresh_handle_request(server().url(), lyric_soap, lyric);
+    benchmark::DoNotOptimize(lyric.data());
+  }
+}
+BENCHMARK(BM_lookup_fresh_handle)->UseRealTime();
+
+BENCHMARK_MAIN();
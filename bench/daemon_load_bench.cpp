@@ -0,0 +1,132 @@
+#include <benchmark/benchmark.h>
+
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// load test of lyrics_daemon over its Unix socket: client threads send
+// lookups on keep-alive connections and every latency is recorded. Hits
+// are answered from the warm cache; misses are unique searches against a
+// stand-in upstream with a fixed delay. Reports p50/p99 latency and the
+// request throughput
+
+namespace
+{
+  const long UPSTREAM_DELAY_MS = 20;
+
+  // 'song N' searches find lyric id N
+  test::stand_in_server::response upstream(const std::string& body) {
+    test::stand_in_server::response r;
+    r.delay_ms = UPSTREAM_DELAY_MS;
+    size_t title = body.find("<ns1:title>song ");
+    if (title != std::string::npos) {
+      size_t begin = title + 16;
+      std::string id = body.substr(begin, body.find('<', begin) - begin);
+      r.body = test::lyric_list_response(1);
+      r.body.replace(r.body.find("<lyricID>1<") + 9, 1, id);
+    } else {
+      size_t begin = body.find("<ns1:lyricID>") + 13;
+      r.body = test::lyric_response(body.substr(begin, body.find('<', begin) - begin));
+    }
+    return r;
+  }
+
+  struct daemon_under_test
+  {
+    test::temp_dir dir{"alsong-daemon-load"};
+    test::stand_in_server server{upstream};
+    moonk5::alsong::lyrics_fetcher fetcher{server.url()};
+    std::string socket_path = dir.str() + "/alsongd.sock";
+    moonk5::alsong::lyrics_daemon daemon{fetcher, dir.str() + "/lyrics", 256};
+    std::thread loop;
+
+    daemon_under_test() {
+      daemon.listen_unix(socket_path);
+      loop = std::thread([this]() { daemon.run(); });
+      // the songs the hit scenario asks for
+      test::unix_http_client client(socket_path);
+      for (int song = 0; song < 100; ++song)
+        client.get(target(song));
+    }
+
+    ~daemon_under_test() {
+      daemon.stop();
+      loop.join();
+    }
+
+    static std::string target(long song) {
+      return "/lyrics?title=song%20" + std::to_string(song) + "&artist=load";
+    }
+  };
+
+  daemon_under_test& shared_daemon() {
+    static daemon_under_test instance;
+    return instance;
+  }
+
+  std::atomic<long> next_miss{1000};
+
+  // clients threads send requests_per_client lookups each; target picks
+  // the song of a request
+  void run_load(benchmark::State& state, const std::function<long(int)>& song) {
+    daemon_under_test& d = shared_daemon();
+    int clients = int(state.range(0));
+    int requests_per_client = int(state.range(1));
+    std::vector<double> latencies;
+    uint64_t failed = 0;
+    double seconds = 0;
+
+    for (auto _ : state) {
+      std::vector<std::vector<double>> per_client{static_cast<size_t>(clients)};
+      std::atomic<uint64_t> errors{0};
+      auto started = std::chrono::steady_clock::now();
+      std::vector<std::thread> threads;
+      for (int c = 0; c < clients; ++c)
+        threads.emplace_back([&, c]() {
+            test::unix_http_client client(d.socket_path);
+            for (int r = 0; r < requests_per_client; ++r) {
+              auto begin = std::chrono::steady_clock::now();
+              int status = client.get(daemon_under_test::target(song(r))).status;
+              per_client[size_t(c)].push_back(std::chrono::duration<double,
+                  std::milli>(std::chrono::steady_clock::now() - begin).count());
+              if (status != 200)
+                ++errors;
+            }
+          });
+      for (std::thread& t : threads)
+        t.join();
+      double elapsed = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - started).count();
+      state.SetIterationTime(elapsed);
+      seconds += elapsed;
+      failed += errors;
+      for (const std::vector<double>& l : per_client)
+        latencies.insert(latencies.end(), l.begin(), l.end());
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+      return latencies.empty() ? 0.0
+        : latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+    };
+    state.counters["p50_ms"] = percentile(0.50);
+    state.counters["p99_ms"] = percentile(0.99);
+    state.counters["requests_per_second"] = double(latencies.size()) / seconds;
+    state.counters["failed"] = double(failed);
+  }
+}
+
+static void BM_daemon_hits(benchmark::State& state) {
+  run_load(state, [](int r) { return long(r % 100); });
+}
+BENCHMARK(BM_daemon_hits)->Args({1, 2000})->Args({16, 500})->Args({64, 200})
+  ->UseManualTime()->Unit(benchmark::kMillisecond);
+
+// every request is a search and a lyric fetch upstream
+static void BM_daemon_misses(benchmark::State& state) {
+  run_load(state, [](int) { return next_miss++; });
+}
+BENCHMARK(BM_daemon_misses)->Args({1, 20})->Args({16, 20})->Args({64, 20})
+  ->Args({128, 10})->UseManualTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,68 @@
+#include <benchmark/benchmark.h>
+
+#include <AlsongLyricsFetcher.h>
+
+// delimiter index of GetLyricByID2 style payloads from 1 KB to 1 MB, by
+// implementation
+
+namespace
+{
+  std::string payload(size_t size) {
+    const std::string line =
+      "[01:23.45]駆けてくあなたの背中は<br>[01:23.45]그라운드를 달리는 당신의 등은<br>";
+    std::string text;
+    while (text.size() < size)
+      text += line;
+    text.resize(size);
+    return text;
+  }
+
+  template <typename Finder>
+  void run(benchmark::State& state, Finder finder) {
+    std::string text = payload(size_t(state.range(0)));
+    std::vector<uint32_t> positions;
+    for (auto _ : state) {
+      positions.clear();
+      finder(text, positions);
+      benchmark::DoNotOptimize(positions.data());
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+  }
+}
+
+static void BM_delimiters_scalar(benchmark::State& state) {
+  run(state, [](std::string_view text, std::vector<uint32_t>& positions) {
+      moonk5::delimiter_scan::find_lyric_delimiters_scalar(text, 0, positions);
+    });
+}
+BENCHMARK(BM_delimiters_scalar)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+static void BM_delimiters_sse2(benchmark::State& state) {
+  run(state, moonk5::delimiter_scan::find_lyric_delimiters_sse2);
+}
+BENCHMARK(BM_delimiters_sse2)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+static void BM_delimiters_avx2(benchmark::State& state) {
+  if (!__builtin_cpu_supports("avx2")) {
+    state.SkipWithError("no AVX2 on this CPU");
+    return;
+  }
+  run(state, moonk5::delimiter_scan::find_lyric_delimiters_avx2);
+}
+BENCHMARK(BM_delimiters_avx2)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+#endif
+
+static void BM_index_lyric_lines(benchmark::State& state) {
+  std::string text = payload(size_t(state.range(0)));
+  std::vector<moonk5::delimiter_scan::line_span> lines;
+  for (auto _ : state) {
+    lines.clear();
+    moonk5::delimiter_scan::index_lyric_lines(text, lines);
+    benchmark::DoNotOptimize(lines.data());
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_index_lyric_lines)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,67 @@
+#include <benchmark/benchmark.h>
+
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// a 50 entry search response read by the DOM-free extractor and by the
+// tinyxml2 DOM with the chained FirstChildElement/find_child walk that
+// parse_lyric_list used before
+
+namespace
+{
+  std::string find_child(tinyxml2::XMLNode *root, const char *value) {
+    std::string text;
+    tinyxml2::XMLElement *element = root->FirstChildElement(value);
+    if (element != nullptr && element->GetText() != nullptr)
+      text = element->GetText();
+    return text;
+  }
+}
+
+static void BM_lyric_list_find_child(benchmark::State& state) {
+  std::string response = test::lyric_list_response(50);
+  for (auto _ : state) {
+    tinyxml2::XMLDocument doc;
+    doc.Parse(response.c_str(), response.size());
+    std::vector<moonk5::alsong::song_list> lists;
+    tinyxml2::XMLElement *result = doc.FirstChildElement("soap:Envelope")
+      ->FirstChildElement("soap:Body")
+      ->FirstChildElement("GetResembleLyricList2Response")
+      ->FirstChildElement("GetResembleLyricList2Result");
+    for (tinyxml2::XMLNode *child = result->FirstChildElement("ST_SEARCHLYRIC_LIST");
+        child; child = child->NextSiblingElement("ST_SEARCHLYRIC_LIST")) {
+      moonk5::alsong::song_list list;
+      list.lyric_id = find_child(child, "lyricID");
+      list.title = find_child(child, "title");
+      list.artist = find_child(child, "artist");
+      list.album = find_child(child, "album");
+      lists.push_back(list);
+    }
+    benchmark::DoNotOptimize(lists.data());
+  }
+}
+BENCHMARK(BM_lyric_list_find_child);
+
+static void BM_lyric_list_extract(benchmark::State& state) {
+  std::string response = test::lyric_list_response(50);
+  for (auto _ : state) {
+    std::vector<moonk5::alsong::song_list> lists;
+    moonk5::alsong::soap_extract::lyric_list(response, lists, 50);
+    benchmark::DoNotOptimize(lists.data());
+  }
+}
+BENCHMARK(BM_lyric_list_extract);
+
+static void BM_lyric_extract(benchmark::State& state) {
+  std::string response = test::lyric_response("1");
+  for (auto _ : state) {
+    moonk5::alsong::song_info song;
+    std::string raw;
+    moonk5::alsong::soap_extract::lyric(response, song, raw);
+    benchmark::DoNotOptimize(raw.data());
+  }
+}
+BENCHMARK(BM_lyric_extract);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,41 @@
+#include <regex>
+
+#include <benchmark/benchmark.h>
+
+#include <AlsongLyricsFetcher.h>
+
+// building the search envelope with three std::regex_replace passes, as
+// fetch_lyric_list did, against rendering the pre-split soap_template
+
+namespace
+{
+  const moonk5::alsong::lyrics_fetcher& fetcher() {
+    static moonk5::alsong::lyrics_fetcher instance;
+    return instance;
+  }
+}
+
+static void BM_envelope_regex(benchmark::State& state) {
+  const std::string title = "dead boy's poem", artist = "nightwish";
+  for (auto _ : state) {
+    std::string soap(fetcher().SOAP_TEMPLATE_LYRIC_LIST);
+    soap = std::regex_replace(soap, std::regex("\\$encdata"), fetcher().ENC_DATA);
+    soap = std::regex_replace(soap, std::regex("\\$title"), title);
+    soap = std::regex_replace(soap, std::regex("\\$artist"), artist);
+    benchmark::DoNotOptimize(soap.data());
+  }
+}
+BENCHMARK(BM_envelope_regex);
+
+static void BM_envelope_template(benchmark::State& state) {
+  const moonk5::alsong::soap_template t(fetcher().SOAP_TEMPLATE_LYRIC_LIST,
+      {"encdata", "title", "artist"});
+  const std::string title = "dead boy's poem", artist = "nightwish";
+  for (auto _ : state) {
+    std::string soap = t.render({fetcher().ENC_DATA, title, artist});
+    benchmark::DoNotOptimize(soap.data());
+  }
+}
+BENCHMARK(BM_envelope_template);
+
+BENCHMARK_MAIN();
@@ -27,15 +27,52 @@
 #ifndef ALSONG_LYRICS_FETCHER_H
 #define ALSONG_LYRICS_FETCHER_H
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
+#include <iostream>
+#include <list>
 #include <locale>
-#include <regex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-#include <boost/algorithm/string/case_conv.hpp>
-#include <boost/algorithm/string/replace.hpp>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
 #include <curl/curl.h>
 #include <nlohmann/json.hpp>
 #include <tinyxml2.h>
@@ -69,16 +106,530 @@ namespace moonk5
       return &buff[0];
     }
 
-    unsigned int to_milliseconds(const std::string& time_in_str) {
+    unsigned int to_milliseconds(std::string_view time_in_str) {
+      auto two_digits = [&time_in_str](size_t pos) {
+        unsigned int value = 0;
+        for (size_t i = pos; i < pos + 2 && i < time_in_str.size(); ++i) {
+          if (time_in_str[i] < '0' || time_in_str[i] > '9')
+            break;
+          value = value * 10 + (time_in_str[i] - '0');
+        }
+        return value;
+      };
+
       unsigned int milliseconds = 0;
-      milliseconds += stoi(time_in_str.substr(0, 2)) * 60 * 1000;  // mins
-      milliseconds += stoi(time_in_str.substr(3, 2)) * 1000;       // secs
-      milliseconds += stoi(time_in_str.substr(6, 2));              // mils
+      milliseconds += two_digits(0) * 60 * 1000;  // mins
+      milliseconds += two_digits(3) * 1000;       // secs
+      milliseconds += two_digits(6);              // mils
 
       return milliseconds;
     }
   }
 
+  namespace delimiter_scan
+  {
+    // appends the offset of every '\n', '<' and '[' in text[from, end)
+    // to positions; the SIMD versions below produce exactly the same index
+    void find_lyric_delimiters_scalar(std::string_view text, size_t from,
+        std::vector<uint32_t>& positions) {
+      for (size_t i = from; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '\n' || c == '<' || c == '[')
+          positions.push_back(uint32_t(i));
+      }
+    }
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __attribute__((target("sse2")))
+    void find_lyric_delimiters_sse2(std::string_view text,
+        std::vector<uint32_t>& positions) {
+      const __m128i nl = _mm_set1_epi8('\n');
+      const __m128i lt = _mm_set1_epi8('<');
+      const __m128i bracket = _mm_set1_epi8('[');
+      size_t i = 0;
+      for (; i + 16 <= text.size(); i += 16) {
+        __m128i block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(text.data() + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(block, nl),
+            _mm_or_si128(_mm_cmpeq_epi8(block, lt), _mm_cmpeq_epi8(block, bracket)));
+        unsigned int mask = unsigned(_mm_movemask_epi8(hits));
+        while (mask != 0) {
+          positions.push_back(uint32_t(i + __builtin_ctz(mask)));
+          mask &= mask - 1;
+        }
+      }
+      find_lyric_delimiters_scalar(text, i, positions);
+    }
+
+    __attribute__((target("avx2")))
+    void find_lyric_delimiters_avx2(std::string_view text,
+        std::vector<uint32_t>& positions) {
+      const __m256i nl = _mm256_set1_epi8('\n');
+      const __m256i lt = _mm256_set1_epi8('<');
+      const __m256i bracket = _mm256_set1_epi8('[');
+      size_t i = 0;
+      for (; i + 32 <= text.size(); i += 32) {
+        __m256i block = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(text.data() + i));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(block, nl),
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, lt),
+              _mm256_cmpeq_epi8(block, bracket)));
+        unsigned int mask = unsigned(_mm256_movemask_epi8(hits));
+        while (mask != 0) {
+          positions.push_back(uint32_t(i + __builtin_ctz(mask)));
+          mask &= mask - 1;
+        }
+      }
+      find_lyric_delimiters_scalar(text, i, positions);
+    }
+#endif
+
+    // picks the widest implementation the running CPU supports
+    void find_lyric_delimiters(std::string_view text,
+        std::vector<uint32_t>& positions) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+      static const bool has_avx2 = __builtin_cpu_supports("avx2");
+      static const bool has_sse2 = __builtin_cpu_supports("sse2");
+      if (has_avx2)
+        return find_lyric_delimiters_avx2(text, positions);
+      if (has_sse2)
+        return find_lyric_delimiters_sse2(text, positions);
+#endif
+      find_lyric_delimiters_scalar(text, 0, positions);
+    }
+
+    // one line of a raw lyric blob, not including its '<br>' or '\n'
+    struct line_span
+    {
+      uint32_t begin = 0;
+      uint32_t end = 0;
+      uint32_t first_bracket = UINT32_MAX; // first '[' in the line, if any
+    };
+
+    // splits text into the lines terminated by '<br>' or '\n'; a trailing
+    // line without a terminator is left out
+    void index_lyric_lines(std::string_view text,
+        std::vector<line_span>& lines) {
+      std::vector<uint32_t> positions;
+      positions.reserve(text.size() / 16 + 16);
+      find_lyric_delimiters(text, positions);
+
+      line_span line;
+      for (uint32_t pos : positions) {
+        switch (text[pos]) {
+          case '[':
+            if (line.first_bracket == UINT32_MAX)
+              line.first_bracket = pos;
+            break;
+          case '<':
+            if (text.compare(pos, 4, "<br>") != 0)
+              break;
+            line.end = pos;
+            lines.push_back(line);
+            line = line_span();
+            line.begin = pos + 4;
+            break;
+          case '\n':
+            line.end = pos;
+            lines.push_back(line);
+            line = line_span();
+            line.begin = pos + 1;
+            break;
+        }
+      }
+    }
+  }
+
+  // folds titles and artists into cache keys so that spellings which only
+  // differ in case, character width, composition, spacing, punctuation or
+  // a "feat." credit map to the same key. Covers the scripts ALSong is
+  // used with (Latin, Greek, Cyrillic, Hangul, kana) rather than all of
+  // Unicode
+  namespace key_normalization
+  {
+    // decodes the code point at text[i] and advances i. An ill-formed
+    // sequence (overlong, a surrogate, past U+10FFFF, cut short) is
+    // returned as -1 and skipped by its maximal subpart, the bytes that
+    // one U+FFFD would replace
+    int32_t decode_utf8(std::string_view text, size_t& i) {
+      unsigned char c = static_cast<unsigned char>(text[i]);
+      if (c < 0x80) {
+        ++i;
+        return c;
+      }
+      // the second byte's range rules out overlong forms, surrogates and
+      // values past U+10FFFF
+      size_t length = 0;
+      unsigned char low = 0x80, high = 0xBF;
+      if (c >= 0xC2 && c <= 0xDF) {
+        length = 2;
+      } else if (c >= 0xE0 && c <= 0xEF) {
+        length = 3;
+        low = c == 0xE0 ? 0xA0 : 0x80;
+        high = c == 0xED ? 0x9F : 0xBF;
+      } else if (c >= 0xF0 && c <= 0xF4) {
+        length = 4;
+        low = c == 0xF0 ? 0x90 : 0x80;
+        high = c == 0xF4 ? 0x8F : 0xBF;
+      } else {
+        ++i;
+        return -1;
+      }
+      int32_t cp = c & (0x7F >> length);
+      size_t k = 1;
+      for (; k < length && i + k < text.size(); ++k) {
+        unsigned char next = static_cast<unsigned char>(text[i + k]);
+        if (next < low || next > high)
+          break;
+        cp = (cp << 6) | (next & 0x3F);
+        low = 0x80;
+        high = 0xBF;
+      }
+      i += k;
+      return k == length ? cp : -1;
+    }
+
+    // encodes cp as UTF-8; surrogates and values past U+10FFFF, which
+    // have no encoding, become U+FFFD
+    void append_utf8(std::string& output, uint32_t cp) {
+      if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF)
+        cp = 0xFFFD;
+      if (cp < 0x80) {
+        output += char(cp);
+      } else if (cp < 0x800) {
+        output += char(0xC0 | (cp >> 6));
+        output += char(0x80 | (cp & 0x3F));
+      } else if (cp < 0x10000) {
+        output += char(0xE0 | (cp >> 12));
+        output += char(0x80 | ((cp >> 6) & 0x3F));
+        output += char(0x80 | (cp & 0x3F));
+      } else {
+        output += char(0xF0 | (cp >> 18));
+        output += char(0x80 | ((cp >> 12) & 0x3F));
+        output += char(0x80 | ((cp >> 6) & 0x3F));
+        output += char(0x80 | (cp & 0x3F));
+      }
+    }
+
+    // full-width ASCII, the ideographic space and half-width katakana to
+    // their regular forms
+    uint32_t fold_width(uint32_t cp) {
+      static const uint16_t HALFWIDTH_KATAKANA[] = {
+        0x3002, 0x300C, 0x300D, 0x3001, 0x30FB, 0x30F2, 0x30A1, 0x30A3,
+        0x30A5, 0x30A7, 0x30A9, 0x30E3, 0x30E5, 0x30E7, 0x30C3, 0x30FC,
+        0x30A2, 0x30A4, 0x30A6, 0x30A8, 0x30AA, 0x30AB, 0x30AD, 0x30AF,
+        0x30B1, 0x30B3, 0x30B5, 0x30B7, 0x30B9, 0x30BB, 0x30BD, 0x30BF,
+        0x30C1, 0x30C4, 0x30C6, 0x30C8, 0x30CA, 0x30CB, 0x30CC, 0x30CD,
+        0x30CE, 0x30CF, 0x30D2, 0x30D5, 0x30D8, 0x30DB, 0x30DE, 0x30DF,
+        0x30E0, 0x30E1, 0x30E2, 0x30E4, 0x30E6, 0x30E8, 0x30E9, 0x30EA,
+        0x30EB, 0x30EC, 0x30ED, 0x30EF, 0x30F3, 0x3099, 0x309A
+      }; // U+FF61 to U+FF9F
+      if (cp >= 0xFF01 && cp <= 0xFF5E)
+        return cp - 0xFEE0;
+      if (cp >= 0xFF61 && cp <= 0xFF9F)
+        return HALFWIDTH_KATAKANA[cp - 0xFF61];
+      if (cp == 0x3000)
+        return ' ';
+      return cp;
+    }
+
+    uint32_t fold_case(uint32_t cp) {
+      if (cp < 0x80)
+        return (cp >= 'A' && cp <= 'Z') ? cp + 0x20 : cp;
+      if (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7)
+        return cp + 0x20;
+      if (cp >= 0x100 && cp <= 0x17F) {
+        if (cp == 0x178)
+          return 0xFF;
+        // the dotted capital I lower cases to a plain i, not the dotless one
+        if (cp == 0x130)
+          return 'i';
+        bool even_upper = (cp <= 0x137) || (cp >= 0x14A && cp <= 0x177);
+        if (even_upper && (cp & 1) == 0)
+          return cp + 1;
+        if (!even_upper && cp != 0x138 && cp != 0x149 && (cp & 1) == 1
+            && cp != 0x17F)
+          return cp + 1;
+        return cp;
+      }
+      if (cp >= 0x391 && cp <= 0x3A9 && cp != 0x3A2)
+        return cp + 0x20;
+      if (cp == 0x3C2)
+        return 0x3C3;
+      if (cp >= 0x410 && cp <= 0x42F)
+        return cp + 0x20;
+      if (cp >= 0x400 && cp <= 0x40F)
+        return cp + 0x50;
+      return cp;
+    }
+
+    // the precomposed form of base followed by a combining mark, or 0;
+    // bases are already case folded, so only lower case forms are needed
+    uint32_t compose(uint32_t base, uint32_t mark) {
+      // Hangul syllables from conjoining jamo
+      if (base >= 0x1100 && base <= 0x1112 && mark >= 0x1161 && mark <= 0x1175)
+        return 0xAC00 + ((base - 0x1100) * 21 + (mark - 0x1161)) * 28;
+      if (base >= 0xAC00 && base <= 0xD7A3 && (base - 0xAC00) % 28 == 0
+          && mark >= 0x11A8 && mark <= 0x11C2)
+        return base + (mark - 0x11A7);
+
+      // kana with (semi-)voiced sound marks
+      if (mark == 0x3099 || mark == 0x309A) {
+        bool katakana = base >= 0x30A1 && base <= 0x30FE;
+        uint32_t b = katakana ? base - 0x60 : base;
+        bool h_row = b >= 0x306F && b <= 0x307B && (b - 0x306F) % 3 == 0;
+        uint32_t result = 0;
+        if (mark == 0x309A)
+          result = h_row ? b + 2 : 0;
+        else if ((b >= 0x304B && b <= 0x3061 && (b & 1) == 1)
+            || b == 0x3064 || b == 0x3066 || b == 0x3068 || h_row
+            || b == 0x309D)
+          result = b + 1;
+        else if (b == 0x3046)
+          result = 0x3094;
+        return result != 0 && katakana ? result + 0x60 : result;
+      }
+
+      static const struct { char base; uint16_t mark; uint16_t result; } LATIN[] = {
+        {'a', 0x300, 0xE0}, {'a', 0x301, 0xE1}, {'a', 0x302, 0xE2},
+        {'a', 0x303, 0xE3}, {'a', 0x308, 0xE4}, {'a', 0x30A, 0xE5},
+        {'c', 0x327, 0xE7}, {'c', 0x30C, 0x10D},
+        {'e', 0x300, 0xE8}, {'e', 0x301, 0xE9}, {'e', 0x302, 0xEA},
+        {'e', 0x308, 0xEB}, {'e', 0x30C, 0x11B},
+        {'i', 0x300, 0xEC}, {'i', 0x301, 0xED}, {'i', 0x302, 0xEE},
+        {'i', 0x308, 0xEF}, {'n', 0x303, 0xF1},
+        {'o', 0x300, 0xF2}, {'o', 0x301, 0xF3}, {'o', 0x302, 0xF4},
+        {'o', 0x303, 0xF5}, {'o', 0x308, 0xF6}, {'r', 0x30C, 0x159},
+        {'s', 0x30C, 0x161},
+        {'u', 0x300, 0xF9}, {'u', 0x301, 0xFA}, {'u', 0x302, 0xFB},
+        {'u', 0x308, 0xFC}, {'y', 0x301, 0xFD}, {'y', 0x308, 0xFF},
+        {'z', 0x30C, 0x17E}
+      };
+      if (base < 0x80 && mark >= 0x300 && mark <= 0x36F)
+        for (const auto& entry : LATIN)
+          if (uint32_t(entry.base) == base && entry.mark == mark)
+            return entry.result;
+      return 0;
+    }
+
+    bool is_space(uint32_t cp) {
+      return cp == ' ' || (cp >= '\t' && cp <= '\r') || cp == 0xA0
+        || (cp >= 0x2000 && cp <= 0x200B) || cp == 0x202F || cp == 0x205F;
+    }
+
+    // apostrophes are dropped so "boy's" and "boys" match
+    bool is_apostrophe(uint32_t cp) {
+      return cp == '\'' || cp == '`' || cp == 0x2018 || cp == 0x2019 || cp == 0xB4;
+    }
+
+    bool is_punctuation(uint32_t cp) {
+      if (cp < 0x80)
+        return !((cp >= '0' && cp <= '9') || (cp >= 'a' && cp <= 'z')
+            || (cp >= 'A' && cp <= 'Z') || cp >= 0x80) && cp > ' ';
+      return (cp >= 0xA1 && cp <= 0xBF && cp != 0xAA && cp != 0xB5 && cp != 0xBA
+            && cp != 0xB2 && cp != 0xB3 && cp != 0xB9 && (cp < 0xBC || cp > 0xBE))
+        || cp == 0xD7 || cp == 0xF7
+        || (cp >= 0x2010 && cp <= 0x205E)
+        || (cp >= 0x3001 && cp <= 0x3003) || (cp >= 0x3008 && cp <= 0x3011)
+        || (cp >= 0x3014 && cp <= 0x301F) || cp == 0x30FB
+        || (cp >= 0xFE30 && cp <= 0xFE4F);
+    }
+
+    inline bool is_ascii_alnum(unsigned char c) {
+      return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+        || (c >= 'A' && c <= 'Z');
+    }
+
+    // appends the lower cased run of ASCII letters and digits starting at
+    // text[i], returns its length
+    size_t append_ascii_run_scalar(std::string_view text, size_t i,
+        std::string& output) {
+      size_t begin = i;
+      for (; i < text.size() && is_ascii_alnum(text[i]); ++i) {
+        char c = text[i];
+        output += (c >= 'A' && c <= 'Z') ? char(c + 0x20) : c;
+      }
+      return i - begin;
+    }
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __attribute__((target("sse2")))
+    size_t append_ascii_run_sse2(std::string_view text, size_t i,
+        std::string& output) {
+      size_t begin = i;
+      for (; i + 16 <= text.size(); i += 16) {
+        __m128i block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(text.data() + i));
+        // bytes >= 0x80 compare as negative and fall out of every range
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)),
+            _mm_cmplt_epi8(block, _mm_set1_epi8('Z' + 1)));
+        __m128i lower = _mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+            _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('0' - 1)),
+            _mm_cmplt_epi8(block, _mm_set1_epi8('9' + 1)));
+        unsigned int mask = unsigned(_mm_movemask_epi8(_mm_or_si128(letter, digit)));
+        alignas(16) char lowered[16];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lowered), lower);
+        if (mask != 0xFFFF) {
+          output.append(lowered, __builtin_ctz(~mask));
+          return i + __builtin_ctz(~mask) - begin;
+        }
+        output.append(lowered, 16);
+      }
+      return i - begin + append_ascii_run_scalar(text, i, output);
+    }
+#endif
+
+    size_t append_ascii_run(std::string_view text, size_t i,
+        std::string& output) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+      static const bool has_sse2 = __builtin_cpu_supports("sse2");
+      if (has_sse2)
+        return append_ascii_run_sse2(text, i, output);
+#endif
+      return append_ascii_run_scalar(text, i, output);
+    }
+
+    // appends the normalised form of one field: NFC for the covered
+    // scripts, case and width folded, punctuation turned into spaces and
+    // whitespace collapsed. Everything from a featured artist credit on is
+    // dropped; "feat" and "ft" only count as one when bracketed or followed
+    // by a dot, as in "(feat X)" or " ft. X", so "Heroic Feat of X" stays
+    void normalise(std::string_view text, std::string& output) {
+      struct word
+      {
+        size_t pos;             // in output
+        bool bracketed;         // right after an opening bracket
+        bool dotted;            // followed by a dot
+      };
+
+      size_t start = output.size();
+      bool pending_space = false;
+      bool opened = false;      // an opening bracket since the last word
+      int32_t last = -1;        // last code point written
+      size_t last_pos = start;  // and where it starts in output
+      std::vector<word> words;
+
+      auto begin_word = [&]() {
+        if (pending_space || output.size() == start) {
+          if (output.size() > start)
+            output += ' ';
+          words.push_back({output.size(), opened, false});
+          pending_space = false;
+          opened = false;
+        }
+      };
+
+      for (size_t i = 0; i < text.size(); ) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (is_ascii_alnum(c)) {
+          begin_word();
+          i += append_ascii_run(text, i, output);
+          last_pos = output.size() - 1;
+          last = static_cast<unsigned char>(output.back());
+          continue;
+        }
+
+        size_t begin = i;
+        int32_t cp = decode_utf8(text, i);
+        if (cp < 0) {
+          // kept as is so that distinct byte strings stay distinct
+          begin_word();
+          last_pos = output.size();
+          output.append(text.data() + begin, i - begin);
+          last = -1;
+          continue;
+        }
+
+        uint32_t u = fold_case(fold_width(uint32_t(cp)));
+        if (last >= 0 && !pending_space) {
+          uint32_t composed = compose(uint32_t(last), u);
+          if (composed != 0) {
+            output.resize(last_pos);
+            append_utf8(output, composed);
+            last = int32_t(composed);
+            continue;
+          }
+        }
+        if (is_apostrophe(u))
+          continue;
+        if (is_space(u) || is_punctuation(u)) {
+          if (u == '.' && !pending_space && !words.empty())
+            words.back().dotted = true;
+          else if (u == '(' || u == '[' || u == '{')
+            opened = true;
+          pending_space = true;
+          continue;
+        }
+        begin_word();
+        last_pos = output.size();
+        append_utf8(output, u);
+        last = int32_t(u);
+      }
+
+      for (size_t w = 1; w < words.size(); ++w) {
+        std::string_view name(output.data() + words[w].pos,
+            (w + 1 < words.size() ? words[w + 1].pos - 1 : output.size())
+            - words[w].pos);
+        bool marker = name == "featuring" || ((name == "feat" || name == "ft")
+            && (words[w].bracketed || words[w].dotted));
+        if (marker) {
+          output.resize(words[w].pos - 1);
+          break;
+        }
+      }
+    }
+
+    // FNV-1a 64, stable across runs and platforms. Continues from seed,
+    // so hash(b, hash(a)) is the hash of a followed by b
+    uint64_t hash(std::string_view key,
+        uint64_t seed = 14695981039346656037ULL) {
+      uint64_t hash = seed;
+      for (unsigned char c : key)
+        hash = (hash ^ c) * 1099511628211ULL;
+      return hash;
+    }
+
+    // relative path for a key, sharded by the first byte of its hash:
+    //   'hh/hhhhhhhhhhhhhhhh artist - title<extension>'
+    // the readable part is made safe for any file system and cut to a
+    // bounded length, the hash keeps it unique
+    std::string sharded_filename(std::string_view key,
+        std::string_view extension) {
+      static const char HEX[] = "0123456789abcdef";
+      uint64_t h = hash(key);
+      char digits[16];
+      for (int i = 0; i < 16; ++i)
+        digits[i] = HEX[(h >> (60 - 4 * i)) & 0xF];
+
+      std::string name;
+      name.reserve(20 + std::min<size_t>(key.size(), 96) + extension.size());
+      name.append(digits, 2);
+      name += '/';
+      name.append(digits, 16);
+      name += ' ';
+
+      size_t limit = name.size() + 96;
+      for (size_t i = 0; i < key.size() && name.size() < limit; ) {
+        size_t begin = i;
+        int32_t cp = decode_utf8(key, i);
+        if (cp == '\x1f')
+          name += " - ";
+        else if (cp < 0x20 || cp == '/' || cp == '\\' || cp == ':' || cp == '*'
+            || cp == '?' || cp == '"' || cp == '<' || cp == '>' || cp == '|'
+            || cp == 0x7F)
+          name += '_';
+        else
+          name.append(key.data() + begin, i - begin);
+      }
+      while (!name.empty() && (name.back() == ' ' || name.back() == '.'))
+        name.pop_back();
+      name += extension;
+      return name;
+    }
+  }
+
   namespace alsong
   {
     const std::string ALSONG_LYRICS_FETCHER_VERSION =
@@ -86,21 +637,294 @@ namespace moonk5
       std::to_string(ALSONG_LYRICS_FETCHER_MINOR) + "." +
       std::to_string(ALSONG_LYRICS_FETCHER_PATCH);
 
+    // per-stage spans for finding where a lookup spends its time. Each
+    // thread appends to a ring of its last RING_SIZE spans without taking
+    // a lock; while tracing is off a span costs one relaxed load. The
+    // spans of all threads export as Chrome trace JSON, also while they
+    // are being written: every slot carries a sequence number, and spans
+    // that change while they are read are left out. The rings of exited
+    // threads stay exportable until MAX_RETIRED newer ones replace them
+    class tracer
+    {
+      public:
+        struct event
+        {
+          const char *name = nullptr;   // a string literal
+          int64_t begin_us = 0;         // since the tracer started
+          int64_t duration_us = 0;
+        };
+
+        // times the enclosing scope
+        class span
+        {
+          public:
+            explicit span(const char *stage)
+              : name(tracer::enabled() ? stage : nullptr),
+                begin_us(name != nullptr ? tracer::now_us() : 0) {
+            }
+
+            ~span() {
+              if (name != nullptr)
+                tracer::record(name, begin_us, tracer::now_us());
+            }
+
+            span(const span&) = delete;
+            span& operator=(const span&) = delete;
+
+          private:
+            const char *name;
+            int64_t begin_us;
+        }; // class moonk5::alsong::tracer::span
+
+        static void enable(bool on) {
+          origin();
+          flag().store(on, std::memory_order_relaxed);
+        }
+
+        static bool enabled() {
+          return flag().load(std::memory_order_relaxed);
+        }
+
+        static int64_t now_us() {
+          return int64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - origin()).count());
+        }
+
+        // appends a span to the calling thread's ring, overwriting its
+        // oldest one once the ring is full
+        static void record(const char *name, int64_t begin_us, int64_t end_us) {
+          ring& r = local_ring();
+          uint64_t head = r.head.load(std::memory_order_relaxed);
+          slot& s = r.slots[head % RING_SIZE];
+          // odd while the slot is written, 2 * (span + 1) once span is in
+          s.sequence.store(2 * head + 1, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_release);
+          s.name.store(name, std::memory_order_relaxed);
+          s.begin_us.store(begin_us, std::memory_order_relaxed);
+          s.duration_us.store(end_us - begin_us, std::memory_order_relaxed);
+          s.sequence.store(2 * head + 2, std::memory_order_release);
+          r.head.store(head + 1, std::memory_order_release);
+        }
+
+        // {"traceEvents":[...]} with one complete event per span, for
+        // chrome://tracing or Perfetto
+        static void write_chrome_trace(std::ostream& os) {
+          std::vector<std::shared_ptr<ring>> all;
+          {
+            registry& r = rings();
+            std::lock_guard<std::mutex> guard(r.mutex);
+            all = r.rings;
+          }
+
+          os << "{\"traceEvents\":[";
+          bool first = true;
+          std::vector<event> events;
+          for (const std::shared_ptr<ring>& r : all) {
+            uint64_t head = r->head.load(std::memory_order_acquire);
+            uint64_t begin = head > RING_SIZE ? head - RING_SIZE : 0;
+            events.clear();
+            for (uint64_t i = begin; i < head; ++i) {
+              // spans the owner overwrites while they are copied are dropped
+              const slot& s = r->slots[i % RING_SIZE];
+              uint64_t sequence = s.sequence.load(std::memory_order_acquire);
+              if (sequence != 2 * i + 2)
+                continue;
+              event e;
+              e.name = s.name.load(std::memory_order_relaxed);
+              e.begin_us = s.begin_us.load(std::memory_order_relaxed);
+              e.duration_us = s.duration_us.load(std::memory_order_relaxed);
+              std::atomic_thread_fence(std::memory_order_acquire);
+              if (s.sequence.load(std::memory_order_relaxed) == sequence)
+                events.push_back(e);
+            }
+            for (const event& e : events) {
+              os << (first ? "" : ",") << "\n{\"name\":\"" << e.name
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << r->thread
+                << ",\"ts\":" << e.begin_us << ",\"dur\":" << e.duration_us << "}";
+              first = false;
+            }
+          }
+          os << "\n]}\n";
+        }
+
+        static bool write_chrome_trace(const std::string& path) {
+          std::ofstream ofs(path);
+          if (!ofs) {
+            std::cerr << "moonk5::alsong::tracer::write_chrome_trace() - "
+              << "cannot open " << path << "\n";
+            return false;
+          }
+          write_chrome_trace(ofs);
+          return bool(ofs);
+        }
+
+        // spans thrown away with the rings of exited threads
+        static uint64_t dropped_spans() {
+          registry& r = rings();
+          std::lock_guard<std::mutex> guard(r.mutex);
+          return r.dropped;
+        }
+
+      private:
+        static constexpr uint64_t RING_SIZE = 4096;
+        static constexpr size_t MAX_RETIRED = 16;
+
+        // an event whose fields may be read while its thread rewrites them
+        struct slot
+        {
+          std::atomic<uint64_t> sequence{0};
+          std::atomic<const char *> name{nullptr};
+          std::atomic<int64_t> begin_us{0};
+          std::atomic<int64_t> duration_us{0};
+        };
+
+        // written only by its thread; kept for a while after the thread
+        // exits so its spans can still be exported
+        struct ring
+        {
+          uint32_t thread = 0;
+          std::atomic<uint64_t> head{0};
+          slot slots[RING_SIZE];
+        };
+
+        struct registry
+        {
+          std::mutex mutex;
+          std::vector<std::shared_ptr<ring>> rings;
+          std::deque<std::shared_ptr<ring>> retired;  // oldest first
+          uint32_t next_thread = 1;
+          uint64_t dropped = 0;
+        };
+
+        // the calling thread's ring, retired when the thread exits
+        struct ring_holder
+        {
+          std::shared_ptr<ring> r;
+
+          ring_holder() : r(std::make_shared<ring>()) {
+            registry& reg = rings();
+            std::lock_guard<std::mutex> guard(reg.mutex);
+            r->thread = reg.next_thread++;
+            reg.rings.push_back(r);
+          }
+
+          // past MAX_RETIRED the oldest retired ring is released; an
+          // export still holding it keeps it alive until it is done
+          ~ring_holder() {
+            registry& reg = rings();
+            std::lock_guard<std::mutex> guard(reg.mutex);
+            reg.retired.push_back(r);
+            if (reg.retired.size() <= MAX_RETIRED)
+              return;
+            std::shared_ptr<ring> oldest = reg.retired.front();
+            reg.retired.pop_front();
+            reg.dropped += std::min(
+                oldest->head.load(std::memory_order_relaxed), RING_SIZE);
+            reg.rings.erase(std::find(reg.rings.begin(), reg.rings.end(),
+                  oldest));
+          }
+        };
+
+        static std::atomic<bool>& flag() {
+          static std::atomic<bool> on{false};
+          return on;
+        }
+
+        static std::chrono::steady_clock::time_point origin() {
+          static const std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+          return start;
+        }
+
+        static registry& rings() {
+          static registry r;
+          return r;
+        }
+
+        static ring& local_ring() {
+          thread_local ring_holder local;
+          return *local.r;
+        }
+    }; // class moonk5::alsong::tracer
+
+    // appends text to output as a quoted JSON string, escaping in one pass
+    void append_json_string(std::string& output, std::string_view text) {
+      static const char HEX[] = "0123456789abcdef";
+      output += '"';
+      size_t begin = 0;
+      for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c != '"' && c != '\\')
+          continue;
+        output.append(text.data() + begin, i - begin);
+        switch (c) {
+          case '"': output += "\\\""; break;
+          case '\\': output += "\\\\"; break;
+          case '\n': output += "\\n"; break;
+          case '\r': output += "\\r"; break;
+          case '\t': output += "\\t"; break;
+          case '\b': output += "\\b"; break;
+          case '\f': output += "\\f"; break;
+          default:
+            output += "\\u00";
+            output += HEX[c >> 4];
+            output += HEX[c & 0xF];
+        }
+        begin = i + 1;
+      }
+      output.append(text.data() + begin, text.size() - begin);
+      output += '"';
+    }
+
+    // appends "key":"value",
+    void append_json_field(std::string& output, std::string_view key,
+        std::string_view value) {
+      output += '"';
+      output += key;
+      output += "\":";
+      append_json_string(output, value);
+      output += ',';
+    }
+
     struct time_lyrics
     {
       unsigned int time = 0; // unit in milliseconds
       std::vector<std::string> lyrics;
 
-      std::string to_json_string() {
-        std::string str_json = "{\"time\":\""
-          + time_conversion::to_simple_string(time)
-          + "\",\"lyrics\":[";
-        for (std::string l : lyrics)
-          str_json += "\"" + l + "\",";
-        str_json.replace(str_json.size()-1, 1, 1, ']');
-        str_json += "}";
+      // appends this object as JSON to output
+      void write_json(std::string& output) const {
+        output += "{\"time\":\"";
+        output += time_conversion::to_simple_string(time);
+        output += "\",\"lyrics\":[";
+        for (const std::string& l : lyrics) {
+          append_json_string(output, l);
+          output += ',';
+        }
+        close_json_array(output);
+        output += '}';
+      }
+
+      size_t json_size_estimate() const {
+        size_t size = 32;
+        for (const std::string& l : lyrics)
+          size += l.size() + 3;
+        return size;
+      }
+
+      std::string to_json_string() const {
+        std::string str_json;
+        str_json.reserve(json_size_estimate());
+        write_json(str_json);
         return str_json;
       }
+
+      // replaces a trailing ',' with ']', or closes an empty array
+      static void close_json_array(std::string& output) {
+        if (output.back() == ',')
+          output.back() = ']';
+        else
+          output += ']';
+      }
     }; // struct moonk5::alsong::time_lyrics
 
     struct song_list
@@ -110,13 +934,20 @@ namespace moonk5
       std::string artist = "";
       std::string album = "";
       
-      std::string to_json_string() {
-        std::string str_json = "{";
-        str_json += "\"lyric_id\":\"" + lyric_id + "\",";
-        str_json += "\"title\":\"" + title + "\",";
-        str_json += "\"artist\":\"" + artist + "\",";
-        str_json += "\"album\":\"" + album + "\",";
-        str_json += "}";
+      void write_json(std::string& output) const {
+        output += '{';
+        append_json_field(output, "lyric_id", lyric_id);
+        append_json_field(output, "title", title);
+        append_json_field(output, "artist", artist);
+        append_json_field(output, "album", album);
+        output.back() = '}';
+      }
+
+      std::string to_json_string() const {
+        std::string str_json;
+        str_json.reserve(64 + lyric_id.size() + title.size() + artist.size()
+            + album.size());
+        write_json(str_json);
         return str_json;
       }
 
@@ -133,7 +964,7 @@ namespace moonk5
       unsigned int language_count = 0;
       std::vector<time_lyrics> lyrics_collection;
 
-      void add_lyrics(const std::string& time, const std::string& lyrics) {
+      void add_lyrics(std::string_view time, std::string_view lyrics) {
         // convert string time (mm:ss.SS) to milliseconds
         unsigned int ms = time_conversion::to_milliseconds(time);
         // compare time with previous timestamp
@@ -141,234 +972,3457 @@ namespace moonk5
         // the user wants to support multi-languages or multi-lines
         if (lyrics_collection.size() > 0 && ms == lyrics_collection.back().time) {
           // case #1 : multi-languages or multi-lines
-          lyrics_collection.back().lyrics.push_back(lyrics);
+          lyrics_collection.back().lyrics.emplace_back(lyrics);
         } else {
           // case #2 : either first or only one line of lyrics for specific time
           alsong::time_lyrics obj;
           obj.time = ms;
-          obj.lyrics.push_back(lyrics);
+          obj.lyrics.emplace_back(lyrics);
           lyrics_collection.push_back(obj);
         }
       }
 
-      std::string to_json_string() {
-        std::string str_json = "{";
-        str_json += "\"lyric_id\":\"" + lyric_id + "\",";
-        str_json += "\"title\":\"" + title + "\",";
-        str_json += "\"artist\":\"" + artist + "\",";
-        str_json += "\"album\":\"" + album + "\",";
-        str_json += "\"written_by\":\"" + written_by + "\",";
-        str_json += "\"delay\":" + std::to_string(delay) + ",";
-        str_json += "\"lyrics\":[";
-        for (alsong::time_lyrics tl : lyrics_collection)
-          str_json += tl.to_json_string() + ",";
-        str_json.replace(str_json.size()-1, 1, 1, ']');
-        str_json += "}";
-        return str_json;
+      void write_json(std::string& output) const {
+        output += '{';
+        append_json_field(output, "lyric_id", lyric_id);
+        append_json_field(output, "title", title);
+        append_json_field(output, "artist", artist);
+        append_json_field(output, "album", album);
+        append_json_field(output, "written_by", written_by);
+        output += "\"delay\":";
+        output += std::to_string(delay);
+        output += ",\"lyrics\":[";
+        for (const alsong::time_lyrics& tl : lyrics_collection) {
+          tl.write_json(output);
+          output += ',';
+        }
+        time_lyrics::close_json_array(output);
+        output += '}';
       }
-    }; // struct moonk5::alsong::song_info
-
-    struct lyrics_fetcher
-    {
-      const std::string URL =
-        "http://lyrics.alsong.co.kr/alsongwebservice/service1.asmx";
-
-      const std::string ENC_DATA =
-        "7c2d15b8f51ac2f3b2a37d7a445c3158455defb8a58d621eb77a3ff8ae4921318e49cefe24e515f79892a4c29c9a3e204358698c1cfe79c151c04f9561e945096ccd1d1c0a8d8f265a2f3fa7995939b21d8f663b246bbc433c7589da7e68047524b80e16f9671b6ea0faaf9d6cde1b7dbcf1b89aa8a1d67a8bbc566664342e12";
-
-      const std::string SOAP_TEMPLATE_LYRIC_LIST =
-        R"(<SOAP-ENV:Envelope
-           xmlns:SOAP-ENV="http://www.w3.org/2003/05/soap-envelope"
-           xmlns:SOAP-ENC="http://www.w3.org/2003/05/soap-encoding"
-           xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"
-           xmlns:xsd="http://www.w3.org/2001/XMLSchema"
-           xmlns:ns2="ALSongWebServer/Service1Soap"
-           xmlns:ns1="ALSongWebServer"
-           xmlns:ns3="ALSongWebServer/Service1Soap12">
-           <SOAP-ENV:Body>
-           <ns1:GetResembleLyricList2>
-           <ns1:encData>$encdata</ns1:encData>
-           <ns1:title>$title</ns1:title>
-           <ns1:artist>$artist</ns1:artist>
-           <ns1:pageNo>1</ns1:pageNo>
-           </ns1:GetResembleLyricList2>
-           </SOAP-ENV:Body>
-           </SOAP-ENV:Envelope>
-          )";
-      
-      const std::string SOAP_TEMPLATE_LYRIC_BY_ID =
-        R"(<SOAP-ENV:Envelope
-           xmlns:SOAP-ENV="http://www.w3.org/2003/05/soap-envelope"
-           xmlns:SOAP-ENC="http://www.w3.org/2003/05/soap-encoding"
-           xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"
-           xmlns:xsd="http://www.w3.org/2001/XMLSchema"
-           xmlns:ns2="ALSongWebServer/Service1Soap"
-           xmlns:ns1="ALSongWebServer"
-           xmlns:ns3="ALSongWebServer/Service1Soap12">
-           <SOAP-ENV:Body>
-           <ns1:GetLyricByID2>
-           <ns1:encData>$encdata</ns1:encData>
-           <ns1:lyricID>$lyricId</ns1:lyricID>
-           </ns1:GetLyricByID2>
-           </SOAP-ENV:Body>
-           </SOAP-ENV:Envelope>
-          )";
 
-     
-      CURLcode _fetch(const std::string& soap, std::string &output, unsigned timeout=10) {
-        CURLcode result;
-        CURL  *curl = curl_easy_init();
-        
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers,
-            "Content-Type: application/soap+xml; charset=utf-8");
-        headers = curl_slist_append(headers, "Accept: text/plain");
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, soap.length());
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, soap.c_str());
-        curl_easy_setopt(curl, CURLOPT_URL, URL.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &output);
-        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
-        result = curl_easy_perform(curl);
-        
-        curl_easy_cleanup(curl);
-        
-        return result;
+      // rough upper bound of the JSON size, used to reserve buffers
+      size_t json_size_estimate() const {
+        size_t size = 128 + lyric_id.size() + title.size() + artist.size()
+          + album.size() + written_by.size();
+        for (const alsong::time_lyrics& tl : lyrics_collection)
+          size += tl.json_size_estimate();
+        return size + size / 16;
       }
 
-      CURLcode fetch_lyric_list(const std::string& title, const std::string& artist,
-          std::string &output) {
-        CURLcode result;
-        if (title.empty() || artist.empty())
-          return result;
-        
-        std::string soap(SOAP_TEMPLATE_LYRIC_LIST);
-        soap = std::regex_replace(soap, std::regex("\\$encdata"), ENC_DATA);
-        soap = std::regex_replace(soap, std::regex("\\$title"), title);
-        soap = std::regex_replace(soap, std::regex("\\$artist"), artist);
-        
-        return _fetch(soap, output, 20);
+      std::string to_json_string() const {
+        tracer::span span("json");
+        std::string str_json;
+        str_json.reserve(json_size_estimate());
+        write_json(str_json);
+        return str_json;
       }
 
-      CURLcode fetch_lyric(const std::string& lyric_id, std::string &output) {
-        CURLcode result;
-        if (lyric_id.empty()) 
-          return result;  
-
-        std::string soap(SOAP_TEMPLATE_LYRIC_BY_ID);
-        soap = std::regex_replace(soap, std::regex("\\$encdata"), ENC_DATA);
-        soap = std::regex_replace(soap, std::regex("\\$lyricId"), lyric_id);
-        
-        return _fetch(soap, output, 20);
+      // approximate heap and object bytes held by this song
+      size_t memory_size() const {
+        size_t size = sizeof(song_info) + lyric_id.capacity() + title.capacity()
+          + artist.capacity() + album.capacity() + written_by.capacity()
+          + lyrics_collection.capacity() * sizeof(time_lyrics);
+        for (const alsong::time_lyrics& tl : lyrics_collection) {
+          size += tl.lyrics.capacity() * sizeof(std::string);
+          for (const std::string& l : tl.lyrics)
+            size += l.capacity();
+        }
+        return size;
       }
+    }; // struct moonk5::alsong::song_info
 
-    private:
-      static size_t write_data(char *buffer, size_t size,
-          size_t nmemb, void *data) {
-        size_t result = size * nmemb;
-        static_cast<std::string *>(data)->append(buffer, result);
-        return result;
-      }  
-    }; // struct moonk5::alsong::lyrics_fetcher
+    // appends text to output with the five XML special characters escaped
+    void append_xml_escaped(std::string& output, std::string_view text) {
+      size_t begin = 0;
+      for (size_t i = 0; i < text.size(); ++i) {
+        const char *entity = nullptr;
+        switch (text[i]) {
+          case '&': entity = "&amp;"; break;
+          case '<': entity = "&lt;"; break;
+          case '>': entity = "&gt;"; break;
+          case '"': entity = "&quot;"; break;
+          case '\'': entity = "&apos;"; break;
+          default: continue;
+        }
+        output.append(text.data() + begin, i - begin);
+        output.append(entity);
+        begin = i + 1;
+      }
+      output.append(text.data() + begin, text.size() - begin);
+    }
 
-    class lyrics_serializer
+    // a SOAP envelope with $name placeholders, split into literal segments
+    // once so that rendering is a single pass into one pre-sized buffer
+    class soap_template
     {
       public:
-        std::vector<alsong::song_list> song_list_collection;
-        std::vector<alsong::song_info> song_collection;
-
-      public:
-        lyrics_serializer(const std::string& lyrics_path,
-            unsigned int lyrics_count=3) {
-          set_lyrics_folder_path(lyrics_path);
-          max_lyrics_count = lyrics_count;
+        soap_template(const std::string& source,
+            const std::vector<std::string>& names) {
+          std::string literal;
+          size_t i = 0;
+          while (i < source.size()) {
+            if (source[i] == '$') {
+              size_t end = i + 1;
+              while (end < source.size() &&
+                  (std::isalnum(static_cast<unsigned char>(source[end]))
+                   || source[end] == '_'))
+                ++end;
+              auto it = std::find(names.begin(), names.end(),
+                  source.substr(i + 1, end - i - 1));
+              if (it != names.end()) {
+                segments.push_back({literal, int(it - names.begin())});
+                literal_size += literal.size();
+                literal.clear();
+                i = end;
+                continue;
+              }
+            }
+            literal += source[i++];
+          }
+          segments.push_back({literal, -1});
+          literal_size += literal.size();
         }
 
-        lyrics_serializer(unsigned int lyrics_count=3)
-          : lyrics_serializer(std::string(getenv("HOME")) + "/.alsong",
-              lyrics_count) {
+        // values are given in the same order as the names passed to the
+        // constructor and are XML-escaped on the way in
+        std::string render(std::initializer_list<std::string_view> values) const {
+          const std::string_view *fields = values.begin();
+          size_t size = literal_size;
+          for (const std::string_view& v : values)
+            size += v.size();
 
+          std::string output;
+          output.reserve(size + size / 8);
+          for (const segment& seg : segments) {
+            output += seg.literal;
+            if (seg.field >= 0 && size_t(seg.field) < values.size())
+              append_xml_escaped(output, fields[seg.field]);
           }
+          return output;
+        }
 
-        bool parse_lyric_list(const std::string& alsong_raw) {
-          int count = 0;
-          tinyxml2::XMLDocument doc;
-          doc.Parse(alsong_raw.c_str(), alsong_raw.size());
-          
-          if (alsong_raw.find("GetResembleLyricList2Result") == std::string::npos) {
-            std::cerr << "SOAP Fault: missing tag, GetResembleLyricList2Result\n";
+      private:
+        struct segment
+        {
+          std::string literal;
+          int field; // index of the placeholder after the literal, or -1
+        };
+
+        std::vector<segment> segments;
+        size_t literal_size = 0;
+    }; // class moonk5::alsong::soap_template
+
+    // the code point of a character reference's name ("#65", "#x41"), or
+    // -1 unless it is all digits and names a character: not 0, not a
+    // surrogate and not past U+10FFFF
+    int32_t character_reference(std::string_view entity) {
+      if (entity.size() < 2 || entity[0] != '#')
+        return -1;
+      bool hex = entity[1] == 'x' || entity[1] == 'X';
+      std::string_view digits = entity.substr(hex ? 2 : 1);
+      if (digits.empty())
+        return -1;
+      uint32_t cp = 0;
+      for (char c : digits) {
+        int digit = c >= '0' && c <= '9' ? c - '0'
+          : hex && c >= 'a' && c <= 'f' ? c - 'a' + 10
+          : hex && c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0)
+          return -1;
+        cp = cp * (hex ? 16 : 10) + uint32_t(digit);
+        if (cp > 0x10FFFF)
+          return -1;
+      }
+      if (cp == 0 || (cp >= 0xD800 && cp <= 0xDFFF))
+        return -1;
+      return int32_t(cp);
+    }
+
+    // appends text to output with XML entity and character references
+    // decoded
+    void append_xml_unescaped(std::string& output, std::string_view text) {
+      size_t i = 0;
+      while (i < text.size()) {
+        size_t amp = text.find('&', i);
+        if (amp == std::string_view::npos) {
+          output.append(text.data() + i, text.size() - i);
+          break;
+        }
+        output.append(text.data() + i, amp - i);
+        size_t semi = text.find(';', amp);
+        if (semi == std::string_view::npos) {
+          output.append(text.data() + amp, text.size() - amp);
+          break;
+        }
+        std::string_view entity = text.substr(amp + 1, semi - amp - 1);
+        if (entity == "lt") output += '<';
+        else if (entity == "gt") output += '>';
+        else if (entity == "amp") output += '&';
+        else if (entity == "quot") output += '"';
+        else if (entity == "apos") output += '\'';
+        else if (int32_t cp = character_reference(entity); cp > 0)
+          key_normalization::append_utf8(output, uint32_t(cp));
+        else {
+          // unknown entity or a reference to no character, keep it as is
+          output.append(text.data() + amp, semi - amp + 1);
+        }
+        i = semi + 1;
+      }
+    }
+
+    // appends the text content of an element the way an XML parser reports
+    // it: line endings normalised to '\n', then references decoded
+    void append_xml_text(std::string& output, std::string_view text) {
+      if (text.find('\r') == std::string_view::npos)
+        return append_xml_unescaped(output, text);
+
+      std::string normalised;
+      normalised.reserve(text.size());
+      for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '\r') {
+          normalised += text[i];
+          continue;
+        }
+        normalised += '\n';
+        if (i + 1 < text.size() && text[i + 1] == '\n')
+          ++i;
+      }
+      append_xml_unescaped(output, normalised);
+    }
+
+    // DOM-free extraction for the two fixed ALSong response shapes; it
+    // jumps between the known tags and only decodes the fields it returns.
+    // Anything it does not expect (comments, CDATA, attributes or child
+    // elements in fields, a missing close tag) is reported as an anomaly
+    // so the caller can fall back to a full XML parser
+    namespace soap_extract
+    {
+      enum class found { yes, no, anomaly };
+
+      // finds the first <name>...</name> or empty <name/> in xml; content
+      // receives the raw text between the tags and after the offset just
+      // past the element. A leaf must contain text only, a container is
+      // closed by the first </name>
+      found find_element(std::string_view xml, std::string_view name,
+          std::string_view& content, size_t& after, bool leaf=true) {
+        size_t pos = 0;
+        while ((pos = xml.find('<', pos)) != std::string_view::npos) {
+          size_t end = pos + 1 + name.size();
+          if (xml.compare(pos + 1, name.size(), name) != 0
+              || end >= xml.size()) {
+            ++pos;
+            continue;
+          }
+
+          char c = xml[end];
+          if (c == '/' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            // only an empty element is expected here, attributes or not
+            size_t gt = xml.find('>', end);
+            if (gt == std::string_view::npos || xml[gt - 1] != '/')
+              return found::anomaly;
+            content = std::string_view();
+            after = gt + 1;
+            return found::yes;
+          }
+          if (c != '>') {
+            // a longer tag sharing the prefix, e.g. <lyricID> for <lyric>
+            ++pos;
+            continue;
+          }
+
+          size_t begin = end + 1;
+          size_t close = xml.find(leaf ? "<" : "</", begin);
+          while (!leaf && close != std::string_view::npos
+              && (xml.compare(close + 2, name.size(), name) != 0
+                || xml.compare(close + 2 + name.size(), 1, ">") != 0))
+            close = xml.find("</", close + 2);
+          if (close == std::string_view::npos
+              || xml.compare(close, 2, "</") != 0
+              || xml.compare(close + 2, name.size(), name) != 0
+              || xml.compare(close + 2 + name.size(), 1, ">") != 0)
+            return found::anomaly;
+          content = xml.substr(begin, close - begin);
+          after = close + 3 + name.size();
+          return found::yes;
+        }
+        return found::no;
+      }
+
+      // decodes the text of child element name into output, leaves output
+      // empty if the element is missing
+      bool field(std::string_view record, std::string_view name,
+          std::string& output) {
+        std::string_view content;
+        size_t after = 0;
+        found f = find_element(record, name, content, after);
+        if (f == found::anomaly)
+          return false;
+        output.clear();
+        if (f == found::yes)
+          append_xml_text(output, content);
+        return true;
+      }
+
+      // GetResembleLyricList2Result; stops after limit entries
+      bool lyric_list(std::string_view xml, std::vector<alsong::song_list>& output,
+          size_t limit) {
+        if (xml.find("<!") != std::string_view::npos)
+          return false;
+
+        std::string_view result;
+        size_t after = 0;
+        if (find_element(xml, "GetResembleLyricList2Result", result, after,
+              false) != found::yes)
+          return false;
+
+        std::vector<alsong::song_list> lists;
+        size_t pos = 0;
+        while (lists.size() < limit) {
+          std::string_view record;
+          found f = find_element(result.substr(pos), "ST_SEARCHLYRIC_LIST",
+              record, after, false);
+          if (f == found::no)
+            break;
+          if (f == found::anomaly)
+            return false;
+          pos += after;
+
+          alsong::song_list list;
+          if (!field(record, "lyricID", list.lyric_id)
+              || !field(record, "title", list.title)
+              || !field(record, "artist", list.artist)
+              || !field(record, "album", list.album))
+            return false;
+          lists.push_back(std::move(list));
+        }
+
+        output.insert(output.end(), std::make_move_iterator(lists.begin()),
+            std::make_move_iterator(lists.end()));
+        return true;
+      }
+
+      // GetLyricByID2Result and the <output> record that follows it
+      bool lyric(std::string_view xml, alsong::song_info& song,
+          std::string& lyric_raw) {
+        if (xml.find("<!") != std::string_view::npos)
+          return false;
+
+        std::string_view content;
+        size_t after = 0;
+        if (find_element(xml, "GetLyricByID2Result", content, after)
+            != found::yes)
+          return false;
+
+        xml = xml.substr(after);
+        size_t next = xml.find_first_not_of(" \t\r\n");
+        if (next == std::string_view::npos
+            || xml.compare(next, 7, "<output") != 0)
+          return false;
+
+        std::string_view record;
+        if (find_element(xml.substr(next), "output", record, after, false)
+            != found::yes)
+          return false;
+
+        return field(record, "lyricID", song.lyric_id)
+          && field(record, "title", song.title)
+          && field(record, "artist", song.artist)
+          && field(record, "album", song.album)
+          && field(record, "registerName", song.written_by)
+          && field(record, "lyric", lyric_raw);
+      }
+    }
+
+    // incremental parser for ALSong SOAP responses; it is fed the body
+    // chunk by chunk as curl receives it and reports each search result
+    // and lyric record as soon as its closing tag has been seen, without
+    // keeping the raw body or building a DOM
+    class soap_stream_parser
+    {
+      public:
+        // called for every </ST_SEARCHLYRIC_LIST> of GetResembleLyricList2
+        std::function<void(alsong::song_list&)> on_song_list;
+        // called for the </output> record of GetLyricByID2, lyric holds
+        // the decoded raw lyric text
+        std::function<void(alsong::song_info&, std::string& lyric)> on_lyric;
+
+        soap_stream_parser(const std::string& result_tag)
+          : result_tag(result_tag) {
+
+          }
+
+        void feed(const char *data, size_t size) {
+          for (size_t i = 0; i < size; ++i) {
+            char c = data[i];
+            if (!in_tag) {
+              if (c == '<') {
+                in_tag = true;
+                tag.clear();
+              } else if (collect_text) {
+                text += c;
+              }
+              continue;
+            }
+
+            tag += c;
+            if (quote != 0) {
+              if (c == quote)
+                quote = 0;
+            } else if (c == '"' || c == '\'') {
+              // CDATA sections and comments may contain unbalanced quotes
+              if (tag[0] != '!')
+                quote = c;
+            } else if (c == '>') {
+              if (tag_complete()) {
+                tag.pop_back();
+                in_tag = false;
+                handle_tag();
+              }
+            }
+          }
+        }
+
+        // true once the expected result element has been seen
+        bool result_found() const {
+          return result_seen;
+        }
+
+        // number of song lists or lyrics reported so far
+        size_t record_count() const {
+          return records;
+        }
+
+        bool finish() {
+          if (!result_seen) {
+            std::cerr << "SOAP Fault: missing tag, " << result_tag << "\n";
+            return false;
+          }
+          return true;
+        }
+
+        // curl write callback, CURLOPT_WRITEDATA must point to the parser
+        static size_t write_data(char *buffer, size_t size,
+            size_t nmemb, void *data) {
+          size_t result = size * nmemb;
+          static_cast<soap_stream_parser *>(data)->feed(buffer, result);
+          return result;
+        }
+
+      private:
+        bool tag_complete() const {
+          if (tag.compare(0, 8, "![CDATA[") == 0)
+            return tag.size() >= 11 && tag.compare(tag.size() - 3, 3, "]]>") == 0;
+          if (tag.compare(0, 3, "!--") == 0)
+            return tag.size() >= 6 && tag.compare(tag.size() - 3, 3, "-->") == 0;
+          return true;
+        }
+
+        void handle_tag() {
+          if (tag.empty())
+            return;
+          if (tag.compare(0, 8, "![CDATA[") == 0) {
+            // CDATA is literal, escape it so end_element can decode all
+            // text in one go
+            if (collect_text)
+              append_xml_escaped(text,
+                  std::string_view(tag).substr(8, tag.size() - 10));
+            return;
+          }
+          if (tag[0] == '?' || tag[0] == '!')
+            return;
+
+          if (tag[0] == '/') {
+            end_element(local_name(1));
+            return;
+          }
+
+          bool self_closing = tag.back() == '/';
+          std::string name = local_name(0);
+          start_element(name);
+          if (self_closing)
+            end_element(name);
+        }
+
+        // element name without namespace prefix and attributes
+        std::string local_name(size_t begin) const {
+          size_t end = tag.find_first_of(" \t\r\n/", begin);
+          if (end == std::string::npos || end == begin)
+            end = tag.size();
+          size_t colon = tag.find(':', begin);
+          if (colon != std::string::npos && colon < end)
+            begin = colon + 1;
+          return tag.substr(begin, end - begin);
+        }
+
+        void start_element(const std::string& name) {
+          if (name == result_tag)
+            result_seen = true;
+          path.push_back(name);
+          text.clear();
+          // only the leaf fields we report need their text kept
+          collect_text = path.size() >= 2 && (
+              path[path.size() - 2] == "ST_SEARCHLYRIC_LIST" ||
+              path[path.size() - 2] == "output");
+        }
+
+        void end_element(const std::string& name) {
+          if (path.empty())
+            return;
+          std::string parent = path.size() >= 2 ? path[path.size() - 2] : "";
+          path.pop_back();
+          collect_text = false;
+
+          if (parent == "ST_SEARCHLYRIC_LIST") {
+            set_field(name, list.lyric_id, list.title, list.artist,
+                list.album, nullptr, nullptr);
+          } else if (parent == "output") {
+            set_field(name, song.lyric_id, song.title, song.artist,
+                song.album, &song.written_by, &lyric);
+          } else if (name == "ST_SEARCHLYRIC_LIST") {
+            ++records;
+            if (on_song_list)
+              on_song_list(list);
+            list = alsong::song_list();
+          } else if (name == "output") {
+            ++records;
+            if (on_lyric)
+              on_lyric(song, lyric);
+            song = alsong::song_info();
+            lyric.clear();
+          }
+          text.clear();
+        }
+
+        void set_field(const std::string& name, std::string& lyric_id,
+            std::string& title, std::string& artist, std::string& album,
+            std::string *register_name, std::string *lyric_raw) {
+          std::string *field = nullptr;
+          if (name == "lyricID") field = &lyric_id;
+          else if (name == "title") field = &title;
+          else if (name == "artist") field = &artist;
+          else if (name == "album") field = &album;
+          else if (name == "registerName") field = register_name;
+          else if (name == "lyric") field = lyric_raw;
+          if (field == nullptr)
+            return;
+          field->clear();
+          append_xml_text(*field, text);
+        }
+
+        std::string result_tag;
+        bool result_seen = false;
+        size_t records = 0;
+        bool in_tag = false;
+        bool collect_text = false;
+        char quote = 0;
+        std::string tag;
+        std::string text;
+        std::vector<std::string> path;
+        alsong::song_list list;
+        alsong::song_info song;
+        std::string lyric;
+    }; // class moonk5::alsong::soap_stream_parser
+
+    struct lyrics_query
+    {
+      std::string title = "";
+      std::string artist = "";
+    }; // struct moonk5::alsong::lyrics_query
+
+    // search key of a title/artist pair, see key_normalization
+    std::string query_key(std::string_view title, std::string_view artist) {
+      std::string key;
+      key.reserve(title.size() + artist.size() + 1);
+      key_normalization::normalise(artist, key);
+      key += '\x1f';
+      key_normalization::normalise(title, key);
+      return key;
+    }
+
+    uint64_t key_hash(std::string_view key) {
+      return key_normalization::hash(key);
+    }
+
+    // searches that returned no candidates, kept until their TTL runs out
+    // so they are not sent upstream again. Entries are appended to a file
+    // as {hash, expiry} records and loaded at startup; a bloom filter in
+    // front of the table answers most lookups of unknown searches with a
+    // few bit tests. Entries added by other processes are seen on reopen;
+    // appends and the rewrite at load hold flock(2) on a lock file next to
+    // the cache file, so several processes can share it. The rewrite
+    // replaces the file, so an append first reopens it if another process
+    // did that since
+    class negative_cache
+    {
+      public:
+        static constexpr int64_t DEFAULT_TTL = 7 * 24 * 3600; // seconds
+
+        negative_cache(const std::filesystem::path& path,
+            int64_t ttl_seconds=DEFAULT_TTL)
+          : path(path), ttl(ttl_seconds) {
+          std::filesystem::path lock_path = path;
+          lock_path += ".lock";
+          lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+          std::lock_guard<std::mutex> guard(mutex);
+          load();
+        }
+
+        negative_cache(const negative_cache&) = delete;
+        negative_cache& operator=(const negative_cache&) = delete;
+
+        ~negative_cache() {
+          if (fd >= 0)
+            ::close(fd);
+          if (lock_fd >= 0)
+            ::close(lock_fd);
+        }
+
+        // one cache per file shared by every fetcher in the process
+        static std::shared_ptr<negative_cache> open_shared(
+            const std::filesystem::path& path) {
+          static std::mutex registry_mutex;
+          static std::map<std::string, std::weak_ptr<negative_cache>> registry;
+          std::lock_guard<std::mutex> guard(registry_mutex);
+          std::weak_ptr<negative_cache>& entry = registry[path.string()];
+          std::shared_ptr<negative_cache> cache = entry.lock();
+          if (!cache) {
+            cache = std::make_shared<negative_cache>(path);
+            entry = cache;
+          }
+          return cache;
+        }
+
+        bool contains(std::string_view title, std::string_view artist) {
+          uint64_t hash = key_hash(query_key(title, artist));
+          std::lock_guard<std::mutex> guard(mutex);
+          if (!maybe_contains(hash))
+            return false;
+          auto it = expiries.find(hash);
+          if (it == expiries.end() || it->second <= now())
+            return false;
+          ++hit_count;
+          return true;
+        }
+
+        void add(std::string_view title, std::string_view artist) {
+          record r;
+          r.hash = key_hash(query_key(title, artist));
+          r.expiry = now() + ttl;
+          std::lock_guard<std::mutex> guard(mutex);
+          append(r);
+          insert(r);
+        }
+
+        // forgets a search, e.g. once lyrics were found for it elsewhere
+        void remove(std::string_view title, std::string_view artist) {
+          record r;
+          r.hash = key_hash(query_key(title, artist));
+          r.expiry = 0;
+          std::lock_guard<std::mutex> guard(mutex);
+          if (expiries.erase(r.hash) != 0)
+            append(r);
+        }
+
+        // applies to entries added from now on
+        void set_ttl(int64_t ttl_seconds) {
+          ttl = ttl_seconds;
+        }
+
+        size_t size() {
+          std::lock_guard<std::mutex> guard(mutex);
+          return expiries.size();
+        }
+
+        // searches answered from this cache instead of upstream
+        uint64_t hits() const {
+          return hit_count;
+        }
+
+      private:
+        struct record
+        {
+          uint64_t hash;
+          int64_t expiry; // unix time in seconds, 0 removes the entry
+        };
+
+        static int64_t now() {
+          return std::chrono::duration_cast<std::chrono::seconds>(
+              std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        // k = 4 probes derived from the two halves of the hash
+        bool maybe_contains(uint64_t hash) const {
+          if (bloom.empty())
+            return false;
+          uint64_t mask = bloom.size() * 64 - 1;
+          uint64_t h1 = hash, h2 = (hash >> 32) | 1;
+          for (int i = 0; i < 4; ++i) {
+            uint64_t bit = (h1 + i * h2) & mask;
+            if ((bloom[bit >> 6] & (uint64_t(1) << (bit & 63))) == 0)
+              return false;
+          }
+          return true;
+        }
+
+        void set_bloom(uint64_t hash) {
+          uint64_t mask = bloom.size() * 64 - 1;
+          uint64_t h1 = hash, h2 = (hash >> 32) | 1;
+          for (int i = 0; i < 4; ++i) {
+            uint64_t bit = (h1 + i * h2) & mask;
+            bloom[bit >> 6] |= uint64_t(1) << (bit & 63);
+          }
+        }
+
+        // keeps about 16 bits per entry, around 0.2% false positives
+        void rebuild_bloom() {
+          size_t words = 1024;
+          while (words * 4 < expiries.size())
+            words *= 2;
+          bloom.assign(words, 0);
+          for (const auto& entry : expiries)
+            set_bloom(entry.first);
+        }
+
+        void insert(const record& r) {
+          if (r.expiry <= now()) {
+            expiries.erase(r.hash);
+            return;
+          }
+          expiries[r.hash] = r.expiry;
+          if (bloom.size() * 4 < expiries.size())
+            rebuild_bloom();
+          else
+            set_bloom(r.hash);
+        }
+
+        void append(const record& r) {
+          if (fd < 0)
+            return;
+          if (lock_fd >= 0)
+            ::flock(lock_fd, LOCK_EX);
+          reopen_if_replaced();
+          if (::write(fd, &r, sizeof(r)) != ssize_t(sizeof(r)))
+            std::cerr << "moonk5::alsong::negative_cache - write failed\n";
+          if (lock_fd >= 0)
+            ::flock(lock_fd, LOCK_UN);
+        }
+
+        // points fd at the file at path again once a rewrite by another
+        // instance left it on the replaced one; runs under the file lock
+        void reopen_if_replaced() {
+          struct stat opened, current;
+          if (::fstat(fd, &opened) == 0 && ::stat(path.c_str(), &current) == 0
+              && opened.st_dev == current.st_dev && opened.st_ino == current.st_ino)
+            return;
+          int reopened = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+          if (reopened < 0) {
+            std::cerr << "moonk5::alsong::negative_cache - cannot reopen "
+              << path << "\n";
+            return;
+          }
+          ::close(fd);
+          fd = reopened;
+        }
+
+        // replays the file and rewrites it without expired and removed
+        // entries once they make up most of it
+        void load() {
+          if (lock_fd >= 0)
+            ::flock(lock_fd, LOCK_EX);
+          size_t replayed = 0;
+          std::ifstream ifs(path, std::ios::binary);
+          record r;
+          while (ifs.read(reinterpret_cast<char *>(&r), sizeof(r))) {
+            insert(r);
+            ++replayed;
+          }
+          ifs.close();
+          rebuild_bloom();
+
+          if (replayed > 2 * expiries.size() + 1024) {
+            std::filesystem::path tmp_path = path;
+            tmp_path += ".tmp";
+            std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+            for (const auto& entry : expiries) {
+              record live = {entry.first, entry.second};
+              ofs.write(reinterpret_cast<const char *>(&live), sizeof(live));
+            }
+            ofs.close();
+            std::error_code ec;
+            if (ofs)
+              std::filesystem::rename(tmp_path, path, ec);
+          }
+          fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+          if (lock_fd >= 0)
+            ::flock(lock_fd, LOCK_UN);
+        }
+
+        std::filesystem::path path;
+        std::atomic<int64_t> ttl;
+        int fd = -1;
+        int lock_fd = -1;
+        std::mutex mutex;
+        std::unordered_map<uint64_t, int64_t> expiries;
+        std::vector<uint64_t> bloom;
+        std::atomic<uint64_t> hit_count{0};
+    }; // class moonk5::alsong::negative_cache
+
+    enum class request_priority { interactive, bulk };
+
+    // admits upstream requests through a global token bucket of rate
+    // requests per second with room for a burst. Priority is strict:
+    // bulk requests only get a token while no interactive request waits,
+    // and each class is served in arrival order. Time spent waiting is
+    // recorded per class
+    class request_scheduler
+    {
+      public:
+        struct queue_stats
+        {
+          uint64_t admitted = 0;
+          uint64_t waiting = 0;      // right now
+          double mean_wait_ms = 0;
+          double p99_wait_ms = 0;    // upper bound, from a log2 histogram
+          double max_wait_ms = 0;
+        };
+
+        request_scheduler(double rate_per_second=10, double burst=10)
+          : rate(rate_per_second), capacity(std::max(1.0, burst)),
+            tokens(capacity), refilled(std::chrono::steady_clock::now()) {
+        }
+
+        request_scheduler(const request_scheduler&) = delete;
+        request_scheduler& operator=(const request_scheduler&) = delete;
+
+        // blocks until the request may go out
+        void acquire(request_priority priority) {
+          std::chrono::steady_clock::time_point queued =
+            std::chrono::steady_clock::now();
+          size_t c = size_t(priority);
+          std::unique_lock<std::mutex> lock(mutex);
+          uint64_t ticket = next_ticket[c]++;
+          ++waiting[c];
+          for (;;) {
+            refill();
+            if (ticket == serving[c] && may_serve(c) && tokens >= 1)
+              break;
+            if (ticket == serving[c] && may_serve(c))
+              ready.wait_for(lock, token_delay());
+            else
+              ready.wait(lock);
+          }
+          tokens -= 1;
+          --waiting[c];
+          ++serving[c];
+          record_wait(c, queued);
+          ready.notify_all();
+        }
+
+        // takes a token only if one is free and nobody of this or a higher
+        // priority is queued; queued is when the caller started waiting
+        bool try_acquire(request_priority priority,
+            std::chrono::steady_clock::time_point queued) {
+          size_t c = size_t(priority);
+          std::lock_guard<std::mutex> guard(mutex);
+          refill();
+          if (waiting[c] > 0 || !may_serve(c) || tokens < 1)
+            return false;
+          tokens -= 1;
+          record_wait(c, queued);
+          return true;
+        }
+
+        // time until the next token is due, zero if one is free now
+        std::chrono::milliseconds next_token_delay() {
+          std::lock_guard<std::mutex> guard(mutex);
+          refill();
+          return std::chrono::duration_cast<std::chrono::milliseconds>(token_delay());
+        }
+
+        void set_rate(double rate_per_second, double burst) {
+          std::lock_guard<std::mutex> guard(mutex);
+          refill();
+          rate = rate_per_second;
+          capacity = std::max(1.0, burst);
+          tokens = std::min(tokens, capacity);
+          ready.notify_all();
+        }
+
+        queue_stats stats(request_priority priority) {
+          size_t c = size_t(priority);
+          std::lock_guard<std::mutex> guard(mutex);
+          queue_stats result;
+          result.admitted = admitted[c];
+          result.waiting = waiting[c];
+          if (admitted[c] == 0)
+            return result;
+          result.mean_wait_ms = double(total_wait_us[c]) / admitted[c] / 1000;
+          result.max_wait_ms = double(max_wait_us[c]) / 1000;
+          uint64_t rank = (admitted[c] * 99 + 99) / 100, seen = 0;
+          for (size_t b = 0; b < WAIT_BUCKETS; ++b) {
+            seen += wait_histogram[c][b];
+            if (seen >= rank) {
+              result.p99_wait_ms = std::min(double(uint64_t(1) << b),
+                  double(max_wait_us[c])) / 1000;
+              break;
+            }
+          }
+          return result;
+        }
+
+      private:
+        static constexpr size_t CLASSES = 2;
+        static constexpr size_t WAIT_BUCKETS = 40;
+
+        bool may_serve(size_t c) const {
+          for (size_t higher = 0; higher < c; ++higher)
+            if (waiting[higher] > 0)
+              return false;
+          return true;
+        }
+
+        void refill() {
+          std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+          double seconds = std::chrono::duration<double>(now - refilled).count();
+          tokens = std::min(capacity, tokens + seconds * rate);
+          refilled = now;
+        }
+
+        std::chrono::steady_clock::duration token_delay() const {
+          if (tokens >= 1)
+            return std::chrono::steady_clock::duration::zero();
+          if (rate <= 0)
+            return std::chrono::seconds(1);
+          return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>((1 - tokens) / rate));
+        }
+
+        void record_wait(size_t c, std::chrono::steady_clock::time_point queued) {
+          uint64_t us = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - queued).count());
+          ++admitted[c];
+          total_wait_us[c] += us;
+          max_wait_us[c] = std::max(max_wait_us[c], us);
+          size_t bucket = 0;
+          while (bucket + 1 < WAIT_BUCKETS && (uint64_t(1) << bucket) < us)
+            ++bucket;
+          ++wait_histogram[c][bucket];
+        }
+
+        std::mutex mutex;
+        std::condition_variable ready;
+        double rate;
+        double capacity;
+        double tokens;
+        std::chrono::steady_clock::time_point refilled;
+        uint64_t next_ticket[CLASSES] = {};
+        uint64_t serving[CLASSES] = {};
+        uint64_t waiting[CLASSES] = {};
+        uint64_t admitted[CLASSES] = {};
+        uint64_t total_wait_us[CLASSES] = {};
+        uint64_t max_wait_us[CLASSES] = {};
+        uint64_t wait_histogram[CLASSES][WAIT_BUCKETS] = {};
+    }; // class moonk5::alsong::request_scheduler
+
+    // in-flight limit for batch transfers, adapted to the upstream by
+    // additive increase / multiplicative decrease: every completion that
+    // comes back in time grows the limit by 1/limit (about one per round
+    // trip), while a failure that points at overload or a latency well
+    // above the best seen recently cuts it by backoff, at most once per
+    // round trip
+    class concurrency_limiter
+    {
+      public:
+        concurrency_limiter(size_t initial_limit=4, size_t min_limit=1,
+            size_t max_limit=64, double backoff=0.7,
+            double latency_tolerance=2.0)
+          : min_limit(std::max<size_t>(1, min_limit)),
+            max_limit(std::max(max_limit, std::max<size_t>(1, min_limit))),
+            backoff(backoff), latency_tolerance(latency_tolerance),
+            current(double(std::min(std::max(initial_limit, this->min_limit),
+                    this->max_limit))) {
+        }
+
+        concurrency_limiter(const concurrency_limiter&) = delete;
+        concurrency_limiter& operator=(const concurrency_limiter&) = delete;
+
+        // the number of transfers that may be in flight right now
+        size_t limit() const {
+          std::lock_guard<std::mutex> guard(mutex);
+          return size_t(current);
+        }
+
+        // feeds one completed transfer; overloaded is true for timeouts,
+        // connection failures and 429/5xx answers
+        void record(std::chrono::microseconds latency, bool overloaded) {
+          std::lock_guard<std::mutex> guard(mutex);
+          std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+          double us = double(std::max<int64_t>(1, int64_t(latency.count())));
+          if (!overloaded) {
+            // the baseline is the fastest answer of the last two windows
+            // of samples, so it follows an upstream that gets slower
+            window_min = std::min(window_min, us);
+            if (++window_samples >= BASELINE_WINDOW) {
+              previous_min = window_min;
+              window_min = HUGE_VAL;
+              window_samples = 0;
+            }
+            smoothed = smoothed == 0 ? us : smoothed * 0.8 + us * 0.2;
+          }
+          double baseline = std::min(window_min, previous_min);
+
+          bool congested = overloaded || (baseline < HUGE_VAL
+              && smoothed > baseline * latency_tolerance);
+          if (!congested) {
+            current = std::min(double(max_limit), current + 1 / current);
+            ++increase_count;
+            return;
+          }
+          // the transfers of one round trip all see the same overload
+          std::chrono::microseconds round_trip(int64_t(std::max(smoothed, us)));
+          if (now - last_decrease < round_trip)
+            return;
+          last_decrease = now;
+          current = std::max(double(min_limit), current * backoff);
+          ++decrease_count;
+        }
+
+        uint64_t increases() const {
+          std::lock_guard<std::mutex> guard(mutex);
+          return increase_count;
+        }
+
+        uint64_t decreases() const {
+          std::lock_guard<std::mutex> guard(mutex);
+          return decrease_count;
+        }
+
+      private:
+        static constexpr size_t BASELINE_WINDOW = 100;
+
+        mutable std::mutex mutex;
+        const size_t min_limit;
+        const size_t max_limit;
+        const double backoff;
+        const double latency_tolerance;
+        double current;
+        double smoothed = 0;
+        double window_min = HUGE_VAL;
+        double previous_min = HUGE_VAL;
+        size_t window_samples = 0;
+        std::chrono::steady_clock::time_point last_decrease;
+        uint64_t increase_count = 0;
+        uint64_t decrease_count = 0;
+    }; // class moonk5::alsong::concurrency_limiter
+
+    enum class breaker_state { closed, open, half_open };
+
+    // stops calls to an upstream that keeps failing. While closed, the
+    // outcomes of the last window_ms are kept in a ring of buckets; once
+    // at least min_calls were seen and failure_rate of them failed the
+    // breaker opens and refuses every call for open_ms. After that it is
+    // half open and lets a single probe through, which closes it again on
+    // success or reopens it on failure. Every call carries the permit it
+    // was let through with, so outcomes of calls admitted before the last
+    // change of state are ignored
+    class circuit_breaker
+    {
+      public:
+        circuit_breaker(double failure_rate=0.5, unsigned min_calls=10,
+            long window_ms=10000, long open_ms=5000)
+          : failure_rate(failure_rate), min_calls(std::max(1u, min_calls)),
+            bucket_span(std::chrono::milliseconds(std::max(BUCKETS, window_ms) / BUCKETS)),
+            open_span(std::chrono::milliseconds(open_ms)) {
+        }
+
+        circuit_breaker(const circuit_breaker&) = delete;
+        circuit_breaker& operator=(const circuit_breaker&) = delete;
+
+        // a permit for a call that may go out now, 0 if it is refused. In
+        // the half open state the permit makes the caller the probe, which
+        // must report back with record() or give it up with cancel()
+        uint64_t allow() {
+          std::lock_guard<std::mutex> guard(mutex);
+          std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+          if (current == breaker_state::open && now >= reopen_at)
+            current = breaker_state::half_open;
+          if (current == breaker_state::closed)
+            return generation;
+          if (current == breaker_state::half_open && !probing) {
+            probing = true;
+            return ++generation;
+          }
+          ++rejected_count;
+          return 0;
+        }
+
+        // the outcome of a call made with permit
+        void record(uint64_t permit, bool failed) {
+          std::lock_guard<std::mutex> guard(mutex);
+          std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+          if (permit != generation || current == breaker_state::open)
+            return;
+          if (current == breaker_state::half_open) {
+            probing = false;
+            if (failed) {
+              trip(now);
+            } else {
+              current = breaker_state::closed;
+              ++generation;
+              for (bucket& b : buckets)
+                b = bucket();
+            }
+            return;
+          }
+
+          int64_t epoch = int64_t((now.time_since_epoch()) / bucket_span);
+          bucket& b = buckets[size_t(epoch) % BUCKETS];
+          if (b.epoch != epoch)
+            b = bucket{epoch, 0, 0};
+          ++b.calls;
+          if (failed)
+            ++b.failures;
+
+          uint64_t calls = 0, failures = 0;
+          for (const bucket& past : buckets) {
+            if (past.epoch > epoch - int64_t(BUCKETS)) {
+              calls += past.calls;
+              failures += past.failures;
+            }
+          }
+          if (calls >= min_calls && double(failures) >= failure_rate * calls)
+            trip(now);
+        }
+
+        breaker_state state() {
+          std::lock_guard<std::mutex> guard(mutex);
+          if (current == breaker_state::open
+              && std::chrono::steady_clock::now() >= reopen_at)
+            return breaker_state::half_open;
+          return current;
+        }
+
+        // times the breaker opened, and calls it refused
+        uint64_t trips() const {
+          std::lock_guard<std::mutex> guard(mutex);
+          return trip_count;
+        }
+
+        uint64_t rejected() const {
+          std::lock_guard<std::mutex> guard(mutex);
+          return rejected_count;
+        }
+
+        // gives back a permit whose call never went out, so a probe that
+        // could not be sent does not hold the breaker half open
+        void cancel(uint64_t permit) {
+          std::lock_guard<std::mutex> guard(mutex);
+          if (current == breaker_state::half_open && probing
+              && permit == generation)
+            probing = false;
+        }
+
+      private:
+        static constexpr long BUCKETS = 10;
+
+        struct bucket
+        {
+          int64_t epoch = -1;
+          uint64_t calls = 0;
+          uint64_t failures = 0;
+        };
+
+        void trip(std::chrono::steady_clock::time_point now) {
+          current = breaker_state::open;
+          reopen_at = now + open_span;
+          ++generation;
+          ++trip_count;
+        }
+
+        mutable std::mutex mutex;
+        const double failure_rate;
+        const unsigned min_calls;
+        const std::chrono::steady_clock::duration bucket_span;
+        const std::chrono::steady_clock::duration open_span;
+        breaker_state current = breaker_state::closed;
+        bool probing = false;
+        // bumped on every change of state; permits of older states are stale
+        uint64_t generation = 1;
+        std::chrono::steady_clock::time_point reopen_at;
+        bucket buckets[BUCKETS];
+        uint64_t trip_count = 0;
+        uint64_t rejected_count = 0;
+    }; // class moonk5::alsong::circuit_breaker
+
+    // how lyrics_fetcher bounds, retries and hedges a single request
+    struct request_policy
+    {
+      // whole call including retries and backoff, 0 for none
+      long deadline_ms = 30000;
+      // attempts per call, retrying connection failures, timeouts and
+      // HTTP 5xx answers
+      unsigned max_attempts = 3;
+      // full jitter: the n-th retry waits a random time below
+      // min(backoff_max_ms, backoff_base_ms * 2^n)
+      long backoff_base_ms = 100;
+      long backoff_max_ms = 2000;
+      // sends a duplicate request if the first is slower than the p95 of
+      // recent requests and takes whichever answers first; responses are
+      // then buffered before reaching a streaming parser
+      bool hedge = false;
+      // hedge delay until enough latencies have been seen, and its floor
+      long hedge_min_delay_ms = 50;
+    }; // struct moonk5::alsong::request_policy
+
+    struct lyrics_fetcher
+    {
+      // called once per request of a batch as soon as it completes;
+      // index is the position of the request in the batch input
+      typedef std::function<void(size_t index, CURLcode result,
+          std::string& output)> batch_callback;
+
+      const std::string URL;
+
+      const std::string ENC_DATA =
+        "7c2d15b8f51ac2f3b2a37d7a445c3158455defb8a58d621eb77a3ff8ae4921318e49cefe24e515f79892a4c29c9a3e204358698c1cfe79c151c04f9561e945096ccd1d1c0a8d8f265a2f3fa7995939b21d8f663b246bbc433c7589da7e68047524b80e16f9671b6ea0faaf9d6cde1b7dbcf1b89aa8a1d67a8bbc566664342e12";
+
+      const std::string SOAP_TEMPLATE_LYRIC_LIST =
+        R"(<SOAP-ENV:Envelope
+           xmlns:SOAP-ENV="http://www.w3.org/2003/05/soap-envelope"
+           xmlns:SOAP-ENC="http://www.w3.org/2003/05/soap-encoding"
+           xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"
+           xmlns:xsd="http://www.w3.org/2001/XMLSchema"
+           xmlns:ns2="ALSongWebServer/Service1Soap"
+           xmlns:ns1="ALSongWebServer"
+           xmlns:ns3="ALSongWebServer/Service1Soap12">
+           <SOAP-ENV:Body>
+           <ns1:GetResembleLyricList2>
+           <ns1:encData>$encdata</ns1:encData>
+           <ns1:title>$title</ns1:title>
+           <ns1:artist>$artist</ns1:artist>
+           <ns1:pageNo>1</ns1:pageNo>
+           </ns1:GetResembleLyricList2>
+           </SOAP-ENV:Body>
+           </SOAP-ENV:Envelope>
+          )";
+      
+      const std::string SOAP_TEMPLATE_LYRIC_BY_ID =
+        R"(<SOAP-ENV:Envelope
+           xmlns:SOAP-ENV="http://www.w3.org/2003/05/soap-envelope"
+           xmlns:SOAP-ENC="http://www.w3.org/2003/05/soap-encoding"
+           xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"
+           xmlns:xsd="http://www.w3.org/2001/XMLSchema"
+           xmlns:ns2="ALSongWebServer/Service1Soap"
+           xmlns:ns1="ALSongWebServer"
+           xmlns:ns3="ALSongWebServer/Service1Soap12">
+           <SOAP-ENV:Body>
+           <ns1:GetLyricByID2>
+           <ns1:encData>$encdata</ns1:encData>
+           <ns1:lyricID>$lyricId</ns1:lyricID>
+           </ns1:GetLyricByID2>
+           </SOAP-ENV:Body>
+           </SOAP-ENV:Envelope>
+          )";
+
+      const soap_template lyric_list_template{SOAP_TEMPLATE_LYRIC_LIST,
+        {"encdata", "title", "artist"}};
+
+      const soap_template lyric_by_id_template{SOAP_TEMPLATE_LYRIC_BY_ID,
+        {"encdata", "lyricId"}};
+
+      // what a search with no candidates returns, handed out for searches
+      // found in the negative cache
+      const std::string EMPTY_LYRIC_LIST =
+        R"(<?xml version="1.0" encoding="utf-8"?>)"
+        R"(<soap:Envelope xmlns:soap="http://www.w3.org/2003/05/soap-envelope">)"
+        R"(<soap:Body><GetResembleLyricList2Response xmlns="ALSongWebServer">)"
+        R"(<GetResembleLyricList2Result></GetResembleLyricList2Result>)"
+        R"(</GetResembleLyricList2Response></soap:Body></soap:Envelope>)";
+
+      lyrics_fetcher(const std::string& url =
+          "http://lyrics.alsong.co.kr/alsongwebservice/service1.asmx")
+        : URL(url) {
+        init_curl();
+
+        // the header list never changes, so build it once for all requests
+        headers = curl_slist_append(headers,
+            "Content-Type: application/soap+xml; charset=utf-8");
+        headers = curl_slist_append(headers, "Accept: text/plain");
+
+        // share DNS and the connection cache between every pooled handle
+        // so consecutive requests go out on the same warm connection
+        share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+      }
+
+      lyrics_fetcher(const lyrics_fetcher&) = delete;
+      lyrics_fetcher& operator=(const lyrics_fetcher&) = delete;
+
+      ~lyrics_fetcher() {
+        for (CURL *curl : idle_handles)
+          curl_easy_cleanup(curl);
+        curl_share_cleanup(share);
+        curl_slist_free_all(headers);
+      }
+
+      CURLcode _fetch(const std::string& soap, std::string &output, unsigned timeout=10,
+          request_priority priority=request_priority::interactive) {
+        tracer::span span("fetch");
+        // a failed attempt's partial body is dropped before retrying
+        size_t before = output.size();
+        return _perform(soap, write_data, &output, timeout, priority,
+            [&output, before]() { output.resize(before); });
+      }
+
+      // same as _fetch but hands the body to a streaming parser as it
+      // arrives instead of collecting it
+      CURLcode _fetch(const std::string& soap, soap_stream_parser &parser,
+          unsigned timeout=10,
+          request_priority priority=request_priority::interactive) {
+        tracer::span span("fetch");
+        return _perform(soap, soap_stream_parser::write_data, &parser, timeout,
+            priority);
+      }
+
+      CURLcode fetch_lyric_list(const std::string& title, const std::string& artist,
+          std::string &output,
+          request_priority priority=request_priority::interactive) {
+        if (title.empty() || artist.empty())
+          return CURLE_BAD_FUNCTION_ARGUMENT;
+        if (negatives && negatives->contains(title, artist)) {
+          output += EMPTY_LYRIC_LIST;
+          return CURLE_OK;
+        }
+
+        size_t before = output.size();
+        CURLcode result = _fetch(create_lyric_list_soap(title, artist), output, 20,
+            priority);
+        if (result == CURLE_OK)
+          remember_empty(title, artist, std::string_view(output).substr(before));
+        return result;
+      }
+
+      CURLcode fetch_lyric_list(const std::string& title, const std::string& artist,
+          soap_stream_parser &parser,
+          request_priority priority=request_priority::interactive) {
+        if (title.empty() || artist.empty())
+          return CURLE_BAD_FUNCTION_ARGUMENT;
+        if (negatives && negatives->contains(title, artist)) {
+          parser.feed(EMPTY_LYRIC_LIST.data(), EMPTY_LYRIC_LIST.size());
+          return CURLE_OK;
+        }
+
+        size_t before = parser.record_count();
+        CURLcode result = _fetch(create_lyric_list_soap(title, artist), parser, 20,
+            priority);
+        if (result == CURLE_OK && negatives && parser.result_found()
+            && parser.record_count() == before)
+          negatives->add(title, artist);
+        return result;
+      }
+
+      CURLcode fetch_lyric(const std::string& lyric_id, std::string &output,
+          request_priority priority=request_priority::interactive) {
+        if (lyric_id.empty()) 
+          return CURLE_BAD_FUNCTION_ARGUMENT;
+
+        return _fetch(create_lyric_soap(lyric_id), output, 20, priority);
+      }
+
+      CURLcode fetch_lyric(const std::string& lyric_id, soap_stream_parser &parser,
+          request_priority priority=request_priority::interactive) {
+        if (lyric_id.empty()) 
+          return CURLE_BAD_FUNCTION_ARGUMENT;
+
+        return _fetch(create_lyric_soap(lyric_id), parser, 20, priority);
+      }
+
+      // batch version of fetch_lyric_list, keeps up to max_in_flight
+      // requests running at once on a single curl multi event loop
+      void fetch_lyric_lists(const std::vector<lyrics_query>& queries,
+          const batch_callback& on_complete, unsigned max_in_flight=8,
+          request_priority priority=request_priority::bulk) {
+        // searches known to be empty complete right away
+        std::vector<size_t> pending;
+        pending.reserve(queries.size());
+        for (size_t i = 0; i < queries.size(); ++i) {
+          if (negatives && !queries[i].title.empty() && !queries[i].artist.empty()
+              && negatives->contains(queries[i].title, queries[i].artist)) {
+            std::string output = EMPTY_LYRIC_LIST;
+            on_complete(i, CURLE_OK, output);
+          } else {
+            pending.push_back(i);
+          }
+        }
+
+        _fetch_batch(pending.size(), [&](size_t i, std::string& soap) {
+            const lyrics_query& query = queries[pending[i]];
+            if (query.title.empty() || query.artist.empty())
+              return false;
+            soap = create_lyric_list_soap(query.title, query.artist);
+            return true;
+          }, [&](size_t i, CURLcode result, std::string& output) {
+            const lyrics_query& query = queries[pending[i]];
+            if (result == CURLE_OK)
+              remember_empty(query.title, query.artist, output);
+            on_complete(pending[i], result, output);
+          }, max_in_flight, 20, priority);
+      }
+
+      // batch version of fetch_lyric
+      void fetch_lyrics(const std::vector<std::string>& lyric_ids,
+          const batch_callback& on_complete, unsigned max_in_flight=8,
+          request_priority priority=request_priority::bulk) {
+        _fetch_batch(lyric_ids.size(), [&](size_t i, std::string& soap) {
+            if (lyric_ids[i].empty())
+              return false;
+            soap = create_lyric_soap(lyric_ids[i]);
+            return true;
+          }, on_complete, max_in_flight, 20, priority);
+      }
+
+      // one request of a mixed batch: the search for query, or the lyrics
+      // of lyric_id when that is set
+      struct batch_request
+      {
+        lyrics_query query;
+        std::string lyric_id = "";
+      };
+
+      // searches and lyric fetches on one curl multi event loop. on_complete
+      // may append to requests, so a lyric fetch can start as soon as the
+      // search it depends on completes while the rest of the batch is still
+      // in flight; index is the position in requests. See _fetch_batch for
+      // more_requests and wake_fd, which let other threads feed the batch
+      void fetch_batch(std::vector<batch_request>& requests,
+          const batch_callback& on_complete, unsigned max_in_flight=8,
+          request_priority priority=request_priority::bulk,
+          const std::function<void()>& more_requests=nullptr, int wake_fd=-1) {
+        _fetch_batch([&]() {
+            if (more_requests)
+              more_requests();
+            return requests.size();
+          },
+          [&](size_t i, std::string& soap) {
+            const batch_request& request = requests[i];
+            if (!request.lyric_id.empty()) {
+              soap = create_lyric_soap(request.lyric_id);
+              return true;
+            }
+            if (request.query.title.empty() || request.query.artist.empty())
+              return false;
+            soap = create_lyric_list_soap(request.query.title, request.query.artist);
+            return true;
+          }, [&](size_t i, CURLcode result, std::string& output) {
+            if (result == CURLE_OK && requests[i].lyric_id.empty())
+              remember_empty(requests[i].query.title, requests[i].query.artist,
+                  output);
+            on_complete(i, result, output);
+          }, max_in_flight, 20, priority, wake_fd);
+      }
+
+      // drives count requests through curl multi; create_soap builds the
+      // envelope of request i just before it starts and returns false if
+      // its arguments are invalid. max_in_flight is a ceiling when a
+      // concurrency limiter is set
+      void _fetch_batch(size_t count,
+          const std::function<bool(size_t, std::string&)>& create_soap,
+          const batch_callback& on_complete, unsigned max_in_flight,
+          unsigned timeout=10,
+          request_priority priority=request_priority::bulk) {
+        _fetch_batch([count]() { return count; }, create_soap, on_complete,
+            unsigned(std::min<size_t>(max_in_flight, count)), timeout, priority);
+      }
+
+      // same, with a count that may grow while the batch runs, e.g. from
+      // on_complete. The wait for transfers also ends when wake_fd becomes
+      // readable, so requests added by another thread start at once; count
+      // is asked again right after and should drain it. The batch returns
+      // once count requests are done and none are in flight
+      void _fetch_batch(const std::function<size_t()>& count,
+          const std::function<bool(size_t, std::string&)>& create_soap,
+          const batch_callback& on_complete, unsigned max_in_flight,
+          unsigned timeout=10,
+          request_priority priority=request_priority::bulk, int wake_fd=-1) {
+        struct transfer
+        {
+          size_t index = 0;
+          CURL *curl = nullptr;
+          uint64_t permit = 0;    // from the circuit breaker
+          std::string soap;
+          std::string output;
+        };
+
+        if (max_in_flight == 0)
+          max_in_flight = 1;
+
+        CURLM *multi = curl_multi_init();
+        if (multi == nullptr) {
+          for (size_t i = 0; i < count(); ++i) {
+            std::string output;
+            on_complete(i, CURLE_FAILED_INIT, output);
+          }
+          return;
+        }
+
+        std::vector<transfer> slots(max_in_flight);
+        std::vector<transfer *> free_slots;
+        for (transfer& t : slots)
+          free_slots.push_back(&t);
+
+        size_t next = 0;
+        // a request that is ready to go out but waits for its token
+        transfer *staged = nullptr;
+        std::chrono::steady_clock::time_point queued =
+          std::chrono::steady_clock::now();
+        while (next < count() || free_slots.size() < slots.size()) {
+          // top up the in-flight window as far as the limiter and the
+          // scheduler admit
+          size_t window = slots.size();
+          if (limiter)
+            window = std::min(window, limiter->limit());
+          bool throttled = false;
+          while (slots.size() - free_slots.size() < window || staged != nullptr) {
+            if (staged == nullptr) {
+              if (next >= count() || free_slots.empty())
+                break;
+              size_t index = next++;
+              transfer *t = free_slots.back();
+              t->soap.clear();
+              t->output.clear();
+              if (!create_soap(index, t->soap)) {
+                on_complete(index, CURLE_BAD_FUNCTION_ARGUMENT, t->output);
+                continue;
+              }
+              t->curl = acquire_handle();
+              if (t->curl == nullptr) {
+                on_complete(index, CURLE_FAILED_INIT, t->output);
+                continue;
+              }
+              t->permit = breaker ? breaker->allow() : 0;
+              if (breaker && t->permit == 0) {
+                release_handle(t->curl);
+                t->curl = nullptr;
+                on_complete(index, CURLE_COULDNT_CONNECT, t->output);
+                continue;
+              }
+              t->index = index;
+              free_slots.pop_back();
+              staged = t;
+            }
+            // the token is taken last, once nothing can stop the request
+            // from going out
+            if (scheduler && !scheduler->try_acquire(priority, queued)) {
+              throttled = true;
+              break;
+            }
+            queued = std::chrono::steady_clock::now();
+            transfer *t = staged;
+            staged = nullptr;
+            curl_easy_setopt(t->curl, CURLOPT_POSTFIELDSIZE, t->soap.length());
+            curl_easy_setopt(t->curl, CURLOPT_POSTFIELDS, t->soap.c_str());
+            curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, &t->output);
+            curl_easy_setopt(t->curl, CURLOPT_CONNECTTIMEOUT, timeout);
+            if (policy.deadline_ms > 0)
+              curl_easy_setopt(t->curl, CURLOPT_TIMEOUT_MS, policy.deadline_ms);
+            curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t);
+            curl_multi_add_handle(multi, t->curl);
+          }
+
+          if (free_slots.size() == slots.size()) {
+            if (throttled)
+              std::this_thread::sleep_for(std::max(std::chrono::milliseconds(1),
+                    scheduler->next_token_delay()));
+            continue;
+          }
+
+          int running = 0;
+          curl_multi_perform(multi, &running);
+
+          int pending = 0;
+          while (CURLMsg *msg = curl_multi_info_read(multi, &pending)) {
+            if (msg->msg != CURLMSG_DONE)
+              continue;
+            transfer *t = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &t);
+            long status = 0;
+            curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &status);
+            bool fault = false;
+            CURLcode result = check_response(msg->data.result, status,
+                t->output, fault);
+            // the output holds a response only on success
+            if (result != CURLE_OK)
+              t->output.clear();
+            if (breaker)
+              breaker->record(t->permit, upstream_failed(result, status, fault));
+            if (limiter) {
+              curl_off_t total = 0;
+              curl_easy_getinfo(t->curl, CURLINFO_TOTAL_TIME_T, &total);
+              limiter->record(std::chrono::microseconds(total),
+                  retryable(result, status));
+            }
+            curl_multi_remove_handle(multi, t->curl);
+            count_connection(t->curl, result);
+            release_handle(t->curl);
+            t->curl = nullptr;
+            free_slots.push_back(t);
+            on_complete(t->index, result, t->output);
+          }
+
+          if (free_slots.size() < slots.size()) {
+            int wait = 1000;
+            if (throttled)
+              wait = int(std::max<long>(1, scheduler->next_token_delay().count()));
+            curl_waitfd wake = {wake_fd, CURL_WAIT_POLLIN, 0};
+            curl_multi_poll(multi, wake_fd >= 0 ? &wake : nullptr,
+                wake_fd >= 0 ? 1 : 0, wait, nullptr);
+          }
+        }
+
+        curl_multi_cleanup(multi);
+      }
+
+      // searches that come back without candidates are recorded in cache
+      // and answered from it until they expire; off unless set
+      void set_negative_cache(std::shared_ptr<negative_cache> cache) {
+        negatives = std::move(cache);
+      }
+
+      // requests are refused without going out while this breaker is
+      // open; none by default
+      void set_circuit_breaker(std::shared_ptr<circuit_breaker> circuit_breaker) {
+        breaker = std::move(circuit_breaker);
+      }
+
+      // batch transfers in flight follow this limiter instead of the
+      // fixed max_in_flight; none by default
+      void set_concurrency_limiter(std::shared_ptr<concurrency_limiter> concurrency_limiter) {
+        limiter = std::move(concurrency_limiter);
+      }
+
+      // upstream requests wait for this scheduler's admission; none by
+      // default
+      void set_scheduler(std::shared_ptr<request_scheduler> request_scheduler) {
+        scheduler = std::move(request_scheduler);
+      }
+
+      void set_request_policy(const request_policy& request_policy) {
+        policy = request_policy;
+      }
+
+      const request_policy& get_request_policy() const {
+        return policy;
+      }
+
+      // attempts repeated after a retryable failure
+      unsigned long retry_count() const {
+        return retries.load();
+      }
+
+      // duplicate requests sent by hedging, and how many of them won
+      unsigned long hedge_count() const {
+        return hedges.load();
+      }
+
+      unsigned long hedge_win_count() const {
+        return hedge_wins.load();
+      }
+
+      // number of requests that went out on an already open connection
+      unsigned long connection_reuse_count() const {
+        return reuse_count.load();
+      }
+
+      // number of requests that had to open a new connection
+      unsigned long connection_open_count() const {
+        return open_count.load();
+      }
+
+    private:
+      // runs one call under the request policy; rollback undoes a failed
+      // attempt's partial output, without it an attempt that already
+      // delivered data is not retried. An open circuit breaker fails the
+      // call at once with CURLE_COULDNT_CONNECT
+      CURLcode _perform(const std::string& soap, curl_write_callback write,
+          void *data, unsigned timeout,
+          request_priority priority=request_priority::interactive,
+          const std::function<void()>& rollback=nullptr) {
+        std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+        CURLcode result = CURLE_OK;
+        for (unsigned attempt = 0; ; ++attempt) {
+          long remaining = remaining_ms(start);
+          if (remaining == 0)
+            return CURLE_OPERATION_TIMEDOUT;
+
+          uint64_t permit = breaker ? breaker->allow() : 0;
+          if (breaker && permit == 0)
+            return attempt == 0 ? CURLE_COULDNT_CONNECT : result;
+          if (scheduler)
+            scheduler->acquire(priority);
+          std::chrono::steady_clock::time_point attempt_start =
+            std::chrono::steady_clock::now();
+          delivery sink{write, data, 0, nullptr, std::string(), false};
+          long status = 0;
+          if (policy.hedge)
+            result = _perform_hedged(soap, sink, timeout, remaining, status,
+                priority);
+          else
+            result = _perform_once(soap, sink, timeout, remaining, status);
+          // a call that never went out says nothing about the upstream
+          if (breaker && result == CURLE_FAILED_INIT)
+            breaker->cancel(permit);
+          else if (breaker)
+            breaker->record(permit, upstream_failed(result, status, sink.fault));
+          if (result == CURLE_OK) {
+            record_latency(std::chrono::steady_clock::now() - attempt_start);
+            return result;
+          }
+
+          if (attempt + 1 >= policy.max_attempts || !retryable(result, status))
+            return result;
+          if (sink.bytes > 0) {
+            if (!rollback)
+              return result;
+            rollback();
+          }
+          long wait = backoff_ms(attempt);
+          remaining = remaining_ms(start);
+          if (remaining >= 0 && wait >= remaining)
+            return result;
+          ++retries;
+          std::this_thread::sleep_for(std::chrono::milliseconds(wait));
+        }
+      }
+
+      // forwards a response to the caller's write callback and counts it;
+      // the body of an HTTP error is kept here instead
+      struct delivery
+      {
+        curl_write_callback write;
+        void *data;
+        size_t bytes;
+        CURL *curl = nullptr;     // the transfer, if still running
+        std::string error_body;
+        bool fault = false;       // the answer was a SOAP fault
+      };
+
+      static constexpr size_t MAX_ERROR_BODY = 64 * 1024;
+
+      static size_t deliver(char *buffer, size_t size, size_t nmemb,
+          void *data) {
+        delivery *sink = static_cast<delivery *>(data);
+        long status = 0;
+        if (sink->curl != nullptr)
+          curl_easy_getinfo(sink->curl, CURLINFO_RESPONSE_CODE, &status);
+        if (status >= 400) {
+          size_t length = size * nmemb;
+          sink->error_body.append(buffer,
+              std::min(length, MAX_ERROR_BODY - std::min(MAX_ERROR_BODY,
+                  sink->error_body.size())));
+          return length;
+        }
+        size_t result = sink->write(buffer, size, nmemb, sink->data);
+        sink->bytes += result;
+        return result;
+      }
+
+      // prepares a pooled handle for one attempt
+      CURL* start_attempt(const std::string& soap, unsigned timeout,
+          long remaining) {
+        CURL *curl = acquire_handle();
+        if (curl == nullptr)
+          return nullptr;
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, soap.length());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, soap.c_str());
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+        if (remaining > 0)
+          curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, remaining);
+        return curl;
+      }
+
+      CURLcode _perform_once(const std::string& soap, delivery& sink,
+          unsigned timeout, long remaining, long& status) {
+        CURLcode result;
+        CURL  *curl = start_attempt(soap, timeout, remaining);
+        if (curl == nullptr)
+          return CURLE_FAILED_INIT;
+
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, deliver);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+        sink.curl = curl;
+        result = curl_easy_perform(curl);
+        sink.curl = nullptr;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        count_connection(curl, result);
+        result = check_response(result, status, sink.error_body, sink.fault);
+        if (tracer::enabled())
+          trace_transfer(curl);
+
+        release_handle(curl);
+
+        return result;
+      }
+
+      // races the request against a duplicate sent after the hedge delay;
+      // both are buffered and only the first complete answer is delivered
+      CURLcode _perform_hedged(const std::string& soap, delivery& sink,
+          unsigned timeout, long remaining, long& status,
+          request_priority priority) {
+        struct attempt
+        {
+          CURL *curl = nullptr;
+          std::string output;
+        };
+
+        CURLM *multi = curl_multi_init();
+        if (multi == nullptr)
+          return CURLE_FAILED_INIT;
+
+        attempt attempts[2];
+        std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+        long hedge_delay = hedge_delay_ms();
+        auto launch = [&](attempt& a) {
+          long left = remaining < 0 ? -1 : std::max(1L, remaining - elapsed_ms(start));
+          a.curl = start_attempt(soap, timeout, left);
+          if (a.curl == nullptr)
+            return false;
+          curl_easy_setopt(a.curl, CURLOPT_WRITEDATA, &a.output);
+          curl_multi_add_handle(multi, a.curl);
+          return true;
+        };
+
+        CURLcode result = CURLE_FAILED_INIT;
+        int winner = -1;
+        unsigned launched = launch(attempts[0]) ? 1 : 0;
+        unsigned finished = 0;
+        while (launched > finished && winner < 0) {
+          int running = 0;
+          curl_multi_perform(multi, &running);
+          int pending = 0;
+          while (CURLMsg *msg = curl_multi_info_read(multi, &pending)) {
+            if (msg->msg != CURLMSG_DONE)
+              continue;
+            int i = msg->easy_handle == attempts[0].curl ? 0 : 1;
+            ++finished;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+            count_connection(msg->easy_handle, msg->data.result);
+            result = check_response(msg->data.result, status,
+                attempts[i].output, sink.fault);
+            if (tracer::enabled())
+              trace_transfer(msg->easy_handle);
+            if (result == CURLE_OK) {
+              winner = i;
+              break;
+            }
+          }
+          if (winner >= 0 || launched == finished)
+            break;
+
+          long elapsed = elapsed_ms(start);
+          // a hedge never waits for the scheduler, it is skipped instead
+          if (launched == 1 && elapsed >= hedge_delay && (!scheduler
+                || scheduler->try_acquire(priority, std::chrono::steady_clock::now()))) {
+            if (launch(attempts[1])) {
+              ++launched;
+              ++hedges;
+            }
+          }
+          long wait = launched == 1 ? hedge_delay - elapsed : 100;
+          curl_multi_poll(multi, nullptr, 0, int(std::max(1L, std::min(wait, 100L))),
+              nullptr);
+        }
+
+        for (attempt& a : attempts) {
+          if (a.curl == nullptr)
+            continue;
+          curl_multi_remove_handle(multi, a.curl);
+          release_handle(a.curl);
+        }
+        curl_multi_cleanup(multi);
+
+        if (winner < 0)
+          return result;
+        if (winner == 1)
+          ++hedge_wins;
+        std::string& output = attempts[winner].output;
+        if (!output.empty() && deliver(&output[0], 1, output.size(), &sink)
+            != output.size())
+          return CURLE_WRITE_ERROR;
+        return CURLE_OK;
+      }
+
+      // an HTTP error answer becomes CURLE_HTTP_RETURNED_ERROR; a SOAP
+      // fault in a 500 answer is reported and sets fault
+      static CURLcode check_response(CURLcode result, long status,
+          std::string_view body, bool& fault) {
+        fault = false;
+        if (result != CURLE_OK || status < 400)
+          return result;
+        std::string reason;
+        if (status == 500 && soap_fault(body, reason)) {
+          fault = true;
+          std::cerr << "SOAP Fault: " << reason << "\n";
+        }
+        return CURLE_HTTP_RETURNED_ERROR;
+      }
+
+      // whether body holds a SOAP 1.1 or 1.2 fault; its faultstring or
+      // Reason/Text goes to reason
+      static bool soap_fault(std::string_view body, std::string& reason) {
+        size_t fault = element_content(body, "Fault", 0);
+        if (fault == std::string_view::npos)
+          return false;
+        reason = "no reason given";
+        for (std::string_view name : {"faultstring", "Text"}) {
+          size_t begin = element_content(body, name, fault);
+          if (begin == std::string_view::npos)
+            continue;
+          size_t end = body.find('<', begin);
+          reason.clear();
+          append_xml_unescaped(reason, body.substr(begin,
+                end == std::string_view::npos ? std::string_view::npos : end - begin));
+          break;
+        }
+        return true;
+      }
+
+      // position after the start tag of the first element named local,
+      // in any namespace, at or after from
+      static size_t element_content(std::string_view body,
+          std::string_view local, size_t from) {
+        for (size_t lt = body.find('<', from); lt != std::string_view::npos;
+            lt = body.find('<', lt + 1)) {
+          size_t end = body.find_first_of(" \t\r\n/>", lt + 1);
+          if (end == std::string_view::npos)
+            return std::string_view::npos;
+          std::string_view name = body.substr(lt + 1, end - lt - 1);
+          size_t colon = name.rfind(':');
+          if (colon != std::string_view::npos)
+            name.remove_prefix(colon + 1);
+          if (name != local)
+            continue;
+          size_t gt = body.find('>', end);
+          return gt == std::string_view::npos ? gt : gt + 1;
+        }
+        return std::string_view::npos;
+      }
+
+      // transport failures and the answers of an overloaded or restarting
+      // upstream; anything else, a SOAP fault among them, would only get
+      // the same answer again
+      static bool retryable(CURLcode result, long status) {
+        switch (result) {
+          case CURLE_COULDNT_RESOLVE_HOST:
+          case CURLE_COULDNT_CONNECT:
+          case CURLE_OPERATION_TIMEDOUT:
+          case CURLE_SEND_ERROR:
+          case CURLE_RECV_ERROR:
+          case CURLE_GOT_NOTHING:
+          case CURLE_PARTIAL_FILE:
+            return true;
+          case CURLE_HTTP_RETURNED_ERROR:
+            return status == 429 || status == 502 || status == 503
+              || status == 504;
+          default:
+            return false;
+        }
+      }
+
+      // outcomes the circuit breaker counts against the upstream: no
+      // answer, or one saying it is broken or overloaded. A SOAP fault or
+      // another deterministic answer comes from a working upstream and
+      // counts as a success
+      static bool upstream_failed(CURLcode result, long status, bool fault) {
+        if (result == CURLE_HTTP_RETURNED_ERROR)
+          return (status == 500 && !fault) || status == 502 || status == 503
+            || status == 504;
+        return retryable(result, status);
+      }
+
+      static long elapsed_ms(std::chrono::steady_clock::time_point start) {
+        return long(std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - start).count());
+      }
+
+      // time left before the deadline, -1 without one
+      long remaining_ms(std::chrono::steady_clock::time_point start) const {
+        if (policy.deadline_ms <= 0)
+          return -1;
+        return std::max(0L, policy.deadline_ms - elapsed_ms(start));
+      }
+
+      long backoff_ms(unsigned attempt) const {
+        static thread_local std::mt19937 random(std::random_device{}());
+        long ceiling = policy.backoff_base_ms;
+        for (unsigned i = 0; i < attempt && ceiling < policy.backoff_max_ms; ++i)
+          ceiling *= 2;
+        ceiling = std::min(ceiling, policy.backoff_max_ms);
+        if (ceiling <= 0)
+          return 0;
+        return std::uniform_int_distribution<long>(0, ceiling)(random);
+      }
+
+      void record_latency(std::chrono::steady_clock::duration latency) {
+        long ms = long(std::chrono::duration_cast<std::chrono::milliseconds>(
+              latency).count());
+        std::lock_guard<std::mutex> lock(latency_mutex);
+        latencies[latency_count++ % LATENCY_SAMPLES] = ms;
+      }
+
+      // p95 of the recent latencies, not below hedge_min_delay_ms
+      long hedge_delay_ms() {
+        std::vector<long> samples;
+        {
+          std::lock_guard<std::mutex> lock(latency_mutex);
+          if (latency_count < 20)
+            return policy.hedge_min_delay_ms;
+          size_t n = std::min<size_t>(latency_count, LATENCY_SAMPLES);
+          samples.assign(latencies, latencies + n);
+        }
+        size_t k = samples.size() * 95 / 100;
+        std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+        return std::max(policy.hedge_min_delay_ms, samples[k]);
+      }
+
+      std::string create_lyric_list_soap(const std::string& title,
+          const std::string& artist) {
+        tracer::span span("envelope");
+        return lyric_list_template.render({ENC_DATA, title, artist});
+      }
+
+      std::string create_lyric_soap(const std::string& lyric_id) {
+        tracer::span span("envelope");
+        return lyric_by_id_template.render({ENC_DATA, lyric_id});
+      }
+
+      void remember_empty(const std::string& title, const std::string& artist,
+          std::string_view response) {
+        if (negatives
+            && response.find("GetResembleLyricList2Result") != std::string_view::npos
+            && response.find("ST_SEARCHLYRIC_LIST") == std::string_view::npos)
+          negatives->add(title, artist);
+      }
+
+      // hands out an idle easy handle from the pool, or a new one if the
+      // pool is empty; the handle comes back configured with everything
+      // but the per-request body, output buffer and timeout
+      CURL* acquire_handle() {
+        CURL *curl = nullptr;
+        {
+          std::lock_guard<std::mutex> lock(pool_mutex);
+          if (!idle_handles.empty()) {
+            curl = idle_handles.back();
+            idle_handles.pop_back();
+          }
+        }
+        if (curl == nullptr)
+          curl = curl_easy_init();
+        if (curl == nullptr)
+          return nullptr;
+
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_URL, URL.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        return curl;
+      }
+
+      void release_handle(CURL *curl) {
+        // drop per-request pointers but keep the handle and its caches
+        curl_easy_reset(curl);
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        idle_handles.push_back(curl);
+      }
+
+      // splits a finished transfer into spans by curl's timing fields,
+      // which count from its start; zero length stages of a reused
+      // connection are left out
+      static void trace_transfer(CURL *curl) {
+        curl_off_t dns = 0, connect = 0, tls = 0, sent = 0, first_byte = 0,
+                   total = 0;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+        curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &sent);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+        int64_t begin = tracer::now_us() - int64_t(total);
+        auto stage = [begin](const char *name, curl_off_t from, curl_off_t to) {
+          if (to > from)
+            tracer::record(name, begin + int64_t(from), begin + int64_t(to));
+        };
+        stage("http", 0, total);
+        stage("dns", 0, dns);
+        stage("connect", dns, connect);
+        stage("tls", connect, tls);
+        stage("ttfb", sent, first_byte);
+        stage("transfer", first_byte, total);
+      }
+
+      void count_connection(CURL *curl, CURLcode result) {
+        if (result != CURLE_OK)
+          return;
+        long connects = 0;
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+        if (connects == 0)
+          ++reuse_count;
+        else
+          open_count += connects;
+      }
+
+      // curl_global_init is not thread-safe and must not be paired with a
+      // cleanup per fetcher, so it runs once for the process and is never
+      // undone; a function-local static makes the first call the only one
+      static void init_curl() {
+        static const CURLcode result = []() {
+          CURLcode code = curl_global_init(CURL_GLOBAL_DEFAULT);
+          if (code != CURLE_OK)
+            std::cerr << "moonk5::alsong::lyrics_fetcher::init_curl() - "
+              << curl_easy_strerror(code) << "\n";
+          return code;
+        }();
+        (void)result;
+      }
+
+      static void share_lock(CURL *, curl_lock_data data,
+          curl_lock_access, void *userptr) {
+        static_cast<lyrics_fetcher *>(userptr)->share_mutexes[data].lock();
+      }
+
+      static void share_unlock(CURL *, curl_lock_data data, void *userptr) {
+        static_cast<lyrics_fetcher *>(userptr)->share_mutexes[data].unlock();
+      }
+
+      static size_t write_data(char *buffer, size_t size,
+          size_t nmemb, void *data) {
+        size_t result = size * nmemb;
+        static_cast<std::string *>(data)->append(buffer, result);
+        return result;
+      }  
+
+      struct curl_slist *headers = nullptr;
+      CURLSH *share = nullptr;
+      std::mutex share_mutexes[CURL_LOCK_DATA_LAST];
+      std::mutex pool_mutex;
+      std::vector<CURL *> idle_handles;
+      std::atomic<unsigned long> reuse_count{0};
+      std::atomic<unsigned long> open_count{0};
+      std::shared_ptr<negative_cache> negatives;
+
+      std::shared_ptr<request_scheduler> scheduler;
+      std::shared_ptr<concurrency_limiter> limiter;
+      std::shared_ptr<circuit_breaker> breaker;
+
+      static constexpr size_t LATENCY_SAMPLES = 128;
+      request_policy policy;
+      std::mutex latency_mutex;
+      long latencies[LATENCY_SAMPLES] = {};
+      size_t latency_count = 0;
+      std::atomic<unsigned long> retries{0};
+      std::atomic<unsigned long> hedges{0};
+      std::atomic<unsigned long> hedge_wins{0};
+    }; // struct moonk5::alsong::lyrics_fetcher
+
+    // compact on-disk format for a song collection, laid out so that a
+    // memory-mapped file can be used in place without parsing:
+    //   header | songs | time groups | string offsets | UTF-8 text
+    // every song owns SONG_STRINGS consecutive strings (lyric_id, title,
+    // artist, album, written_by) and each time group a run of lyric lines;
+    // all integers are native-endian uint32/int32
+    namespace lyrics_binary
+    {
+      const char MAGIC[4] = {'A', 'L', 'S', 'L'};
+      const uint32_t VERSION = 1;
+      const uint32_t SONG_STRINGS = 5;
+
+      struct header
+      {
+        char magic[4];
+        uint32_t version;
+        uint32_t song_count;
+        uint32_t group_count;
+        uint32_t string_count;
+        uint32_t text_size;
+      };
+
+      struct song_record
+      {
+        uint32_t first_string;
+        int32_t delay;
+        uint32_t first_group;
+        uint32_t group_count;
+      };
+
+      struct group_record
+      {
+        uint32_t time; // unit in milliseconds
+        uint32_t first_line;
+        uint32_t line_count;
+      };
+
+      // appends the binary image of songs to output
+      void encode(const std::vector<alsong::song_info>& songs,
+          std::string& output) {
+        std::vector<song_record> song_records;
+        std::vector<group_record> group_records;
+        std::vector<uint32_t> offsets;
+        std::string text;
+
+        auto add_string = [&](const std::string& str) {
+          offsets.push_back(uint32_t(text.size()));
+          text += str;
+        };
+
+        for (const alsong::song_info& song : songs) {
+          song_record record;
+          record.first_string = uint32_t(offsets.size());
+          record.delay = song.delay;
+          record.first_group = uint32_t(group_records.size());
+          record.group_count = uint32_t(song.lyrics_collection.size());
+          song_records.push_back(record);
+
+          add_string(song.lyric_id);
+          add_string(song.title);
+          add_string(song.artist);
+          add_string(song.album);
+          add_string(song.written_by);
+          for (const alsong::time_lyrics& tl : song.lyrics_collection) {
+            group_records.push_back({tl.time, uint32_t(offsets.size()),
+                uint32_t(tl.lyrics.size())});
+            for (const std::string& line : tl.lyrics)
+              add_string(line);
+          }
+        }
+
+        header h;
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = VERSION;
+        h.song_count = uint32_t(song_records.size());
+        h.group_count = uint32_t(group_records.size());
+        h.string_count = uint32_t(offsets.size());
+        h.text_size = uint32_t(text.size());
+        offsets.push_back(uint32_t(text.size()));
+
+        auto append = [&output](const void *data, size_t size) {
+          output.append(static_cast<const char *>(data), size);
+        };
+        output.reserve(output.size() + sizeof(h)
+            + song_records.size() * sizeof(song_record)
+            + group_records.size() * sizeof(group_record)
+            + offsets.size() * sizeof(uint32_t) + text.size());
+        append(&h, sizeof(h));
+        append(song_records.data(), song_records.size() * sizeof(song_record));
+        append(group_records.data(), group_records.size() * sizeof(group_record));
+        append(offsets.data(), offsets.size() * sizeof(uint32_t));
+        output += text;
+      }
+
+      // read-only view over an encoded collection; either maps a file or
+      // borrows a buffer the caller keeps alive. Strings are returned as
+      // views into the image
+      class view
+      {
+        public:
+          view() = default;
+          view(const view&) = delete;
+          view& operator=(const view&) = delete;
+
+          view(view&& other) noexcept {
+            *this = std::move(other);
+          }
+
+          view& operator=(view&& other) noexcept {
+            if (this != &other) {
+              close();
+              std::swap(image, other.image);
+              std::swap(mapped_size, other.mapped_size);
+              std::swap(songs, other.songs);
+              std::swap(groups, other.groups);
+              std::swap(offsets, other.offsets);
+              std::swap(text, other.text);
+              std::swap(h, other.h);
+            }
+            return *this;
+          }
+
+          ~view() {
+            close();
+          }
+
+          // maps path read-only; false if it is missing or not valid
+          bool open(const std::filesystem::path& path) {
+            close();
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+              return false;
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+              ::close(fd);
+              return false;
+            }
+            void *addr = ::mmap(nullptr, size_t(st.st_size), PROT_READ,
+                MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (addr == MAP_FAILED)
+              return false;
+            mapped_size = size_t(st.st_size);
+            if (!attach(std::string_view(static_cast<const char *>(addr),
+                    mapped_size))) {
+              ::munmap(addr, mapped_size);
+              mapped_size = 0;
+              return false;
+            }
+            return true;
+          }
+
+          // uses bytes in place, the caller keeps them alive and unchanged
+          bool open(std::string_view bytes) {
+            close();
+            return attach(bytes);
+          }
+
+          void close() {
+            if (mapped_size > 0)
+              ::munmap(const_cast<char *>(image.data()), mapped_size);
+            image = std::string_view();
+            mapped_size = 0;
+            h = header();
+            songs = nullptr;
+            groups = nullptr;
+            offsets = nullptr;
+            text = nullptr;
+          }
+
+          bool is_open() const {
+            return songs != nullptr;
+          }
+
+          size_t song_count() const {
+            return h.song_count;
+          }
+
+          const song_record& song(size_t i) const {
+            return songs[i];
+          }
+
+          const group_record& group(size_t i) const {
+            return groups[i];
+          }
+
+          std::string_view string(size_t i) const {
+            return std::string_view(text + offsets[i],
+                offsets[i + 1] - offsets[i]);
+          }
+
+          std::string_view lyric_id(size_t s) const {
+            return string(songs[s].first_string);
+          }
+
+          std::string_view title(size_t s) const {
+            return string(songs[s].first_string + 1);
+          }
+
+          std::string_view artist(size_t s) const {
+            return string(songs[s].first_string + 2);
+          }
+
+          std::string_view album(size_t s) const {
+            return string(songs[s].first_string + 3);
+          }
+
+          std::string_view written_by(size_t s) const {
+            return string(songs[s].first_string + 4);
+          }
+
+          // copies song s out of the image
+          void to_song_info(size_t s, alsong::song_info& song) const {
+            const song_record& record = songs[s];
+            song.lyric_id = lyric_id(s);
+            song.title = title(s);
+            song.artist = artist(s);
+            song.album = album(s);
+            song.written_by = written_by(s);
+            song.delay = record.delay;
+            song.lyrics_collection.clear();
+            song.lyrics_collection.reserve(record.group_count);
+            for (uint32_t g = 0; g < record.group_count; ++g) {
+              const group_record& gr = groups[record.first_group + g];
+              alsong::time_lyrics tl;
+              tl.time = gr.time;
+              tl.lyrics.reserve(gr.line_count);
+              for (uint32_t l = 0; l < gr.line_count; ++l)
+                tl.lyrics.emplace_back(string(gr.first_line + l));
+              song.lyrics_collection.push_back(std::move(tl));
+            }
+          }
+
+        private:
+          // validates the layout so accessors need no bounds checks; the
+          // records are read in place, so bytes must be 4 byte aligned
+          bool attach(std::string_view bytes) {
+            if (bytes.size() < sizeof(header)
+                || reinterpret_cast<uintptr_t>(bytes.data()) % alignof(song_record) != 0)
+              return false;
+            header hdr;
+            std::memcpy(&hdr, bytes.data(), sizeof(hdr));
+            if (std::memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0
+                || hdr.version != VERSION)
+              return false;
+
+            uint64_t size = sizeof(header)
+              + uint64_t(hdr.song_count) * sizeof(song_record)
+              + uint64_t(hdr.group_count) * sizeof(group_record)
+              + (uint64_t(hdr.string_count) + 1) * sizeof(uint32_t)
+              + hdr.text_size;
+            if (size != bytes.size())
+              return false;
+
+            const char *p = bytes.data() + sizeof(header);
+            const song_record *s = reinterpret_cast<const song_record *>(p);
+            p += hdr.song_count * sizeof(song_record);
+            const group_record *g = reinterpret_cast<const group_record *>(p);
+            p += hdr.group_count * sizeof(group_record);
+            const uint32_t *o = reinterpret_cast<const uint32_t *>(p);
+            p += (hdr.string_count + 1) * sizeof(uint32_t);
+
+            for (uint32_t i = 0; i < hdr.string_count; ++i)
+              if (o[i] > o[i + 1])
+                return false;
+            if (o[hdr.string_count] != hdr.text_size)
+              return false;
+            for (uint32_t i = 0; i < hdr.song_count; ++i) {
+              if (uint64_t(s[i].first_string) + SONG_STRINGS > hdr.string_count
+                  || uint64_t(s[i].first_group) + s[i].group_count > hdr.group_count)
+                return false;
+            }
+            for (uint32_t i = 0; i < hdr.group_count; ++i)
+              if (uint64_t(g[i].first_line) + g[i].line_count > hdr.string_count)
+                return false;
+
+            image = bytes;
+            h = hdr;
+            songs = s;
+            groups = g;
+            offsets = o;
+            text = p;
+            return true;
+          }
+
+          std::string_view image;
+          size_t mapped_size = 0;
+          header h = header();
+          const song_record *songs = nullptr;
+          const group_record *groups = nullptr;
+          const uint32_t *offsets = nullptr;
+          const char *text = nullptr;
+      }; // class moonk5::alsong::lyrics_binary::view
+    }
+
+    enum class lyrics_format { json, binary };
+
+    // log-structured store holding every cached song in a few append-only
+    // segment files instead of one file per song. Each record is
+    //   record_header | key_padding | key | value | padding to 8 bytes
+    // and the latest record of a key wins. key_padding puts every value on
+    // an 8 byte boundary, so binary images are read in place.
+    //
+    // Records are located through a persistent open-addressing hash table
+    // in the 'index' file, keyed by a 64-bit hash of the key. It is mapped
+    // shared at startup and updated in place on every append, so lookups
+    // and misses are answered from memory without syscalls. Its header
+    // keeps a checkpoint up to which it is complete; on open everything
+    // after it is replayed, and a torn record at the tail of the last
+    // segment (a crash mid-append) is cut off
+    class lyrics_pack
+    {
+      public:
+        struct location
+        {
+          uint32_t segment = 0;
+          uint64_t offset = 0; // of the value within the segment
+          uint32_t size = 0;
+        };
+
+        // segments are rolled over once they would grow past this size
+        static constexpr uint64_t DEFAULT_SEGMENT_SIZE = 64 * 1024 * 1024;
+
+        lyrics_pack(const std::filesystem::path& folder,
+            uint64_t segment_size=DEFAULT_SEGMENT_SIZE)
+          : folder(folder), max_segment_size(segment_size) {
+          std::error_code ec;
+          std::filesystem::create_directories(folder, ec);
+          lock_fd = ::open((folder / "LOCK").c_str(), O_RDWR | O_CREAT, 0644);
+
+          std::lock_guard<std::mutex> guard(mutex);
+          file_lock lock(lock_fd);
+          load();
+        }
+
+        lyrics_pack(const lyrics_pack&) = delete;
+        lyrics_pack& operator=(const lyrics_pack&) = delete;
+
+        ~lyrics_pack() {
+          unmap_all();
+          for (segment& seg : retired)
+            ::munmap(const_cast<char *>(seg.base), seg.mapped_size);
+          unmap_index();
+          if (lock_fd >= 0)
+            ::close(lock_fd);
+        }
+
+        // one pack per folder shared by every serializer in the process
+        static std::shared_ptr<lyrics_pack> open_shared(
+            const std::filesystem::path& folder) {
+          static std::mutex registry_mutex;
+          static std::map<std::string, std::weak_ptr<lyrics_pack>> registry;
+          std::lock_guard<std::mutex> guard(registry_mutex);
+          std::weak_ptr<lyrics_pack>& entry = registry[folder.string()];
+          std::shared_ptr<lyrics_pack> pack = entry.lock();
+          if (!pack) {
+            pack = std::make_shared<lyrics_pack>(folder);
+            entry = pack;
+          }
+          return pack;
+        }
+
+        // appends key/value as one record with a single write(2)
+        bool put(std::string_view key, std::string_view value) {
+          std::string record;
+          size_t value_offset = encode_record(key, value, record);
+
+          std::lock_guard<std::mutex> guard(mutex);
+          file_lock lock(lock_fd);
+          refresh();
+          if (index_base == nullptr)
+            return false;
+
+          segment *seg = active_segment();
+          // records the index could not take yet would sit between ours
+          // and the offset we compute for it
+          if (seg != nullptr && seg->size < seg->file_size)
+            return false;
+          if (seg == nullptr || (seg->size > 0
+                && seg->size + record.size() > max_segment_size))
+            seg = map_segment(next_segment_id(), true, record.size());
+          if (seg == nullptr)
+            return false;
+
+          int fd = ::open(segment_path(seg->id).c_str(),
+              O_WRONLY | O_CREAT | O_APPEND, 0644);
+          if (fd < 0)
             return false;
+          ssize_t written = ::write(fd, record.data(), record.size());
+          bool ok = written == ssize_t(record.size());
+          if (ok && sync)
+            ok = ::fdatasync(fd) == 0;
+          if (!ok && written > 0) {
+            // never leave a partial record behind
+            if (::ftruncate(fd, off_t(seg->size)) != 0)
+              ok = false;
           }
-          
-          tinyxml2::XMLElement* result = 
-            doc.FirstChildElement("soap:Envelope")
-            ->FirstChildElement("soap:Body")
-            ->FirstChildElement("GetResembleLyricList2Response")
-            ->FirstChildElement("GetResembleLyricList2Result");
+          ::close(fd);
+          if (!ok)
+            return false;
 
-          for (tinyxml2::XMLNode* child = result->FirstChildElement("ST_SEARCHLYRIC_LIST")
-              ; child
-              ; child = child->NextSiblingElement("ST_SEARCHLYRIC_LIST")) {
-            alsong::song_list list;
-            list.lyric_id = find_child(&child, "lyricID");
-            list.title = find_child(&child, "title");
-            list.artist = find_child(&child, "artist");
-            list.album = find_child(&child, "album");
-            song_list_collection.push_back(list);
+          location loc;
+          loc.segment = seg->id;
+          loc.offset = seg->size + value_offset;
+          loc.size = uint32_t(value.size());
+          seg->file_size = std::max(seg->file_size, seg->size + record.size());
+          // left unindexed, the record is replayed by the next refresh
+          if (!insert(key, loc))
+            return false;
+          seg->size += record.size();
+          set_checkpoint(loc.segment, seg->size);
+          return true;
+        }
 
-            ++count;
-            if (count >= 50)
+        bool contains(std::string_view key) {
+          return !get(key).empty();
+        }
+
+        // the value of key inside the mapped segment, empty if missing;
+        // it stays valid for the lifetime of the pack
+        std::string_view get(std::string_view key) {
+          std::lock_guard<std::mutex> guard(mutex);
+          if (index_base == nullptr || header()->replaced != 0) {
+            // another process grew or rebuilt the table
+            file_lock lock(lock_fd, LOCK_SH);
+            map_index();
+          }
+          const index_slot *slot = find_slot(hash_key(key), key);
+          if (slot == nullptr || slot->hash == 0)
+            return std::string_view();
+          return value_at(slot->segment, slot->offset, slot->size);
+        }
+
+        size_t size() {
+          std::lock_guard<std::mutex> guard(mutex);
+          return index_base != nullptr ? size_t(header()->count) : 0;
+        }
+
+        // fdatasync after every append, off by default
+        void set_sync(bool sync_writes) {
+          sync = sync_writes;
+        }
+
+        // rewrites the live records into fresh segments and rebuilds the
+        // index; meant to run offline as the only user of the pack. The old
+        // segments stay mapped until the pack is destroyed, so views handed
+        // out by get() remain valid after their files are removed
+        bool compact() {
+          std::lock_guard<std::mutex> guard(mutex);
+          file_lock lock(lock_fd);
+          refresh();
+          if (segments.empty() || index_base == nullptr)
+            return true;
+
+          std::vector<uint32_t> old_ids;
+          for (const segment& seg : segments)
+            old_ids.push_back(seg.id);
+
+          uint32_t id = next_segment_id();
+          uint32_t first_id = id;
+          std::string buffer;
+          auto flush = [&]() {
+            std::ofstream ofs(segment_path(id), std::ios::binary | std::ios::trunc);
+            ofs.write(buffer.data(), buffer.size());
+            ofs.close();
+            buffer.clear();
+            return bool(ofs);
+          };
+
+          std::string record;
+          const index_slot *slot_end = slots() + header()->capacity;
+          for (const index_slot *slot = slots(); slot != slot_end; ++slot) {
+            if (slot->hash == 0)
+              continue;
+            std::string_view value = value_at(slot->segment, slot->offset, slot->size);
+            if (value.data() == nullptr || slot->offset < slot->key_size)
+              continue;
+            std::string_view key(value.data() - slot->key_size, slot->key_size);
+            record.clear();
+            encode_record(key, value, record);
+            if (!buffer.empty() && buffer.size() + record.size() > max_segment_size) {
+              if (!flush())
+                return false;
+              ++id;
+            }
+            buffer += record;
+          }
+          if (!buffer.empty() && !flush())
+            return false;
+
+          // the new segments are complete, index them in a fresh table; until
+          // the old ones are gone a crash just replays both, newest winning
+          uint64_t capacity = header()->capacity;
+          header()->replaced = 1;
+          unmap_index();
+          std::filesystem::remove(folder / "index");
+          retired.insert(retired.end(), segments.begin(), segments.end());
+          segments.clear();
+          for (uint32_t new_id = first_id; new_id <= id; ++new_id)
+            map_segment(new_id, true);
+          if (!map_index(capacity))
+            return false;
+          set_checkpoint(first_id, 0);
+          refresh();
+          for (uint32_t old_id : old_ids)
+            std::filesystem::remove(segment_path(old_id));
+          return true;
+        }
+
+      private:
+        static constexpr uint32_t RECORD_MAGIC = 0x32534c41; // "ALS2"
+        static constexpr uint32_t INDEX_MAGIC = 0x58534c41;  // "ALSX"
+        static constexpr uint32_t INDEX_VERSION = 3;
+        static constexpr uint64_t INITIAL_CAPACITY = 1024;
+
+        struct record_header
+        {
+          uint32_t magic;
+          uint32_t key_size;
+          uint32_t value_size;
+          uint32_t checksum;
+          uint32_t key_padding;     // zero bytes between header and key
+          uint32_t reserved;
+        };
+
+        struct index_header
+        {
+          uint32_t magic;
+          uint32_t version;
+          uint64_t capacity;        // power of two
+          uint64_t count;
+          uint32_t covered_segment; // the table holds every record before
+          uint32_t replaced;        // set once a newer table took over
+          uint64_t covered_offset;  // this segment and offset
+        };
+
+        struct index_slot
+        {
+          uint64_t hash;            // 0 marks an empty slot
+          uint64_t offset;
+          uint32_t segment;
+          uint32_t size;
+          uint32_t key_size;        // the key precedes the value on disk
+          uint32_t reserved;
+        };
+
+        struct segment
+        {
+          uint32_t id = 0;
+          uint64_t size = 0;        // bytes of valid records
+          uint64_t file_size = 0;   // bytes known to be in the file
+          const char *base = nullptr;
+          size_t mapped_size = 0;
+        };
+
+        // holds flock(2) on the pack so several processes can share it
+        struct file_lock
+        {
+          int fd;
+          file_lock(int fd, int operation=LOCK_EX) : fd(fd) {
+            if (fd >= 0)
+              ::flock(fd, operation);
+          }
+          ~file_lock() {
+            if (fd >= 0)
+              ::flock(fd, LOCK_UN);
+          }
+        };
+
+        static uint64_t hash_key(std::string_view key) {
+          // 0 is reserved for empty slots
+          uint64_t hash = key_normalization::hash(key);
+          return hash != 0 ? hash : 1;
+        }
+
+        static uint32_t checksum(std::string_view key, std::string_view value) {
+          // the key and value hash folded to 32 bits
+          uint64_t hash = key_normalization::hash(value,
+              key_normalization::hash(key));
+          return uint32_t(hash ^ (hash >> 32));
+        }
+
+        static size_t padded(size_t size) {
+          return (size + 7) & ~size_t(7);
+        }
+
+        static uint32_t key_padding(uint32_t key_size) {
+          return uint32_t(padded(key_size) - key_size);
+        }
+
+        // appends the record of key/value and returns the offset of the
+        // value within it
+        static size_t encode_record(std::string_view key, std::string_view value,
+            std::string& record) {
+          record_header h;
+          h.magic = RECORD_MAGIC;
+          h.key_size = uint32_t(key.size());
+          h.value_size = uint32_t(value.size());
+          h.checksum = checksum(key, value);
+          h.key_padding = key_padding(h.key_size);
+          h.reserved = 0;
+          size_t start = record.size();
+          size_t size = sizeof(h) + h.key_padding + key.size() + value.size();
+          record.reserve(start + padded(size));
+          record.append(reinterpret_cast<const char *>(&h), sizeof(h));
+          record.append(h.key_padding, '\0');
+          record += key;
+          size_t value_offset = record.size() - start;
+          record += value;
+          record.resize(start + padded(size), '\0');
+          return value_offset;
+        }
+
+        std::filesystem::path segment_path(uint32_t id) const {
+          char name[32];
+          std::snprintf(name, sizeof(name), "%08u.seg", id);
+          return folder / name;
+        }
+
+        segment* active_segment() {
+          return segments.empty() ? nullptr : &segments.back();
+        }
+
+        uint32_t next_segment_id() const {
+          return segments.empty() ? 1 : segments.back().id + 1;
+        }
+
+        index_header* header() {
+          return reinterpret_cast<index_header *>(index_base);
+        }
+
+        index_slot* slots() {
+          return reinterpret_cast<index_slot *>(index_base + sizeof(index_header));
+        }
+
+        // maps the hash table, creating an empty one if the file is
+        // missing or not valid
+        bool map_index(uint64_t min_capacity=INITIAL_CAPACITY) {
+          unmap_index();
+          std::filesystem::path path = folder / "index";
+          int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+          if (fd < 0)
+            return false;
+
+          struct stat st;
+          ::fstat(fd, &st);
+          index_header h = index_header();
+          bool valid = size_t(st.st_size) >= sizeof(h)
+            && ::pread(fd, &h, sizeof(h), 0) == ssize_t(sizeof(h))
+            && h.magic == INDEX_MAGIC && h.version == INDEX_VERSION
+            && h.replaced == 0 && h.capacity != 0
+            && (h.capacity & (h.capacity - 1)) == 0
+            && uint64_t(st.st_size) == sizeof(h) + h.capacity * sizeof(index_slot);
+          if (!valid) {
+            uint64_t capacity = INITIAL_CAPACITY;
+            while (capacity < min_capacity)
+              capacity *= 2;
+            h = index_header();
+            h.magic = INDEX_MAGIC;
+            h.version = INDEX_VERSION;
+            h.capacity = capacity;
+            // nothing covered yet, every segment gets replayed
+            if (::ftruncate(fd, 0) != 0
+                || ::ftruncate(fd, off_t(sizeof(h) + capacity * sizeof(index_slot))) != 0
+                || ::pwrite(fd, &h, sizeof(h), 0) != ssize_t(sizeof(h))) {
+              ::close(fd);
+              return false;
+            }
+          }
+
+          index_size = sizeof(h) + h.capacity * sizeof(index_slot);
+          void *addr = ::mmap(nullptr, index_size, PROT_READ | PROT_WRITE,
+              MAP_SHARED, fd, 0);
+          ::close(fd);
+          if (addr == MAP_FAILED) {
+            index_size = 0;
+            return false;
+          }
+          index_base = static_cast<char *>(addr);
+          return true;
+        }
+
+        void unmap_index() {
+          if (index_base != nullptr)
+            ::munmap(index_base, index_size);
+          index_base = nullptr;
+          index_size = 0;
+        }
+
+        void set_checkpoint(uint32_t segment_id, uint64_t offset) {
+          header()->covered_segment = segment_id;
+          header()->covered_offset = offset;
+        }
+
+        // the slot holding key, or the empty slot where it would go;
+        // nullptr if the key is missing from a full table
+        index_slot* find_slot(uint64_t hash, std::string_view key) {
+          uint64_t capacity = header()->capacity;
+          uint64_t mask = capacity - 1;
+          uint64_t i = hash & mask;
+          for (uint64_t probe = 0; probe < capacity; ++probe, i = (i + 1) & mask) {
+            index_slot *slot = slots() + i;
+            if (slot->hash == 0)
+              return slot;
+            if (slot->hash != hash || slot->key_size != key.size()
+                || slot->offset < key.size())
+              continue;
+            std::string_view value = value_at(slot->segment, slot->offset,
+                slot->size);
+            if (value.data() != nullptr
+                && std::string_view(value.data() - key.size(), key.size()) == key)
+              return slot;
+          }
+          return nullptr;
+        }
+
+        // false if the table could not make room for key
+        bool insert(std::string_view key, const location& loc) {
+          if ((header()->count + 1) * 10 > header()->capacity * 7 && !grow())
+            return false;
+          uint64_t hash = hash_key(key);
+          index_slot *slot = find_slot(hash, key);
+          if (slot == nullptr)
+            return false;
+          if (slot->hash == 0) {
+            slot->hash = hash;
+            slot->key_size = uint32_t(key.size());
+            ++header()->count;
+          }
+          slot->segment = loc.segment;
+          slot->offset = loc.offset;
+          slot->size = loc.size;
+          return true;
+        }
+
+        // rehashes into a table twice the size and swaps it in; on failure
+        // the current table stays in use
+        bool grow() {
+          std::error_code ec;
+          std::filesystem::path tmp_path = folder / "index.tmp";
+          uint64_t capacity = header()->capacity * 2;
+          size_t size = sizeof(index_header) + capacity * sizeof(index_slot);
+          int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+          if (fd < 0 || ::ftruncate(fd, off_t(size)) != 0) {
+            std::cerr << "moonk5::alsong::lyrics_pack::grow() - cannot create "
+              << tmp_path << ": " << std::strerror(errno) << "\n";
+            if (fd >= 0)
+              ::close(fd);
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+          }
+          void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+          ::close(fd);
+          if (addr == MAP_FAILED) {
+            std::cerr << "moonk5::alsong::lyrics_pack::grow() - cannot map "
+              << tmp_path << ": " << std::strerror(errno) << "\n";
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+          }
+
+          char *base = static_cast<char *>(addr);
+          index_header *h = reinterpret_cast<index_header *>(base);
+          index_slot *table = reinterpret_cast<index_slot *>(base + sizeof(index_header));
+          *h = *header();
+          h->capacity = capacity;
+          const index_slot *slot_end = slots() + header()->capacity;
+          for (const index_slot *slot = slots(); slot != slot_end; ++slot) {
+            if (slot->hash == 0)
+              continue;
+            uint64_t i = slot->hash & (capacity - 1);
+            while (table[i].hash != 0)
+              i = (i + 1) & (capacity - 1);
+            table[i] = *slot;
+          }
+          ::munmap(addr, size);
+
+          std::filesystem::rename(tmp_path, folder / "index", ec);
+          if (ec) {
+            std::cerr << "moonk5::alsong::lyrics_pack::grow() - cannot replace "
+              << "the index: " << ec.message() << "\n";
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+          }
+          header()->replaced = 1;
+          return map_index();
+        }
+
+        // view of a value, mapping its segment on first use. Reads never
+        // go past the end of the file, touching mapped pages there raises
+        // SIGBUS; a slot pointing past it, say into a truncated segment,
+        // is a miss
+        std::string_view value_at(uint32_t segment_id, uint64_t offset,
+            uint32_t size) {
+          segment *seg = nullptr;
+          for (segment& s : segments)
+            if (s.id == segment_id)
+              seg = &s;
+          if (seg == nullptr)
+            seg = map_segment(segment_id, false);
+          if (seg == nullptr)
+            return std::string_view();
+          if (offset + size > seg->file_size) {
+            // another process may have appended since
+            struct stat st;
+            if (::stat(segment_path(seg->id).c_str(), &st) == 0)
+              seg->file_size = std::min<uint64_t>(uint64_t(st.st_size),
+                  seg->mapped_size);
+            if (offset + size > seg->file_size)
+              return std::string_view();
+          }
+          return std::string_view(seg->base + offset, size);
+        }
+
+        // maps a segment once with room to grow to the maximum segment
+        // size, so views handed out earlier stay valid while it grows
+        segment* map_segment(uint32_t id, bool create, size_t min_size=0) {
+          int fd = ::open(segment_path(id).c_str(),
+              O_RDONLY | (create ? O_CREAT : 0), 0644);
+          if (fd < 0)
+            return nullptr;
+          struct stat st;
+          ::fstat(fd, &st);
+          segment seg;
+          seg.id = id;
+          seg.file_size = uint64_t(st.st_size);
+          seg.mapped_size = std::max<size_t>({size_t(max_segment_size),
+              size_t(st.st_size), min_size});
+          void *addr = ::mmap(nullptr, seg.mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+          ::close(fd);
+          if (addr == MAP_FAILED)
+            return nullptr;
+          seg.base = static_cast<const char *>(addr);
+          segments.push_back(seg);
+          std::sort(segments.begin(), segments.end(),
+              [](const segment& a, const segment& b) { return a.id < b.id; });
+          for (segment& s : segments)
+            if (s.id == id)
+              return &s;
+          return nullptr;
+        }
+
+        void unmap_all() {
+          for (segment& seg : segments)
+            if (seg.base != nullptr)
+              ::munmap(const_cast<char *>(seg.base), seg.mapped_size);
+          segments.clear();
+        }
+
+        // replays the records of segments[i] from its current size to the
+        // end of the file; a torn record at the end of the last segment is
+        // cut off
+        void scan(size_t i) {
+          uint32_t id = segments[i].id;
+          bool last = i + 1 == segments.size();
+          struct stat st;
+          if (::stat(segment_path(id).c_str(), &st) != 0)
+            return;
+          uint64_t file_size = std::min<uint64_t>(uint64_t(st.st_size),
+              segments[i].mapped_size);
+          segments[i].file_size = file_size;
+
+          while (segments[i].size + sizeof(record_header) <= file_size) {
+            const segment& seg = segments[i];
+            record_header h;
+            std::memcpy(&h, seg.base + seg.size, sizeof(h));
+            uint64_t end = seg.size + padded(sizeof(h) + uint64_t(h.key_padding)
+                + h.key_size + h.value_size);
+            if (h.magic != RECORD_MAGIC || h.key_padding != key_padding(h.key_size)
+                || end > file_size)
               break;
+            std::string_view key(seg.base + seg.size + sizeof(h) + h.key_padding,
+                h.key_size);
+            std::string_view value(key.data() + key.size(), h.value_size);
+            if (checksum(key, value) != h.checksum)
+              break;
+
+            location loc;
+            loc.segment = id;
+            loc.offset = seg.size + sizeof(h) + h.key_padding + h.key_size;
+            loc.size = h.value_size;
+            if (!insert(key, loc))
+              return;
+            segments[i].size = end;
+            set_checkpoint(id, end);
           }
 
-          std::cout << "count = " << count << std::endl;
-          
+          uint64_t valid = segments[i].size;
+          if (last && valid < uint64_t(st.st_size)) {
+            std::cerr << "moonk5::alsong::lyrics_pack - recovered "
+              << segment_path(id) << ", dropped "
+              << uint64_t(st.st_size) - valid << " bytes\n";
+            if (::truncate(segment_path(id).c_str(), off_t(valid)) != 0)
+              std::cerr << "moonk5::alsong::lyrics_pack - truncate failed\n";
+            else
+              segments[i].file_size = valid;
+          }
+        }
+
+        // picks up a replaced table, new segments and any records past the
+        // checkpoint, whether from a crash or from another process
+        void refresh() {
+          if (index_base == nullptr || header()->replaced != 0)
+            map_index();
+          if (index_base == nullptr)
+            return;
+
+          uint32_t id = next_segment_id();
+          while (std::filesystem::exists(segment_path(id)))
+            map_segment(id++, false);
+
+          uint32_t covered = header()->covered_segment;
+          for (size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i].id < covered)
+              continue;
+            if (segments[i].id == covered)
+              segments[i].size = std::max(segments[i].size,
+                  header()->covered_offset);
+            scan(i);
+          }
+        }
+
+        void load() {
+          std::vector<uint32_t> ids;
+          for (const auto& entry : std::filesystem::directory_iterator(folder)) {
+            const std::string name = entry.path().filename().string();
+            if (entry.path().extension() == ".seg")
+              ids.push_back(uint32_t(std::strtoul(name.c_str(), nullptr, 10)));
+          }
+          for (uint32_t id : ids)
+            map_segment(id, false);
+          map_index();
+          if (index_base != nullptr && index_is_stale()) {
+            std::cerr << "moonk5::alsong::lyrics_pack - segment "
+              << header()->covered_segment << " is shorter than its index, "
+              << "rebuilding the index\n";
+            header()->replaced = 1;
+            map_index();
+          }
+          refresh();
+        }
+
+        // whether the table claims records past the end of the segment it
+        // covers, as after the segment file was cut short or removed
+        bool index_is_stale() {
+          uint32_t covered = header()->covered_segment;
+          uint64_t offset = header()->covered_offset;
+          if (covered == 0 || offset == 0)
+            return false;
+          for (const segment& seg : segments)
+            if (seg.id == covered)
+              return seg.file_size < offset;
+          return true;
+        }
+
+        std::filesystem::path folder;
+        uint64_t max_segment_size;
+        bool sync = false;
+        int lock_fd = -1;
+        std::mutex mutex;
+        std::vector<segment> segments;
+        std::vector<segment> retired; // replaced by compact, still mapped
+        char *index_base = nullptr;
+        size_t index_size = 0;
+    }; // class moonk5::alsong::lyrics_pack
+
+    // in-memory LRU of parsed songs bounded by their approximate size in
+    // bytes; songs are shared and immutable, so a hit costs a refcount
+    // instead of reading and rebuilding the song
+    class song_cache
+    {
+      public:
+        typedef std::shared_ptr<const song_info> entry;
+
+        static constexpr size_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+
+        song_cache(size_t capacity_bytes=DEFAULT_CAPACITY)
+          : capacity(capacity_bytes) {
+        }
+
+        song_cache(const song_cache&) = delete;
+        song_cache& operator=(const song_cache&) = delete;
+
+        // one cache shared by every serializer in the process
+        static song_cache& shared() {
+          static song_cache cache;
+          return cache;
+        }
+
+        // the cached song, or nullptr on a miss
+        entry get(const std::string& key) {
+          std::lock_guard<std::mutex> guard(mutex);
+          auto it = index.find(key);
+          if (it == index.end()) {
+            ++miss_count;
+            return nullptr;
+          }
+          ++hit_count;
+          entries.splice(entries.begin(), entries, it->second);
+          return it->second->song;
+        }
+
+        // inserts or replaces key; a song larger than the whole cache is
+        // not kept
+        void put(const std::string& key, entry song) {
+          if (!song)
+            return;
+          size_t bytes = key.size() + song->memory_size();
+
+          std::lock_guard<std::mutex> guard(mutex);
+          auto it = index.find(key);
+          if (it != index.end()) {
+            used -= it->second->bytes;
+            entries.erase(it->second);
+            index.erase(it);
+          }
+          if (bytes > capacity)
+            return;
+
+          entries.push_front(node{key, std::move(song), bytes});
+          index.emplace(key, entries.begin());
+          used += bytes;
+          evict();
+        }
+
+        void erase(const std::string& key) {
+          std::lock_guard<std::mutex> guard(mutex);
+          auto it = index.find(key);
+          if (it == index.end())
+            return;
+          used -= it->second->bytes;
+          entries.erase(it->second);
+          index.erase(it);
+        }
+
+        void clear() {
+          std::lock_guard<std::mutex> guard(mutex);
+          entries.clear();
+          index.clear();
+          used = 0;
+        }
+
+        void set_capacity(size_t capacity_bytes) {
+          std::lock_guard<std::mutex> guard(mutex);
+          capacity = capacity_bytes;
+          evict();
+        }
+
+        size_t size() {
+          std::lock_guard<std::mutex> guard(mutex);
+          return entries.size();
+        }
+
+        size_t bytes() {
+          std::lock_guard<std::mutex> guard(mutex);
+          return used;
+        }
+
+        uint64_t hits() const { return hit_count; }
+        uint64_t misses() const { return miss_count; }
+        uint64_t evictions() const { return eviction_count; }
+
+      private:
+        struct node
+        {
+          std::string key;
+          entry song;
+          size_t bytes;
+        };
+
+        void evict() {
+          while (used > capacity && !entries.empty()) {
+            used -= entries.back().bytes;
+            index.erase(entries.back().key);
+            entries.pop_back();
+            ++eviction_count;
+          }
+        }
+
+        size_t capacity;
+        size_t used = 0;
+        std::mutex mutex;
+        std::list<node> entries; // most recently used first
+        std::unordered_map<std::string, std::list<node>::iterator> index;
+        std::atomic<uint64_t> hit_count{0};
+        std::atomic<uint64_t> miss_count{0};
+        std::atomic<uint64_t> eviction_count{0};
+    }; // class moonk5::alsong::song_cache
+
+    // collapses concurrent calls for the same key into one: the first
+    // caller runs the work, callers arriving while it runs wait for it and
+    // receive the very same result
+    template <typename T>
+    class single_flight
+    {
+      public:
+        typedef std::shared_ptr<const T> value;
+
+        value run(const std::string& key, const std::function<value()>& work) {
+          std::shared_ptr<call> c;
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto it = calls.find(key);
+            if (it != calls.end()) {
+              ++collapsed_count;
+              c = it->second;
+              done.wait(lock, [&c]() { return c->finished; });
+              return c->result;
+            }
+            c = std::make_shared<call>();
+            calls.emplace(key, c);
+            ++leader_count;
+          }
+
+          value result;
+          try {
+            result = work();
+          } catch (...) {
+            finish(key, c, nullptr);
+            throw;
+          }
+          finish(key, c, result);
+          return result;
+        }
+
+        // calls that ran the work
+        uint64_t leaders() const { return leader_count; }
+        // calls that attached to one already in flight
+        uint64_t collapsed() const { return collapsed_count; }
+
+      private:
+        struct call
+        {
+          bool finished = false;
+          value result;
+        };
+
+        void finish(const std::string& key, const std::shared_ptr<call>& c,
+            value result) {
+          {
+            std::lock_guard<std::mutex> guard(mutex);
+            c->result = std::move(result);
+            c->finished = true;
+            calls.erase(key);
+          }
+          done.notify_all();
+        }
+
+        std::mutex mutex;
+        std::condition_variable done;
+        std::unordered_map<std::string, std::shared_ptr<call>> calls;
+        std::atomic<uint64_t> leader_count{0};
+        std::atomic<uint64_t> collapsed_count{0};
+    }; // class moonk5::alsong::single_flight
+
+
+    class lyrics_serializer
+    {
+      public:
+        std::vector<alsong::song_list> song_list_collection;
+        std::vector<alsong::song_info> song_collection;
+
+      public:
+        lyrics_serializer(const std::string& lyrics_path,
+            unsigned int lyrics_count=3) {
+          set_lyrics_folder_path(lyrics_path);
+          max_lyrics_count = lyrics_count;
+        }
+
+        lyrics_serializer(unsigned int lyrics_count=3)
+          : lyrics_serializer(std::string(getenv("HOME")) + "/.alsong",
+              lyrics_count) {
+
+          }
+
+        // streaming counterpart of parse_lyric_list, pass the parser to
+        // lyrics_fetcher::fetch_lyric_list and call finish() afterwards
+        soap_stream_parser lyric_list_stream() {
+          return lyric_list_stream(song_list_collection);
+        }
+
+        // same, collecting into lists
+        static soap_stream_parser lyric_list_stream(
+            std::vector<alsong::song_list>& lists) {
+          soap_stream_parser parser("GetResembleLyricList2Result");
+          parser.on_song_list = [&lists, count = 0](alsong::song_list& list) mutable {
+            if (count++ < 50)
+              lists.push_back(std::move(list));
+          };
+          return parser;
+        }
+
+        // streaming counterpart of parse_lyric
+        soap_stream_parser lyric_stream() {
+          return lyric_stream(song_collection);
+        }
+
+        // same, collecting into songs
+        soap_stream_parser lyric_stream(std::vector<alsong::song_info>& songs) {
+          soap_stream_parser parser("GetLyricByID2Result");
+          parser.on_lyric = [this, &songs](alsong::song_info& song,
+              std::string& lyric) {
+            song.delay = 0;
+            parse_lyrics(lyric, song);
+            songs.push_back(std::move(song));
+          };
+          return parser;
+        }
+
+        // known response shapes are read without building a DOM; anything
+        // unexpected falls back to tinyxml2, which parses alsong_raw in
+        // place, so move the response in to avoid copying it
+        bool parse_lyric_list(std::string alsong_raw) {
+          tracer::span span("parse_lyric_list");
+          if (alsong_raw.find("GetResembleLyricList2Result") == std::string::npos) {
+            std::cerr << "SOAP Fault: missing tag, GetResembleLyricList2Result\n";
+            return false;
+          }
+
+          size_t before = song_list_collection.size();
+          if (!soap_extract::lyric_list(alsong_raw, song_list_collection, 50)
+              && !parse_lyric_list_dom(alsong_raw))
+            return false;
+
+          std::cout << "count = " << song_list_collection.size() - before
+            << std::endl;
           return true;
         }
         
-        bool parse_lyric(const std::string& alsong_raw) {
-          tinyxml2::XMLDocument doc;
-          doc.Parse(alsong_raw.c_str(), alsong_raw.size());
-          
+        bool parse_lyric(std::string alsong_raw) {
+          tracer::span span("parse_lyric");
           if (alsong_raw.find("GetLyricByID2Result") == std::string::npos) {
             std::cerr << "SOAP Fault: missing tag, GetLyricByID2Result\n";
             return false;
           }
 
-          tinyxml2::XMLElement* result = 
-            doc.FirstChildElement("soap:Envelope")
-            ->FirstChildElement("soap:Body")
-            ->FirstChildElement("GetLyricByID2Response")
-            ->FirstChildElement("GetLyricByID2Result");
-          
-          tinyxml2::XMLNode* child = result->NextSibling();
-
           alsong::song_info song;
-          song.lyric_id = find_child(&child, "lyricID");
-          song.title = find_child(&child, "title");
-          song.artist = find_child(&child, "artist");
-          song.album = find_child(&child, "album");
-          song.written_by = find_child(&child, "registerName");
+          std::string lyrics_raw;
+          if (!soap_extract::lyric(alsong_raw, song, lyrics_raw)) {
+            song = alsong::song_info();
+            lyrics_raw.clear();
+            if (!parse_lyric_dom(alsong_raw, song, lyrics_raw))
+              return false;
+          }
           song.delay = 0;
-          std::string lyrics_raw = find_child(&child, "lyric");
           parse_lyrics(lyrics_raw, song);
 
           //std::cout << song.to_json_string() << std::endl;
           song_collection.push_back(song);
-          
           return true;
         }
 
-        // serialization
-        // transformates a song_info object in memory to a file
-        bool write(const std::string& title, const std::string& artist,
+        // serialization
+        // transformates a song_info object in memory to a file, in the
+        // format chosen with set_lyrics_format; binary songs are appended
+        // to the pack store in the lyrics folder
+        bool write(const std::string& title, const std::string& artist,
+            bool overwrite=false) {
+          tracer::span span("write");
+          if (format == lyrics_format::json)
+            return export_json(title, artist, overwrite);
+          if (song_collection.size() <= 0)
+            return false;
+
+          std::string key = create_filename(artist, title, "");
+          if (overwrite == false && pack->contains(key)) {
+            std::cerr << "moonk5::alsong::lyrics_serializer::write() - "
+              << "file already exists\n";
+            return false;
+          }
+
+          std::string image;
+          lyrics_binary::encode(song_collection, image);
+          if (!pack->put(key, image))
+            return false;
+          cache_song(title, artist);
+          return true;
+        }
+        
+        bool write(bool overwrite=false) {
+          if (song_collection.size() <= 0)
+            return false;
+          return write(song_collection[0].title, song_collection[0].artist, overwrite);
+        }
+
+        // writes the song collection as a JSON 'artist - title.lyrics' file
+        bool export_json(const std::string& title, const std::string& artist,
             bool overwrite=false) {
           if (song_collection.size() <= 0)
             return false;
           
           // file nameing convention
-          // 'artist - title.lyrics' 
+          // 'hh/hash artist - title.lyrics', see create_filename
           std::string filename = create_filename(artist, title);
           std::filesystem::path lyrics_path = lyrics_folder_path / filename;
           if (std::filesystem::exists(lyrics_path) && overwrite == false) {
@@ -376,22 +4430,32 @@ namespace moonk5
               << "file already exists\n";
             return false;
           } else {
+            std::error_code ec;
+            std::filesystem::create_directories(lyrics_path.parent_path(), ec);
             std::ofstream ofs(lyrics_path);
-            ofs << to_json_string() << std::endl;
+            tracer::span span("json");
+            write_json(ofs);
+            ofs << std::endl;
             ofs.close();
           }
+          cache_song(title, artist);
           return true;
         }
         
-        bool write(bool overwrite=false) {
-          if (song_collection.size() <= 0)
-            return false;
-          return write(song_collection[0].title, song_collection[0].artist, overwrite);
-        }
-        
         //deserialize
-        // transformates a lyrics file into a song_info object
+        // transformates a lyrics file into a song_info object; the pack
+        // store is preferred, per-song binary and JSON files are still read
         bool read(const std::string& title, const std::string& artist) {
+          tracer::span span("read");
+          lyrics_binary::view view;
+          if (read_view(title, artist, view)) {
+            song_collection.clear();
+            song_collection.resize(view.song_count());
+            for (size_t i = 0; i < view.song_count(); ++i)
+              view.to_song_info(i, song_collection[i]);
+            return true;
+          }
+
           std::string filename = create_filename(artist, title);
           std::filesystem::path lyrics_path = lyrics_folder_path / filename;
           if (std::filesystem::exists(lyrics_path)) {
@@ -405,6 +4469,7 @@ namespace moonk5
             auto& collection = j.at("song_collection");
             for (auto&& s : collection) {
               alsong::song_info song;
+              song.lyric_id = s.value("lyric_id", "");
               song.title = s.at("title");
               song.artist = s.at("artist");
               song.album = s.at("album");
@@ -414,7 +4479,8 @@ namespace moonk5
               for (auto&& tl : tls) {
                 auto& ls = tl.at("lyrics");
                 for (auto&& l : ls) {
-                  song.add_lyrics(tl.at("time"), l);
+                  song.add_lyrics(tl.at("time").get<std::string>(),
+                      l.get<std::string>());
                 }
               }
               song_collection.push_back(song);
@@ -425,30 +4491,392 @@ namespace moonk5
           return true;
         }
 
+        // the stored song for title and artist from the in-memory cache,
+        // reading it from disk on a miss; nullptr if it was never written.
+        // Only the first song of a stored collection is cached
+        song_cache::entry lookup(const std::string& title,
+            const std::string& artist) {
+          std::string key = cache_key(title, artist);
+          song_cache::entry song = cache->get(key);
+          if (song)
+            return song;
+
+          std::vector<alsong::song_info> stored;
+          stored.swap(song_collection);
+          if (read(title, artist) && !song_collection.empty()) {
+            song = std::make_shared<const alsong::song_info>(
+                std::move(song_collection[0]));
+            cache->put(key, song);
+          }
+          song_collection.swap(stored);
+          return song;
+        }
+
+        // search results for title/artist into song_list_collection. The
+        // pack keeps a search tier keyed by the folded query, so repeated
+        // searches are answered locally until search_ttl runs out; empty
+        // results are left to the negative cache. While upstream fails,
+        // expired results are served instead
+        bool search(lyrics_fetcher& fetcher, const std::string& title,
+            const std::string& artist,
+            request_priority priority=request_priority::interactive) {
+          song_list_collection.clear();
+          if (find_search(title, artist))
+            return true;
+
+          // identical searches running at the same time go upstream once
+          std::string key = (lyrics_folder_path / query_key(title, artist)).string();
+          search_flight::value lists = search_flights().run(key, [&]() {
+              search_flight::value result;
+              std::vector<alsong::song_list> found;
+              soap_stream_parser parser = lyric_list_stream(found);
+              if (fetcher.fetch_lyric_list(title, artist, parser, priority) == CURLE_OK
+                  && parser.finish()) {
+                store_search(title, artist, found);
+                result = std::make_shared<const std::vector<alsong::song_list>>(
+                    std::move(found));
+              }
+              return result;
+            });
+          if (!lists)
+            return find_search(title, artist, true);
+          song_list_collection = *lists;
+          return true;
+        }
+
+        // the song with lyric_id, appended to song_collection as well. It
+        // comes from the in-memory cache, the lyrics tier of the pack keyed
+        // by lyric_id, or upstream in that order, so differently spelled
+        // searches resolving to the same lyrics share one copy; concurrent
+        // fetches of one lyric_id share one upstream request
+        song_cache::entry fetch(lyrics_fetcher& fetcher,
+            const std::string& lyric_id,
+            request_priority priority=request_priority::interactive) {
+          song_cache::entry song = find_lyric(lyric_id);
+          if (!song) {
+            std::string key = (lyrics_folder_path / lyric_id).string();
+            song = lyric_flights().run(key, [&]() {
+                std::vector<alsong::song_info> fetched;
+                soap_stream_parser parser = lyric_stream(fetched);
+                if (fetcher.fetch_lyric(lyric_id, parser, priority) != CURLE_OK
+                    || !parser.finish() || fetched.empty())
+                  return song_cache::entry();
+                return store_lyric(lyric_id, fetched.back());
+              });
+          }
+          if (song)
+            song_collection.push_back(*song);
+          return song;
+        }
+
+        // searches and lyric fetches that attached to an identical one in
+        // flight instead of going upstream themselves
+        static uint64_t collapsed_searches() {
+          return search_flights().collapsed();
+        }
+
+        static uint64_t collapsed_fetches() {
+          return lyric_flights().collapsed();
+        }
+
+        // appends the stored results of title/artist to
+        // song_list_collection, false if there are none; expired ones only
+        // count if stale is set
+        bool find_search(const std::string& title, const std::string& artist,
+            bool stale=false) {
+          return decode_search(pack->get("search:" + query_key(title, artist)),
+              song_list_collection, stale);
+        }
+
+        // stores song_list_collection as the results of title/artist
+        void store_search(const std::string& title, const std::string& artist) {
+          store_search(title, artist, song_list_collection);
+        }
+
+        // stores lists as the results of title/artist, and drops the search
+        // from the negative cache of this folder if it has one
+        void store_search(const std::string& title, const std::string& artist,
+            const std::vector<alsong::song_list>& lists) {
+          if (lists.empty())
+            return;
+          std::string image;
+          encode_search(lists, image);
+          pack->put("search:" + query_key(title, artist), image);
+          if (std::filesystem::exists(lyrics_folder_path / "negative"))
+            negative_searches()->remove(title, artist);
+        }
+
+        // the stored song with lyric_id, nullptr if it is not stored
+        song_cache::entry find_lyric(const std::string& lyric_id) {
+          std::string key = "lyric:" + lyric_id;
+          std::string cache_id = (lyrics_folder_path / key).string();
+          song_cache::entry song = cache->get(cache_id);
+          if (song)
+            return song;
+
+          lyrics_binary::view view;
+          if (!view.open(pack->get(key)) || view.song_count() == 0)
+            return nullptr;
+          std::shared_ptr<alsong::song_info> stored =
+            std::make_shared<alsong::song_info>();
+          view.to_song_info(0, *stored);
+          cache->put(cache_id, stored);
+          return stored;
+        }
+
+        // stores the last song of song_collection as the song with lyric_id
+        song_cache::entry store_lyric(const std::string& lyric_id) {
+          if (song_collection.empty())
+            return nullptr;
+          return store_lyric(lyric_id, song_collection.back());
+        }
+
+        song_cache::entry store_lyric(const std::string& lyric_id,
+            const alsong::song_info& fetched) {
+          std::string key = "lyric:" + lyric_id;
+          std::string image;
+          lyrics_binary::encode({fetched}, image);
+          pack->put(key, image);
+          song_cache::entry song = std::make_shared<const alsong::song_info>(fetched);
+          cache->put((lyrics_folder_path / key).string(), song);
+          return song;
+        }
+
+        // how long stored search results are trusted
+        void set_search_ttl(int64_t ttl_seconds) {
+          search_ttl = ttl_seconds;
+        }
+
+        // views the stored binary lyrics without copying or parsing them,
+        // the strings of the view stay valid as long as the view is open
+        // and this serializer's pack store is alive
+        bool read_view(const std::string& title, const std::string& artist,
+            lyrics_binary::view& view) {
+          std::string_view bytes = pack->get(create_filename(artist, title, ""));
+          if (!bytes.empty())
+            return view.open(bytes);
+          return view.open(lyrics_folder_path
+              / create_filename(artist, title, ".lyricsbin"));
+        }
+
+        // rewrites the pack store without superseded records; views read
+        // before stay valid for the lifetime of the pack store
+        bool compact() {
+          return pack->compact();
+        }
+
+        // songs are cached in song_cache::shared() unless set otherwise
+        void set_song_cache(song_cache& song_cache) {
+          cache = &song_cache;
+        }
+
+        void set_lyrics_format(lyrics_format lyrics_format) {
+          format = lyrics_format;
+        }
+
         void set_lyrics_folder_path(const std::string& path) {
           lyrics_folder_path = path;
           if (!std::filesystem::exists(lyrics_folder_path)) {
             std::filesystem::create_directory(lyrics_folder_path);
           }
+          pack = lyrics_pack::open_shared(lyrics_folder_path / "pack");
+        }
+
+        // negative search cache kept in the lyrics folder, to be handed to
+        // lyrics_fetcher::set_negative_cache
+        std::shared_ptr<negative_cache> negative_searches() {
+          return negative_cache::open_shared(lyrics_folder_path / "negative");
         }
 
-        std::string to_json_string() {
-          std::string str_json = "{\"song_collection\":[";
-          for (int i = 0; i < song_collection.size(); ++i) {
-            song_info &song = song_collection[i];
-            str_json += song.to_json_string();
-            if (i < song_collection.size() - 1)
-              str_json += ",";
+        // appends the song collection as JSON to a caller-owned buffer,
+        // which can be cleared and reused between calls
+        void write_json(std::string& output) const {
+          size_t size = 32;
+          for (const song_info& song : song_collection)
+            size += song.json_size_estimate();
+          output.reserve(output.size() + size);
+
+          output += "{\"song_collection\":[";
+          for (const song_info& song : song_collection) {
+            song.write_json(output);
+            output += ',';
           }
-          str_json += "]}";
+          time_lyrics::close_json_array(output);
+          output += '}';
+        }
+
+        void write_json(std::ostream& os) const {
+          static thread_local std::string buffer;
+          buffer.clear();
+          write_json(buffer);
+          os.write(buffer.data(), buffer.size());
+        }
+
+        std::string to_json_string() const {
+          std::string str_json;
+          write_json(str_json);
           return str_json;
         }
 
+        // heap allocations made by this thread's parse document so far;
+        // stays flat once its pools are warm
+        static int xml_heap_allocations() {
+          return parse_document().HeapAllocations();
+        }
+
       private:
-        std::string create_filename(std::string artist, std::string title) {
-          boost::to_upper(artist);
-          boost::to_upper(title);
-          return artist + " - " + title + ".lyrics";
+        typedef single_flight<std::vector<alsong::song_list>> search_flight;
+        typedef single_flight<alsong::song_info> lyric_flight;
+
+        static search_flight& search_flights() {
+          static search_flight flights;
+          return flights;
+        }
+
+        static lyric_flight& lyric_flights() {
+          static lyric_flight flights;
+          return flights;
+        }
+
+        std::string cache_key(const std::string& title,
+            const std::string& artist) {
+          return (lyrics_folder_path / create_filename(artist, title, "")).string();
+        }
+
+        // search tier record: expiry time in unix seconds followed by the
+        // lists in lyrics_binary layout, as songs without lyrics
+        void encode_search(const std::vector<alsong::song_list>& lists,
+            std::string& output) {
+          std::vector<alsong::song_info> songs(lists.size());
+          for (size_t i = 0; i < lists.size(); ++i) {
+            songs[i].lyric_id = lists[i].lyric_id;
+            songs[i].title = lists[i].title;
+            songs[i].artist = lists[i].artist;
+            songs[i].album = lists[i].album;
+          }
+          int64_t expiry = std::chrono::duration_cast<std::chrono::seconds>(
+              std::chrono::system_clock::now().time_since_epoch()).count()
+            + search_ttl;
+          output.assign(reinterpret_cast<const char *>(&expiry), sizeof(expiry));
+          std::string image;
+          lyrics_binary::encode(songs, image);
+          output += image;
+        }
+
+        static bool decode_search(std::string_view bytes,
+            std::vector<alsong::song_list>& lists, bool stale=false) {
+          int64_t expiry = 0;
+          if (bytes.size() < sizeof(expiry))
+            return false;
+          std::memcpy(&expiry, bytes.data(), sizeof(expiry));
+          int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+              std::chrono::system_clock::now().time_since_epoch()).count();
+          lyrics_binary::view view;
+          if ((expiry <= now && !stale) || !view.open(bytes.substr(sizeof(expiry))))
+            return false;
+          for (size_t i = 0; i < view.song_count(); ++i) {
+            alsong::song_list list;
+            list.lyric_id = view.lyric_id(i);
+            list.title = view.title(i);
+            list.artist = view.artist(i);
+            list.album = view.album(i);
+            lists.push_back(std::move(list));
+          }
+          return !lists.empty();
+        }
+
+        void cache_song(const std::string& title, const std::string& artist) {
+          if (!song_collection.empty())
+            cache->put(cache_key(title, artist),
+                std::make_shared<const alsong::song_info>(song_collection[0]));
+        }
+
+        // one document per thread, reused for every response so that the
+        // tinyxml2 node pools keep their blocks between parses
+        static tinyxml2::XMLDocument& parse_document() {
+          static thread_local tinyxml2::XMLDocument doc;
+          return doc;
+        }
+
+        // walks doc along path, nullptr if any element is missing
+        tinyxml2::XMLElement* find_path(tinyxml2::XMLDocument& doc,
+            std::initializer_list<const char*> path) {
+          tinyxml2::XMLNode* node = &doc;
+          for (const char* name : path) {
+            node = node->FirstChildElement(name);
+            if (node == nullptr)
+              return nullptr;
+          }
+          return node->ToElement();
+        }
+
+        bool parse_lyric_list_dom(std::string& alsong_raw) {
+          int count = 0;
+          tinyxml2::XMLDocument& doc = parse_document();
+          doc.ParseInPlace(&alsong_raw[0], alsong_raw.size());
+
+          tinyxml2::XMLElement* result = find_path(doc, {"soap:Envelope",
+              "soap:Body", "GetResembleLyricList2Response",
+              "GetResembleLyricList2Result"});
+          if (result == nullptr) {
+            std::cerr << "SOAP Fault: unexpected response, "
+              << "GetResembleLyricList2Result\n";
+            doc.Clear();
+            return false;
+          }
+
+          for (tinyxml2::XMLNode* child = result->FirstChildElement("ST_SEARCHLYRIC_LIST")
+              ; child
+              ; child = child->NextSiblingElement("ST_SEARCHLYRIC_LIST")) {
+            alsong::song_list list;
+            list.lyric_id = find_child(&child, "lyricID");
+            list.title = find_child(&child, "title");
+            list.artist = find_child(&child, "artist");
+            list.album = find_child(&child, "album");
+            song_list_collection.push_back(list);
+
+            ++count;
+            if (count >= 50)
+              break;
+          }
+
+          // hand the nodes back to the pools before alsong_raw goes away
+          doc.Clear();
+          return true;
+        }
+
+        bool parse_lyric_dom(std::string& alsong_raw, alsong::song_info& song,
+            std::string& lyrics_raw) {
+          tinyxml2::XMLDocument& doc = parse_document();
+          doc.ParseInPlace(&alsong_raw[0], alsong_raw.size());
+
+          tinyxml2::XMLElement* result = find_path(doc, {"soap:Envelope",
+              "soap:Body", "GetLyricByID2Response", "GetLyricByID2Result"});
+          tinyxml2::XMLNode* child =
+            result != nullptr ? result->NextSibling() : nullptr;
+          if (child == nullptr) {
+            std::cerr << "SOAP Fault: unexpected response, GetLyricByID2Result\n";
+            doc.Clear();
+            return false;
+          }
+
+          song.lyric_id = find_child(&child, "lyricID");
+          song.title = find_child(&child, "title");
+          song.artist = find_child(&child, "artist");
+          song.album = find_child(&child, "album");
+          song.written_by = find_child(&child, "registerName");
+          lyrics_raw = find_child(&child, "lyric");
+
+          doc.Clear();
+          return true;
+        }
+
+        // normalised, sharded and file system safe name, see
+        // key_normalization::sharded_filename
+        std::string create_filename(const std::string& artist,
+            const std::string& title, const std::string& extension=".lyrics") {
+          return key_normalization::sharded_filename(query_key(title, artist),
+              extension);
         }
 
         std::string find_child(tinyxml2::XMLNode** root,
@@ -461,29 +4889,699 @@ namespace moonk5
           return text;
         }
 
-        void parse_lyrics(std::string& input, alsong::song_info& output) {
-          const std::string REGEX_TIME =
-            "\\[([0-5][0-9]:[0-5][0-9].[0-9][0-9])\\]";
-          const std::string REGEX_TIME_LYRICS =
-            "(" + REGEX_TIME + ")(.*)(\n)";
-          std::regex reg_ex(REGEX_TIME_LYRICS);
-          std::smatch match;
+        // '<br>' and '\n' separate lines, empty '[00:00.00]' lines are
+        // dropped and each line adds the text after its first [mm:ss.xx]
+        // stamp; lines without an empty stamp, which is nearly all of them,
+        // are scanned in place without copying
+        void parse_lyrics(std::string_view input, alsong::song_info& output) {
+          tracer::span span("parse_lyrics");
+          static const std::string_view EMPTY_STAMP = "[00:00.00]";
+          std::vector<delimiter_scan::line_span> lines;
+          delimiter_scan::index_lyric_lines(input, lines);
+
+          std::string line;      // pending line merged after empty stamps
+          size_t protect = 0;    // no empty stamp may be removed before this
+
+          for (const delimiter_scan::line_span& span : lines) {
+            std::string_view raw = input.substr(span.begin, span.end - span.begin);
+            bool empty_stamp = raw.size() >= EMPTY_STAMP.size() &&
+              raw.compare(raw.size() - EMPTY_STAMP.size(),
+                  EMPTY_STAMP.size(), EMPTY_STAMP) == 0;
+
+            if (line.empty() && !empty_stamp) {
+              if (span.first_bracket != UINT32_MAX)
+                scan_lyrics_line(raw, output, span.first_bracket - span.begin);
+              continue;
+            }
+
+            line += raw;
+            // an empty leading stamp merges its line into the next one
+            if (line.size() >= protect + EMPTY_STAMP.size() &&
+                line.compare(line.size() - EMPTY_STAMP.size(),
+                  EMPTY_STAMP.size(), EMPTY_STAMP) == 0) {
+              line.resize(line.size() - EMPTY_STAMP.size());
+              protect = line.size();
+              continue;
+            }
+
+            scan_lyrics_line(line, output);
+            line.clear();
+            protect = 0;
+          }
+        }
 
-          // replace unnecessary XML tags;
-          boost::replace_all(input, "<br>", "\n");
-          boost::replace_all(input, "\"", "\\\"");
-          boost::replace_all(input, "[00:00.00]\n", "");
+        // finds the first [mm:ss.xx] stamp at or after pos that is followed
+        // by text without a carriage return
+        void scan_lyrics_line(std::string_view line, alsong::song_info& output,
+            size_t pos=0) {
+          auto in = [](char c, char lo, char hi) { return c >= lo && c <= hi; };
+          const size_t STAMP_SIZE = 10;
 
-          // search for time and lyrics
-          while (std::regex_search(input, match, reg_ex)) {
-            output.add_lyrics(match[2], match[3]);
-            input = match.suffix().str();
+          while ((pos = line.find('[', pos)) != std::string_view::npos
+              && pos + STAMP_SIZE <= line.size()) {
+            const char *t = line.data() + pos;
+            bool stamp = in(t[1], '0', '5') && in(t[2], '0', '9') && t[3] == ':'
+              && in(t[4], '0', '5') && in(t[5], '0', '9') && t[6] != '\r'
+              && in(t[7], '0', '9') && in(t[8], '0', '9') && t[9] == ']';
+            if (!stamp) {
+              ++pos;
+              continue;
+            }
+            size_t cr = line.find('\r', pos + STAMP_SIZE);
+            if (cr != std::string_view::npos) {
+              // no stamp before the carriage return can match either
+              pos = cr + 1;
+              continue;
+            }
+            output.add_lyrics(line.substr(pos + 1, 8),
+                line.substr(pos + STAMP_SIZE));
+            return;
           }
         }
 
         std::filesystem::path lyrics_folder_path;
         unsigned int max_lyrics_count; 
+        lyrics_format format = lyrics_format::binary;
+        std::shared_ptr<lyrics_pack> pack;
+        song_cache *cache = &song_cache::shared();
+        int64_t search_ttl = 30 * 24 * 3600;
     }; // class moonk5::alsong::lyrics_serializer
+
+#if defined(__linux__)
+    // long-running HTTP/1.1 front end answering lookups from warm caches
+    // on a single epoll loop, over a Unix socket and/or a localhost TCP
+    // port:
+    //   GET /lyrics?title=...&artist=...
+    //   GET /lyrics/{lyric_id}
+    // Misses go to an upstream thread that runs them on the shared
+    // fetcher's curl multi loop, up to max_in_flight requests at once, so
+    // a slow upstream costs sockets rather than threads; the loop answers
+    // when they complete and never blocks on the network itself
+    class lyrics_daemon
+    {
+      public:
+        lyrics_daemon(lyrics_fetcher& fetcher, const std::string& lyrics_path,
+            unsigned max_in_flight=32)
+          : fetcher(fetcher), lyrics_path(lyrics_path),
+            serializer(lyrics_path), max_in_flight(std::max(1u, max_in_flight)) {
+          negatives = serializer.negative_searches();
+          epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+          wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+          upstream_wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+          watch(wake_fd, EPOLLIN);
+          upstream = std::thread([this]() { fetch_upstream(); });
+        }
+
+        lyrics_daemon(const lyrics_daemon&) = delete;
+        lyrics_daemon& operator=(const lyrics_daemon&) = delete;
+
+        ~lyrics_daemon() {
+          {
+            std::lock_guard<std::mutex> guard(job_mutex);
+            stopping = true;
+          }
+          job_ready.notify_all();
+          wake(upstream_wake_fd);
+          upstream.join();
+          for (auto& entry : connections)
+            ::close(entry.first);
+          for (int fd : listen_fds)
+            ::close(fd);
+          if (!unix_path.empty())
+            ::unlink(unix_path.c_str());
+          ::close(upstream_wake_fd);
+          ::close(wake_fd);
+          ::close(epoll_fd);
+        }
+
+        bool listen_unix(const std::string& path) {
+          sockaddr_un addr = sockaddr_un();
+          if (path.size() >= sizeof(addr.sun_path))
+            return false;
+          addr.sun_family = AF_UNIX;
+          std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+          ::unlink(path.c_str());
+          int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+          if (!bind_and_listen(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)))
+            return false;
+          unix_path = path;
+          return true;
+        }
+
+        // binds 127.0.0.1 only
+        bool listen_tcp(uint16_t port) {
+          sockaddr_in addr = sockaddr_in();
+          addr.sin_family = AF_INET;
+          addr.sin_port = htons(port);
+          addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+          int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+          int on = 1;
+          if (fd >= 0)
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+          return bind_and_listen(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        }
+
+        // serves until stop() is called
+        void run() {
+          epoll_event events[64];
+          while (!stopped) {
+            int count = ::epoll_wait(epoll_fd, events, 64, -1);
+            for (int i = 0; i < count; ++i) {
+              int fd = events[i].data.fd;
+              if (fd == wake_fd)
+                deliver_results();
+              else if (std::find(listen_fds.begin(), listen_fds.end(), fd)
+                  != listen_fds.end())
+                accept_all(fd);
+              else
+                on_event(fd, events[i].events);
+            }
+          }
+        }
+
+        // safe to call from any thread or a signal handler
+        void stop() {
+          stopped = true;
+          uint64_t one = 1;
+          if (::write(wake_fd, &one, sizeof(one)) < 0)
+            return;
+        }
+
+        uint64_t requests() const { return request_count; }
+        uint64_t cache_hits() const { return hit_count; }
+        uint64_t upstream_fetches() const { return fetch_count; }
+
+      private:
+        static constexpr size_t MAX_REQUEST_SIZE = 16 * 1024;
+
+        struct connection
+        {
+          uint64_t id = 0;
+          std::string in;
+          std::string out;
+          size_t sent = 0;
+          bool busy = false;        // waiting for upstream
+          bool close_after = false; // once out is sent
+          bool writing = false;     // EPOLLOUT armed
+          bool read_closed = false; // the peer shut down its side
+        };
+
+        struct job
+        {
+          int fd = -1;
+          uint64_t connection_id = 0;
+          bool keep_alive = true;
+          std::string title;
+          std::string artist;
+          std::string lyric_id;
+        };
+
+        struct result
+        {
+          int fd = -1;
+          uint64_t connection_id = 0;
+          bool keep_alive = true;
+          int status = 200;
+          std::string body;
+        };
+
+        bool bind_and_listen(int fd, const sockaddr *addr, socklen_t size) {
+          if (fd < 0)
+            return false;
+          if (::bind(fd, addr, size) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+            std::cerr << "moonk5::alsong::lyrics_daemon - cannot listen, "
+              << std::strerror(errno) << "\n";
+            ::close(fd);
+            return false;
+          }
+          listen_fds.push_back(fd);
+          watch(fd, EPOLLIN);
+          return true;
+        }
+
+        void watch(int fd, uint32_t events, int op=EPOLL_CTL_ADD) {
+          epoll_event ev = epoll_event();
+          ev.events = events;
+          ev.data.fd = fd;
+          ::epoll_ctl(epoll_fd, op, fd, &ev);
+        }
+
+        // interest in reading until the peer shut down its side, and in
+        // writing while output waits for room
+        void rearm(int fd, const connection& conn) {
+          watch(fd, (conn.read_closed ? 0u : uint32_t(EPOLLIN | EPOLLRDHUP))
+              | (conn.writing ? uint32_t(EPOLLOUT) : 0u), EPOLL_CTL_MOD);
+        }
+
+        static void wake(int fd) {
+          uint64_t one = 1;
+          if (::write(fd, &one, sizeof(one)) < 0)
+            std::cerr << "moonk5::alsong::lyrics_daemon - wake failed\n";
+        }
+
+        void accept_all(int listen_fd) {
+          for (;;) {
+            int fd = ::accept4(listen_fd, nullptr, nullptr,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+              return;
+            connections[fd].id = ++next_connection_id;
+            watch(fd, EPOLLIN | EPOLLRDHUP);
+          }
+        }
+
+        void close_connection(int fd) {
+          ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+          ::close(fd);
+          connections.erase(fd);
+        }
+
+        void on_event(int fd, uint32_t events) {
+          auto it = connections.find(fd);
+          if (it == connections.end())
+            return;
+          connection& conn = it->second;
+
+          if (!conn.read_closed
+              && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+            char buffer[4096];
+            for (;;) {
+              ssize_t n = ::read(fd, buffer, sizeof(buffer));
+              if (n > 0) {
+                conn.in.append(buffer, size_t(n));
+                continue;
+              }
+              if (n == 0) {
+                // a half-closed peer still gets the answers to what it
+                // sent; the connection closes once they are written
+                conn.read_closed = true;
+                rearm(fd, conn);
+                break;
+              }
+              if (errno != EAGAIN) {
+                close_connection(fd);
+                return;
+              }
+              break;
+            }
+          } else if (events & (EPOLLHUP | EPOLLERR) && !(events & EPOLLOUT)) {
+            close_connection(fd);
+            return;
+          }
+          if (events & EPOLLOUT) {
+            if (!flush(fd, conn))
+              return;
+          }
+          process(fd, conn);
+        }
+
+        // handles buffered requests one at a time, in order; a half-closed
+        // connection is closed once nothing is left to answer
+        void process(int fd, connection& conn) {
+          while (!conn.busy && conn.out.empty() && !conn.close_after) {
+            size_t end = conn.in.find("\r\n\r\n");
+            if (end == std::string::npos) {
+              if (conn.in.size() > MAX_REQUEST_SIZE)
+                respond(fd, conn, 431, "{\"error\":\"request too large\"}", false);
+              else if (conn.read_closed)
+                close_connection(fd);
+              return;
+            }
+            std::string request = conn.in.substr(0, end);
+            conn.in.erase(0, end + 4);
+            ++request_count;
+            if (!handle(fd, conn, request))
+              return;
+          }
+        }
+
+        // false once the connection has been closed
+        bool handle(int fd, connection& conn, const std::string& request) {
+          size_t line_end = request.find("\r\n");
+          std::string line = request.substr(0, line_end);
+          std::string lower = request;
+          std::transform(lower.begin(), lower.end(), lower.begin(),
+              [](unsigned char c) { return char(std::tolower(c)); });
+          bool keep_alive = line.compare(line.size() >= 8 ? line.size() - 8 : 0,
+              8, "HTTP/1.0") != 0;
+          if (lower.find("\r\nconnection: close") != std::string::npos)
+            keep_alive = false;
+          else if (lower.find("\r\nconnection: keep-alive") != std::string::npos)
+            keep_alive = true;
+
+          size_t sp1 = line.find(' ');
+          size_t sp2 = line.find(' ', sp1 + 1);
+          if (sp1 == std::string::npos || sp2 == std::string::npos)
+            return respond(fd, conn, 400, "{\"error\":\"bad request\"}", false);
+          if (line.compare(0, sp1, "GET") != 0)
+            return respond(fd, conn, 405, "{\"error\":\"method not allowed\"}",
+                keep_alive);
+
+          std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+          std::string path = target.substr(0, target.find('?'));
+          job j;
+          j.fd = fd;
+          j.connection_id = conn.id;
+          j.keep_alive = keep_alive;
+          if (path == "/lyrics") {
+            size_t query = target.find('?');
+            if (query != std::string::npos)
+              parse_query(target.substr(query + 1), j.title, j.artist);
+            if (j.title.empty() || j.artist.empty())
+              return respond(fd, conn, 400,
+                  "{\"error\":\"title and artist are required\"}", keep_alive);
+            song_cache::entry song = serializer.lookup(j.title, j.artist);
+            if (song) {
+              ++hit_count;
+              return respond(fd, conn, 200, song->to_json_string(), keep_alive);
+            }
+            // stored search results leave only the lyric fetch, the song is
+            // then written under title and artist
+            serializer.song_list_collection.clear();
+            if (serializer.find_search(j.title, j.artist)) {
+              j.lyric_id = serializer.song_list_collection[0].lyric_id;
+              song = serializer.find_lyric(j.lyric_id);
+              if (song) {
+                ++hit_count;
+                return respond(fd, conn, 200, song->to_json_string(), keep_alive);
+              }
+            } else if (negatives->contains(j.title, j.artist)) {
+              return respond(fd, conn, 404, "{\"error\":\"not found\"}",
+                  keep_alive);
+            }
+          } else if (path.compare(0, 8, "/lyrics/") == 0 && path.size() > 8) {
+            j.lyric_id = url_decode(path.substr(8));
+            song_cache::entry song = serializer.find_lyric(j.lyric_id);
+            if (song) {
+              ++hit_count;
+              return respond(fd, conn, 200, song->to_json_string(), keep_alive);
+            }
+          } else {
+            return respond(fd, conn, 404, "{\"error\":\"not found\"}", keep_alive);
+          }
+
+          conn.busy = true;
+          {
+            std::lock_guard<std::mutex> guard(job_mutex);
+            jobs.push_back(std::move(j));
+          }
+          job_ready.notify_one();
+          wake(upstream_wake_fd);
+          return true;
+        }
+
+        static std::string url_decode(std::string_view text) {
+          std::string decoded;
+          decoded.reserve(text.size());
+          for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] == '+') {
+              decoded += ' ';
+            } else if (text[i] == '%' && i + 2 < text.size()
+                && std::isxdigit(static_cast<unsigned char>(text[i + 1]))
+                && std::isxdigit(static_cast<unsigned char>(text[i + 2]))) {
+              decoded += char(std::stoi(std::string(text.substr(i + 1, 2)), nullptr, 16));
+              i += 2;
+            } else {
+              decoded += text[i];
+            }
+          }
+          return decoded;
+        }
+
+        static void parse_query(std::string_view query, std::string& title,
+            std::string& artist) {
+          while (!query.empty()) {
+            size_t amp = query.find('&');
+            std::string_view pair = query.substr(0, amp);
+            size_t eq = pair.find('=');
+            std::string_view name = pair.substr(0, eq);
+            std::string value = eq == std::string_view::npos ? ""
+              : url_decode(pair.substr(eq + 1));
+            if (name == "title")
+              title = value;
+            else if (name == "artist")
+              artist = value;
+            query = amp == std::string_view::npos ? "" : query.substr(amp + 1);
+          }
+        }
+
+        bool respond(int fd, connection& conn, int status,
+            const std::string& body, bool keep_alive) {
+          const char *reason = status == 200 ? "OK" : status == 400 ? "Bad Request"
+            : status == 404 ? "Not Found" : status == 405 ? "Method Not Allowed"
+            : status == 431 ? "Request Header Fields Too Large"
+            : status == 502 ? "Bad Gateway" : "Error";
+          conn.out = "HTTP/1.1 " + std::to_string(status) + " " + reason
+            + "\r\nContent-Type: application/json\r\nContent-Length: "
+            + std::to_string(body.size())
+            + (keep_alive ? "\r\nConnection: keep-alive\r\n\r\n"
+                : "\r\nConnection: close\r\n\r\n");
+          conn.out += body;
+          conn.sent = 0;
+          conn.close_after = !keep_alive;
+          return flush(fd, conn);
+        }
+
+        // writes what the socket takes; false if the connection was closed
+        bool flush(int fd, connection& conn) {
+          while (conn.sent < conn.out.size()) {
+            ssize_t n = ::send(fd, conn.out.data() + conn.sent,
+                conn.out.size() - conn.sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EAGAIN) {
+              if (!conn.writing) {
+                conn.writing = true;
+                rearm(fd, conn);
+              }
+              return true;
+            }
+            if (n <= 0) {
+              close_connection(fd);
+              return false;
+            }
+            conn.sent += size_t(n);
+          }
+          conn.out.clear();
+          conn.sent = 0;
+          if (conn.close_after) {
+            close_connection(fd);
+            return false;
+          }
+          if (conn.writing) {
+            conn.writing = false;
+            rearm(fd, conn);
+          }
+          return true;
+        }
+
+        void deliver_results() {
+          uint64_t value;
+          while (::read(wake_fd, &value, sizeof(value)) > 0) {
+          }
+          std::deque<result> ready;
+          {
+            std::lock_guard<std::mutex> guard(result_mutex);
+            ready.swap(results);
+          }
+          for (result& r : ready) {
+            auto it = connections.find(r.fd);
+            // the client may have gone and its descriptor been reused
+            if (it == connections.end() || it->second.id != r.connection_id)
+              continue;
+            it->second.busy = false;
+            if (respond(r.fd, it->second, r.status, r.body, r.keep_alive))
+              process(r.fd, it->second);
+          }
+        }
+
+        // upstream thread: waits for misses and runs them as one batch on
+        // the fetcher's curl multi loop. Misses arriving meanwhile join the
+        // running batch, identical searches and lyric ids share a request,
+        // and a search that finds lyrics is followed by their fetch in the
+        // same batch. Parsing and storing use this thread's serializer
+        void fetch_upstream() {
+          lyrics_serializer upstream_serializer(lyrics_path);
+          for (;;) {
+            {
+              std::unique_lock<std::mutex> lock(job_mutex);
+              job_ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+              if (stopping)
+                return;
+            }
+            run_batch(upstream_serializer);
+          }
+        }
+
+        void run_batch(lyrics_serializer& s) {
+          std::vector<lyrics_fetcher::batch_request> requests;
+          // jobs waiting for each request, by position in requests
+          std::vector<std::vector<job>> waiting;
+          std::map<std::string, size_t> searches;  // in flight, by query key
+          std::map<std::string, size_t> lyrics;    // in flight, by lyric id
+          std::set<std::string> written;
+
+          auto request = [&](std::map<std::string, size_t>& in_flight,
+              const std::string& key, job j, lyrics_fetcher::batch_request r) {
+            auto it = in_flight.find(key);
+            if (it != in_flight.end()) {
+              waiting[it->second].push_back(std::move(j));
+              return;
+            }
+            in_flight[key] = requests.size();
+            requests.push_back(std::move(r));
+            waiting.emplace_back();
+            waiting.back().push_back(std::move(j));
+          };
+
+          auto fetch_lyric = [&](job j, const std::string& lyric_id) {
+            song_cache::entry song = s.find_lyric(lyric_id);
+            if (song) {
+              post(j, 200, song->to_json_string());
+              return;
+            }
+            j.lyric_id = lyric_id;
+            lyrics_fetcher::batch_request r;
+            r.lyric_id = lyric_id;
+            request(lyrics, lyric_id, std::move(j), std::move(r));
+          };
+
+          auto take_jobs = [&]() {
+            uint64_t value;
+            while (::read(upstream_wake_fd, &value, sizeof(value)) > 0) {
+            }
+            std::deque<job> arrived;
+            {
+              std::lock_guard<std::mutex> guard(job_mutex);
+              if (stopping)
+                return;
+              arrived.swap(jobs);
+            }
+            for (job& j : arrived) {
+              ++fetch_count;
+              if (!j.lyric_id.empty()) {
+                std::string lyric_id = j.lyric_id;
+                fetch_lyric(std::move(j), lyric_id);
+              } else {
+                lyrics_fetcher::batch_request r;
+                r.query = {j.title, j.artist};
+                std::string key = query_key(j.title, j.artist);
+                request(searches, key, std::move(j), std::move(r));
+              }
+            }
+          };
+
+          auto on_search = [&](std::vector<job>& done, CURLcode result,
+              std::string& output) {
+            const job& first = done.front();
+            s.song_list_collection.clear();
+            bool found = false;
+            if (result == CURLE_OK) {
+              soap_stream_parser parser = s.lyric_list_stream();
+              parser.feed(output.data(), output.size());
+              found = parser.finish();
+              if (found && !s.song_list_collection.empty())
+                s.store_search(first.title, first.artist);
+            }
+            // while upstream fails, expired results are served instead
+            if (!found)
+              found = s.find_search(first.title, first.artist, true);
+            if (!found) {
+              for (const job& j : done)
+                post(j, 502, "{\"error\":\"upstream failed\"}");
+            } else if (s.song_list_collection.empty()) {
+              for (const job& j : done)
+                post(j, 404, "{\"error\":\"not found\"}");
+            } else {
+              std::string lyric_id = s.song_list_collection[0].lyric_id;
+              for (job& j : done)
+                fetch_lyric(std::move(j), lyric_id);
+            }
+          };
+
+          auto on_lyric = [&](std::vector<job>& done, const std::string& lyric_id,
+              CURLcode result, std::string& output) {
+            s.song_collection.clear();
+            song_cache::entry song;
+            if (result == CURLE_OK) {
+              soap_stream_parser parser = s.lyric_stream();
+              parser.feed(output.data(), output.size());
+              if (parser.finish() && !s.song_collection.empty())
+                song = s.store_lyric(lyric_id);
+            }
+            if (!song) {
+              for (const job& j : done)
+                post(j, 502, "{\"error\":\"upstream failed\"}");
+              return;
+            }
+            std::string body = song->to_json_string();
+            for (const job& j : done) {
+              // spellings folding to the same key are written once
+              if (!j.title.empty()
+                  && written.insert(query_key(j.title, j.artist)).second)
+                s.write(j.title, j.artist);
+              post(j, 200, body);
+            }
+          };
+
+          fetcher.fetch_batch(requests,
+              [&](size_t i, CURLcode result, std::string& output) {
+                // taken out first, follow-ups may add requests
+                std::vector<job> done = std::move(waiting[i]);
+                std::string lyric_id = requests[i].lyric_id;
+                if (lyric_id.empty()) {
+                  searches.erase(query_key(requests[i].query.title,
+                        requests[i].query.artist));
+                  on_search(done, result, output);
+                } else {
+                  lyrics.erase(lyric_id);
+                  on_lyric(done, lyric_id, result, output);
+                }
+              }, max_in_flight, request_priority::interactive, take_jobs,
+              upstream_wake_fd);
+        }
+
+        // hands an answer to the loop thread
+        void post(const job& j, int status, std::string body) {
+          result r;
+          r.fd = j.fd;
+          r.connection_id = j.connection_id;
+          r.keep_alive = j.keep_alive;
+          r.status = status;
+          r.body = std::move(body);
+          {
+            std::lock_guard<std::mutex> guard(result_mutex);
+            results.push_back(std::move(r));
+          }
+          wake(wake_fd);
+        }
+
+        lyrics_fetcher& fetcher;
+        std::string lyrics_path;
+        lyrics_serializer serializer; // used by the loop thread only
+        std::shared_ptr<negative_cache> negatives;
+        unsigned max_in_flight;
+        int epoll_fd = -1;
+        int wake_fd = -1;
+        int upstream_wake_fd = -1;  // new jobs for the running batch
+        std::vector<int> listen_fds;
+        std::string unix_path;
+        std::unordered_map<int, connection> connections;
+        uint64_t next_connection_id = 0;
+        std::atomic<bool> stopped{false};
+
+        std::mutex job_mutex;
+        std::condition_variable job_ready;
+        std::deque<job> jobs;
+        bool stopping = false;
+        std::thread upstream;
+
+        std::mutex result_mutex;
+        std::deque<result> results;
+
+        std::atomic<uint64_t> request_count{0};
+        std::atomic<uint64_t> hit_count{0};
+        std::atomic<uint64_t> fetch_count{0};
+    }; // class moonk5::alsong::lyrics_daemon
+#endif
   }
 }
 #endif // ALSONG_LYRICS_FETCHER_H
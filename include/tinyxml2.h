@@ -346,7 +346,7 @@ template< int ITEM_SIZE >
 class MemPoolT : public MemPool
 {
 public:
-    MemPoolT() : _blockPtrs(), _root(0), _currentAllocs(0), _nAllocs(0), _maxAllocs(0), _nUntracked(0)	{}
+    MemPoolT() : _blockPtrs(), _root(0), _currentAllocs(0), _nAllocs(0), _maxAllocs(0), _nUntracked(0), _nBlockAllocs(0)	{}
     ~MemPoolT() {
         MemPoolT< ITEM_SIZE >::Clear();
     }
@@ -376,6 +376,7 @@ public:
             // Need a new block.
             Block* block = new Block();
             _blockPtrs.Push( block );
+            ++_nBlockAllocs;
 
             Item* blockItems = block->items;
             for( int i = 0; i < ITEMS_PER_BLOCK - 1; ++i ) {
@@ -423,6 +424,12 @@ public:
         return _nUntracked;
     }
 
+    // Number of blocks allocated from the heap over the lifetime of
+    // the pool. Not reset by Clear().
+    int BlockAllocs() const {
+        return _nBlockAllocs;
+    }
+
 	// This number is perf sensitive. 4k seems like a good tradeoff on my machine.
 	// The test file is large, 170k.
 	// Release:		VS2010 gcc(no opt)
@@ -454,6 +461,7 @@ private:
     int _nAllocs;
     int _maxAllocs;
     int _nUntracked;
+    int _nBlockAllocs;
 };
 
 
@@ -1686,6 +1694,28 @@ public:
     */
     XMLError Parse( const char* xml, size_t nBytes=(size_t)(-1) );
 
+    /**
+    	Parse an XML document in place, without copying it.
+    	Returns XML_SUCCESS (0) on success, or
+    	an errorID.
+
+    	The buffer must be writable and null terminated at
+    	xml[nBytes]. The parser writes into it, and the nodes
+    	of the document point into it, so it has to outlive
+    	the document or the next Clear(). The document never
+    	frees it.
+    */
+    XMLError ParseInPlace( char* xml, size_t nBytes=(size_t)(-1) );
+
+    /**
+    	Number of heap allocations the document has made for
+    	its character buffer and node pools since it was
+    	created. A document that is Clear()ed and reused keeps
+    	its pool blocks, so once it is warm this stays constant
+    	for documents of similar size.
+    */
+    int HeapAllocations() const;
+
     /**
     	Load an XML file from disk.
     	Returns XML_SUCCESS (0) on success, or
@@ -1876,6 +1906,8 @@ private:
     mutable StrPair	_errorStr;
     int             _errorLineNum;
     char*			_charBuffer;
+    bool			_ownsCharBuffer;
+    int				_charBufferAllocs;
     int				_parseCurLineNum;
 	int				_parsingDepth;
 	// Memory tracking does add some overhead.
@@ -1894,6 +1926,7 @@ private:
 	static const char* _errorNames[XML_ERROR_COUNT];
 
     void Parse();
+    void CleanupAfterParseError();
 
     void SetError( XMLError error, int lineNum, const char* format, ... );
 
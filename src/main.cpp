@@ -1,17 +1,369 @@
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <AlsongLyricsFetcher.h>
 
+namespace
+{
+  struct batch_job
+  {
+    size_t line = 0;   // in the input, from 1
+    std::string title;
+    std::string artist;
+  };
+
+  // one NDJSON result line, index is the input line of the job; song is
+  // null unless status is "ok"
+  void emit(const batch_job& job, const char *status,
+      const char *source, const moonk5::alsong::song_info *song,
+      const std::string& error="") {
+    std::string line = "{\"index\":" + std::to_string(job.line) + ",";
+    moonk5::alsong::append_json_field(line, "title", job.title);
+    moonk5::alsong::append_json_field(line, "artist", job.artist);
+    moonk5::alsong::append_json_field(line, "status", status);
+    if (source != nullptr)
+      moonk5::alsong::append_json_field(line, "source", source);
+    if (!error.empty())
+      moonk5::alsong::append_json_field(line, "error", error);
+    line += "\"song\":";
+    if (song != nullptr)
+      song->write_json(line);
+    else
+      line += "null";
+    line += "}\n";
+    std::cout << line << std::flush;
+  }
+
+  // 'title<TAB>artist' lines or NDJSON objects with title and artist
+  bool parse_job(const std::string& line, batch_job& job) {
+    size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+      return false;
+    if (line[begin] == '{') {
+      nlohmann::json j = nlohmann::json::parse(line, nullptr, false);
+      if (j.is_discarded() || !j.is_object())
+        return false;
+      job.title = j.value("title", "");
+      job.artist = j.value("artist", "");
+      return true;
+    }
+    size_t tab = line.find('\t', begin);
+    if (tab == std::string::npos)
+      return false;
+    job.title = line.substr(begin, tab - begin);
+    job.artist = line.substr(tab + 1);
+    if (!job.artist.empty() && job.artist.back() == '\r')
+      job.artist.pop_back();
+    return true;
+  }
+
+  // looks every job up in the caches first, then runs the searches and
+  // lyric fetches that are left on one batch with at most jobs requests in
+  // flight: each lyric fetch starts as soon as its search completes, jobs
+  // folding to the same search share one request and jobs resolving to
+  // the same lyric id share one fetch. Results are printed as they
+  // complete
+  int run_batch(moonk5::alsong::lyrics_fetcher& lyrics_fetcher,
+      moonk5::alsong::lyrics_serializer& lyrics_serializer,
+      std::istream& input, unsigned jobs) {
+    std::vector<batch_job> batch;
+    std::string line;
+    for (size_t number = 1; std::getline(input, line); ++number) {
+      batch_job job;
+      job.line = number;
+      if (parse_job(line, job))
+        batch.push_back(std::move(job));
+      else if (line.find_first_not_of(" \t\r") != std::string::npos)
+        std::cerr << "skipping malformed input line " << number << ": " << line
+          << "\n";
+    }
+
+    std::shared_ptr<moonk5::alsong::negative_cache> negatives =
+      lyrics_serializer.negative_searches();
+    std::vector<moonk5::alsong::lyrics_fetcher::batch_request> requests;
+    // jobs waiting for each request, by position in requests
+    std::vector<std::vector<size_t>> waiting;
+    std::map<std::string, size_t> search_requests;   // by query key
+    std::map<std::string, size_t> lyric_requests;    // by lyric id
+    std::set<std::string> written;
+
+    auto request = [&](std::map<std::string, size_t>& requested,
+        const std::string& key, size_t index,
+        moonk5::alsong::lyrics_fetcher::batch_request r) {
+      auto it = requested.find(key);
+      if (it != requested.end()) {
+        waiting[it->second].push_back(index);
+        return;
+      }
+      requested[key] = requests.size();
+      requests.push_back(std::move(r));
+      waiting.push_back({index});
+    };
+
+    auto resolve = [&](size_t index, const std::string& lyric_id) {
+      moonk5::alsong::song_cache::entry song =
+        lyrics_serializer.find_lyric(lyric_id);
+      if (song) {
+        emit(batch[index], "ok", "cache", song.get());
+        return;
+      }
+      moonk5::alsong::lyrics_fetcher::batch_request r;
+      r.lyric_id = lyric_id;
+      request(lyric_requests, lyric_id, index, std::move(r));
+    };
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+      const batch_job& job = batch[i];
+      moonk5::alsong::song_cache::entry song =
+        lyrics_serializer.lookup(job.title, job.artist);
+      if (song) {
+        emit(job, "ok", "cache", song.get());
+        continue;
+      }
+      lyrics_serializer.song_list_collection.clear();
+      if (lyrics_serializer.find_search(job.title, job.artist)) {
+        resolve(i, lyrics_serializer.song_list_collection[0].lyric_id);
+        continue;
+      }
+      if (!job.title.empty() && !job.artist.empty()
+          && negatives->contains(job.title, job.artist)) {
+        emit(job, "not_found", nullptr, nullptr);
+        continue;
+      }
+      moonk5::alsong::lyrics_fetcher::batch_request r;
+      r.query = {job.title, job.artist};
+      request(search_requests, moonk5::alsong::query_key(job.title, job.artist),
+          i, std::move(r));
+    }
+
+    auto on_search = [&](const std::vector<size_t>& indexes, CURLcode result,
+        std::string& output) {
+      if (result != CURLE_OK) {
+        for (size_t index : indexes)
+          emit(batch[index], "error", nullptr, nullptr, curl_easy_strerror(result));
+        return;
+      }
+      lyrics_serializer.song_list_collection.clear();
+      moonk5::alsong::soap_stream_parser parser =
+        lyrics_serializer.lyric_list_stream();
+      parser.feed(output.data(), output.size());
+      if (!parser.finish()) {
+        for (size_t index : indexes)
+          emit(batch[index], "error", nullptr, nullptr, "unexpected response");
+        return;
+      }
+      if (lyrics_serializer.song_list_collection.empty()) {
+        for (size_t index : indexes)
+          emit(batch[index], "not_found", nullptr, nullptr);
+        return;
+      }
+      // every job here folds to the same search key
+      const batch_job& first = batch[indexes[0]];
+      lyrics_serializer.store_search(first.title, first.artist);
+      std::string lyric_id = lyrics_serializer.song_list_collection[0].lyric_id;
+      for (size_t index : indexes)
+        resolve(index, lyric_id);
+    };
+
+    auto on_lyric = [&](const std::string& lyric_id,
+        const std::vector<size_t>& indexes, CURLcode result, std::string& output) {
+      if (result != CURLE_OK) {
+        for (size_t index : indexes)
+          emit(batch[index], "error", nullptr, nullptr, curl_easy_strerror(result));
+        return;
+      }
+      lyrics_serializer.song_collection.clear();
+      moonk5::alsong::soap_stream_parser parser =
+        lyrics_serializer.lyric_stream();
+      parser.feed(output.data(), output.size());
+      if (!parser.finish() || lyrics_serializer.song_collection.empty()) {
+        for (size_t index : indexes)
+          emit(batch[index], "error", nullptr, nullptr, "unexpected response");
+        return;
+      }
+      moonk5::alsong::song_cache::entry song =
+        lyrics_serializer.store_lyric(lyric_id);
+      for (size_t index : indexes) {
+        // spellings folding to the same key are written once
+        const batch_job& job = batch[index];
+        if (written.insert(moonk5::alsong::query_key(job.title, job.artist)).second)
+          lyrics_serializer.write(job.title, job.artist);
+        emit(job, "ok", "network", song.get());
+      }
+    };
+
+    lyrics_fetcher.fetch_batch(requests,
+        [&](size_t i, CURLcode result, std::string& output) {
+          // taken out first, resolving may add requests and waiting lists
+          std::vector<size_t> indexes = std::move(waiting[i]);
+          std::string lyric_id = requests[i].lyric_id;
+          if (lyric_id.empty()) {
+            on_search(indexes, result, output);
+          } else {
+            // later jobs find the stored song, or retry after a failure
+            lyric_requests.erase(lyric_id);
+            on_lyric(lyric_id, indexes, result, output);
+          }
+        }, jobs);
+
+    return 0;
+  }
+
+  // writes the collected spans as Chrome trace JSON when main returns
+  struct trace_output
+  {
+    std::string path;
+
+    ~trace_output() {
+      if (!path.empty())
+        moonk5::alsong::tracer::write_chrome_trace(path);
+    }
+  };
+
+#if defined(__linux__)
+  moonk5::alsong::lyrics_daemon *running_daemon = nullptr;
+
+  void stop_daemon(int) {
+    if (running_daemon != nullptr)
+      running_daemon->stop();
+  }
+
+  // serves lookups until SIGINT or SIGTERM; an empty socket path or a
+  // port of 0 leaves that listener out
+  int run_daemon(moonk5::alsong::lyrics_fetcher& lyrics_fetcher,
+      const std::string& lyrics_path, const std::string& socket_path,
+      int port, unsigned in_flight) {
+    moonk5::alsong::lyrics_daemon daemon(lyrics_fetcher, lyrics_path, in_flight);
+    bool listening = false;
+    if (!socket_path.empty() && daemon.listen_unix(socket_path)) {
+      std::cerr << "listening on " << socket_path << "\n";
+      listening = true;
+    }
+    if (port > 0 && daemon.listen_tcp(uint16_t(port))) {
+      std::cerr << "listening on 127.0.0.1:" << port << "\n";
+      listening = true;
+    }
+    if (!listening)
+      return 1;
+
+    running_daemon = &daemon;
+    std::signal(SIGINT, stop_daemon);
+    std::signal(SIGTERM, stop_daemon);
+    daemon.run();
+    running_daemon = nullptr;
+    std::cerr << daemon.requests() << " requests, " << daemon.cache_hits()
+      << " cache hits, " << daemon.upstream_fetches() << " upstream fetches\n";
+    return 0;
+  }
+#endif
+}
+
 int main(int argc, char *argv[]) 
 {
   std::string title = "dead boy's poem", artist = "nightwish";
 
-  std::string resp = "";
+  // --trace FILE records per-stage spans in any mode
+  trace_output trace;
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == "--trace") {
+      trace.path = argv[i + 1];
+      moonk5::alsong::tracer::enable(true);
+    }
+  }
+
   moonk5::alsong::lyrics_fetcher lyrics_fetcher;
   moonk5::alsong::lyrics_serializer lyrics_serializer;
 
-  if (argc > 2) {
+  if (argc > 1 && std::string(argv[1]) == "--compact") {
+    // offline maintenance of the lyrics pack store
+    return lyrics_serializer.compact() ? 0 : 1;
+  }
+
+  lyrics_fetcher.set_negative_cache(lyrics_serializer.negative_searches());
+  // an unreachable endpoint fails lookups at once instead of each one
+  // waiting out the connect timeout
+  lyrics_fetcher.set_circuit_breaker(
+      std::make_shared<moonk5::alsong::circuit_breaker>());
+
+  // --rate N caps upstream requests per second in batch and daemon mode;
+  // batch lookups queue behind interactive ones
+  for (int i = 2; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) != "--rate")
+      continue;
+    double rate = std::atof(argv[i + 1]);
+    if (rate > 0)
+      lyrics_fetcher.set_scheduler(
+          std::make_shared<moonk5::alsong::request_scheduler>(rate, rate));
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "--batch") {
+    // --batch [-j N|auto] [--rate N] [--trace FILE] [file], reads stdin
+    // without a file or with '-'; -j auto adapts the requests in flight to
+    // the upstream
+    unsigned jobs = 8;
+    std::shared_ptr<moonk5::alsong::concurrency_limiter> limiter;
+    std::string path = "-";
+    for (int i = 2; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg == "-j" && i + 1 < argc && std::string(argv[i + 1]) == "auto") {
+        limiter = std::make_shared<moonk5::alsong::concurrency_limiter>();
+        jobs = 64;
+        ++i;
+      } else if (arg == "-j" && i + 1 < argc)
+        jobs = unsigned(std::max(1, std::atoi(argv[++i])));
+      else if ((arg == "--rate" || arg == "--trace") && i + 1 < argc)
+        ++i;
+      else
+        path = arg;
+    }
+    lyrics_fetcher.set_concurrency_limiter(limiter);
+    std::ifstream ifs;
+    std::istream *input = &std::cin;
+    if (path != "-") {
+      ifs.open(path);
+      if (!ifs) {
+        std::cerr << "cannot open " << path << "\n";
+        return 1;
+      }
+      input = &ifs;
+    }
+    int result = run_batch(lyrics_fetcher, lyrics_serializer, *input, jobs);
+    if (limiter)
+      std::cerr << "concurrency limit " << limiter->limit() << " ("
+        << limiter->increases() << " increases, " << limiter->decreases()
+        << " decreases)\n";
+    return result;
+  }
+
+#if defined(__linux__)
+  if (argc > 1 && std::string(argv[1]) == "--daemon") {
+    // --daemon [--socket PATH] [--port N] [--in-flight N] [--rate N]
+    // [--trace FILE]; misses share up to --in-flight upstream requests
+    std::string lyrics_path = std::string(getenv("HOME")) + "/.alsong";
+    std::string socket_path = lyrics_path + "/alsongd.sock";
+    int port = 8765;
+    unsigned in_flight = 32;
+    for (int i = 2; i + 1 < argc; i += 2) {
+      std::string arg = argv[i];
+      if (arg == "--socket")
+        socket_path = argv[i + 1];
+      else if (arg == "--port")
+        port = std::atoi(argv[i + 1]);
+      else if (arg == "--in-flight")
+        in_flight = unsigned(std::max(1, std::atoi(argv[i + 1])));
+    }
+    return run_daemon(lyrics_fetcher, lyrics_path, socket_path, port, in_flight);
+  }
+#endif
+
+  if (argc > 2 && std::string(argv[1]).compare(0, 2, "--") != 0) {
     title = argv[1];
     artist = argv[2];
   } 
@@ -19,22 +371,27 @@ int main(int argc, char *argv[])
   std::cout << "\t- Title : " << title << std::endl;
   std::cout << "\t- Artist : " << artist << std::endl;
 
-  lyrics_fetcher.fetch_lyric_list(title, artist, resp);
-  lyrics_serializer.parse_lyric_list(resp);
+  // cached songs are served without touching the network
+  moonk5::alsong::song_cache::entry song =
+    lyrics_serializer.lookup(title, artist);
+  if (!song) {
+    // search results and lyrics are cached separately, by query and by
+    // lyric id
+    lyrics_serializer.search(lyrics_fetcher, title, artist);
+    if (lyrics_serializer.song_list_collection.empty()) {
+      std::cout << "No song list found\n";
+      return 0;
+    }
 
-  if (lyrics_serializer.song_list_collection.empty()) {
-    std::cout << "No song list found\n";
-    return 0;
+    lyrics_serializer.fetch(lyrics_fetcher,
+        lyrics_serializer.song_list_collection[0].lyric_id);
+    lyrics_serializer.write(title, artist);
+    song = lyrics_serializer.lookup(title, artist);
   }
 
-  resp = "";
-  lyrics_fetcher.fetch_lyric(lyrics_serializer.song_list_collection[0].lyric_id, resp);
-  lyrics_serializer.parse_lyric(resp);
-
-  lyrics_serializer.write(title, artist);
-  lyrics_serializer.read(title, artist);
-
-  std::cout << lyrics_serializer.to_json_string() << std::endl;
+  if (song)
+    std::cout << "{\"song_collection\":[" << song->to_json_string() << "]}"
+      << std::endl;
 
   return 0;
 }
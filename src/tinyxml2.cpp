@@ -2012,6 +2012,8 @@ XMLDocument::XMLDocument( bool processEntities, Whitespace whitespaceMode ) :
     _errorStr(),
     _errorLineNum( 0 ),
     _charBuffer( 0 ),
+    _ownsCharBuffer( true ),
+    _charBufferAllocs( 0 ),
     _parseCurLineNum( 0 ),
 	_parsingDepth(0),
     _unlinked(),
@@ -2056,8 +2058,11 @@ void XMLDocument::Clear()
 #endif
     ClearError();
 
-    delete [] _charBuffer;
+    if ( _ownsCharBuffer ) {
+        delete [] _charBuffer;
+    }
     _charBuffer = 0;
+    _ownsCharBuffer = true;
 	_parsingDepth = 0;
 
 #if 0
@@ -2239,6 +2244,7 @@ XMLError XMLDocument::LoadFile( FILE* fp )
     const size_t size = filelength;
     TIXMLASSERT( _charBuffer == 0 );
     _charBuffer = new char[size+1];
+    ++_charBufferAllocs;
     size_t read = fread( _charBuffer, 1, size, fp );
     if ( read != size ) {
         SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
@@ -2295,24 +2301,64 @@ XMLError XMLDocument::Parse( const char* p, size_t len )
     }
     TIXMLASSERT( _charBuffer == 0 );
     _charBuffer = new char[ len+1 ];
+    ++_charBufferAllocs;
     memcpy( _charBuffer, p, len );
     _charBuffer[len] = 0;
 
     Parse();
     if ( Error() ) {
-        // clean up now essentially dangling memory.
-        // and the parse fail can put objects in the
-        // pools that are dead and inaccessible.
-        DeleteChildren();
-        _elementPool.Clear();
-        _attributePool.Clear();
-        _textPool.Clear();
-        _commentPool.Clear();
+        CleanupAfterParseError();
+    }
+    return _errorID;
+}
+
+
+XMLError XMLDocument::ParseInPlace( char* p, size_t len )
+{
+    Clear();
+
+    if ( len == 0 || !p || !*p ) {
+        SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
+        return _errorID;
+    }
+    if ( len == (size_t)(-1) ) {
+        len = strlen( p );
+    }
+    TIXMLASSERT( p[len] == 0 );
+    _charBuffer = p;
+    _ownsCharBuffer = false;
+
+    Parse();
+    if ( Error() ) {
+        CleanupAfterParseError();
     }
     return _errorID;
 }
 
 
+int XMLDocument::HeapAllocations() const
+{
+    return _charBufferAllocs
+        + _elementPool.BlockAllocs()
+        + _attributePool.BlockAllocs()
+        + _textPool.BlockAllocs()
+        + _commentPool.BlockAllocs();
+}
+
+
+void XMLDocument::CleanupAfterParseError()
+{
+    // clean up now essentially dangling memory.
+    // and the parse fail can put objects in the
+    // pools that are dead and inaccessible.
+    DeleteChildren();
+    _elementPool.Clear();
+    _attributePool.Clear();
+    _textPool.Clear();
+    _commentPool.Clear();
+}
+
+
 void XMLDocument::Print( XMLPrinter* streamer ) const
 {
     if ( streamer ) {
@@ -0,0 +1,139 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the binary lyrics image reads back the songs it was encoded from, and
+// a song written in the binary format reads back the same as in JSON
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  alsong::song_info sample_song(int n) {
+    alsong::song_info song;
+    song.lyric_id = std::to_string(1000 + n);
+    song.title = "Title " + std::to_string(n);
+    song.artist = n % 2 ? "Nightwish" : "아이유";
+    song.album = n % 3 ? "Wishmaster" : "";
+    song.written_by = "tester";
+    song.delay = n % 5 - 2;
+    song.add_lyrics("00:00.00", "");
+    song.add_lyrics("00:01.50", "line \"one\" of " + std::to_string(n));
+    song.add_lyrics("00:01.50", "두번째 줄");
+    for (int i = 0; i < n % 7; ++i)
+      song.add_lyrics("00:0" + std::to_string(2 + i) + ".20", "more [x]");
+    song.add_lyrics("01:04.99", "end");
+    return song;
+  }
+
+  bool same_song(const alsong::song_info& a, const alsong::song_info& b) {
+    if (a.lyric_id != b.lyric_id || a.title != b.title || a.artist != b.artist
+        || a.album != b.album || a.written_by != b.written_by
+        || a.delay != b.delay
+        || a.lyrics_collection.size() != b.lyrics_collection.size())
+      return false;
+    for (size_t i = 0; i < a.lyrics_collection.size(); ++i)
+      if (a.lyrics_collection[i].time != b.lyrics_collection[i].time
+          || a.lyrics_collection[i].lyrics != b.lyrics_collection[i].lyrics)
+        return false;
+    return true;
+  }
+
+  void check_round_trip() {
+    std::vector<alsong::song_info> songs;
+    for (int n = 0; n < 12; ++n)
+      songs.push_back(sample_song(n));
+    std::string image;
+    alsong::lyrics_binary::encode(songs, image);
+
+    alsong::lyrics_binary::view view;
+    CHECK(view.open(std::string_view(image)));
+    CHECK(view.song_count() == songs.size());
+    for (size_t i = 0; i < songs.size() && i < view.song_count(); ++i) {
+      CHECK(view.lyric_id(i) == songs[i].lyric_id);
+      CHECK(view.artist(i) == songs[i].artist);
+      alsong::song_info song;
+      view.to_song_info(i, song);
+      CHECK(same_song(song, songs[i]));
+    }
+
+    // an empty collection is still a valid image
+    std::string empty;
+    alsong::lyrics_binary::encode({}, empty);
+    CHECK(view.open(std::string_view(empty)));
+    CHECK(view.song_count() == 0);
+  }
+
+  void check_rejects_damage() {
+    std::string image;
+    alsong::lyrics_binary::encode({sample_song(3), sample_song(4)}, image);
+    alsong::lyrics_binary::view view;
+
+    for (size_t size = 0; size < image.size(); size += 7)
+      CHECK(!view.open(std::string_view(image.data(), size)));
+    CHECK(!view.open(std::string_view(image + "x")));
+
+    std::string magic = image;
+    magic[0] = 'X';
+    CHECK(!view.open(std::string_view(magic)));
+
+    std::string version = image;
+    version[4] = 2;
+    CHECK(!view.open(std::string_view(version)));
+
+    // the first string of the second song pointing past the string table
+    std::string strings = image;
+    uint32_t past = 1u << 30;
+    std::memcpy(&strings[sizeof(alsong::lyrics_binary::header)
+        + sizeof(alsong::lyrics_binary::song_record)], &past, sizeof(past));
+    CHECK(!view.open(std::string_view(strings)));
+    CHECK(!view.is_open());
+  }
+
+  void check_formats_agree(const std::string& folder) {
+    std::vector<alsong::song_info> songs;
+    for (int n = 0; n < 20; ++n)
+      songs.push_back(sample_song(n));
+
+    alsong::song_cache cache(0);
+    alsong::lyrics_serializer binary(folder + "/binary", 10);
+    binary.set_song_cache(cache);
+    alsong::lyrics_serializer json(folder + "/json", 10);
+    json.set_song_cache(cache);
+    json.set_lyrics_format(alsong::lyrics_format::json);
+
+    for (const alsong::song_info& song : songs) {
+      for (alsong::lyrics_serializer *serializer : {&binary, &json}) {
+        serializer->song_collection = {song};
+        CHECK(serializer->write());
+      }
+    }
+
+    for (const alsong::song_info& song : songs) {
+      CHECK(binary.read(song.title, song.artist));
+      CHECK(json.read(song.title, song.artist));
+      CHECK(binary.song_collection.size() == 1);
+      CHECK(json.song_collection.size() == 1);
+      if (binary.song_collection.size() == 1 && json.song_collection.size() == 1) {
+        CHECK(same_song(binary.song_collection[0], song));
+        CHECK(same_song(json.song_collection[0], song));
+      }
+
+      alsong::lyrics_binary::view view;
+      CHECK(binary.read_view(song.title, song.artist, view));
+      CHECK(view.song_count() == 1 && view.title(0) == song.title);
+    }
+
+    alsong::lyrics_binary::view view;
+    CHECK(!binary.read_view("missing", "nobody", view));
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-binary-format");
+  check_round_trip();
+  check_rejects_damage();
+  check_formats_agree(dir.str());
+  return test::test_result();
+}
@@ -0,0 +1,187 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the circuit breaker on its own and in front of a stand-in upstream:
+// tripping and recovering, a single probe while half open, probes given
+// back, late outcomes of calls admitted before the breaker opened, and
+// SOAP faults, which come from a working upstream
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  alsong::request_policy single_attempt() {
+    alsong::request_policy policy;
+    policy.max_attempts = 1;
+    return policy;
+  }
+
+  void check_permits() {
+    alsong::circuit_breaker breaker(0.5, 4, 10000, 50);
+    std::vector<uint64_t> closed;
+    for (int i = 0; i < 8; ++i)
+      closed.push_back(breaker.allow());
+    CHECK(closed.front() != 0);
+    for (int i = 0; i < 4; ++i)
+      breaker.record(closed[size_t(i)], true);
+    CHECK(breaker.state() == alsong::breaker_state::open);
+    CHECK(breaker.trips() == 1);
+    CHECK(breaker.allow() == 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    uint64_t probe = breaker.allow();
+    CHECK(probe != 0);
+    CHECK(breaker.allow() == 0);
+    // calls let through while closed neither close nor reopen it
+    breaker.record(closed[4], false);
+    breaker.record(closed[5], true);
+    CHECK(breaker.state() == alsong::breaker_state::half_open);
+    CHECK(breaker.trips() == 1);
+
+    // a probe that never went out is given back
+    breaker.cancel(probe);
+    uint64_t next_probe = breaker.allow();
+    CHECK(next_probe != 0);
+    CHECK(next_probe != probe);
+    breaker.record(probe, true);
+    CHECK(breaker.state() == alsong::breaker_state::half_open);
+    breaker.record(next_probe, false);
+    CHECK(breaker.state() == alsong::breaker_state::closed);
+
+    // nor do they count once it closed again
+    breaker.record(closed[6], true);
+    breaker.record(closed[7], true);
+    for (int i = 0; i < 3; ++i)
+      breaker.record(breaker.allow(), true);
+    CHECK(breaker.state() == alsong::breaker_state::closed);
+    breaker.record(breaker.allow(), true);
+    CHECK(breaker.state() == alsong::breaker_state::open);
+    CHECK(breaker.trips() == 2);
+  }
+
+  void check_down_and_up() {
+    test::stand_in_server server;
+    alsong::lyrics_fetcher fetcher(server.url());
+    fetcher.set_request_policy(single_attempt());
+    auto breaker = std::make_shared<alsong::circuit_breaker>(0.5, 4, 10000, 100);
+    fetcher.set_circuit_breaker(breaker);
+
+    server.set_down(true);
+    std::string output;
+    for (int i = 0; i < 4; ++i)
+      CHECK(fetcher.fetch_lyric("1", output) == CURLE_HTTP_RETURNED_ERROR);
+    CHECK(breaker->state() == alsong::breaker_state::open);
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_COULDNT_CONNECT);
+    CHECK(server.requests() == 4);
+    CHECK(breaker->rejected() == 1);
+
+    // a failed probe opens it again
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_HTTP_RETURNED_ERROR);
+    CHECK(breaker->trips() == 2);
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_COULDNT_CONNECT);
+
+    server.set_down(false);
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    output.clear();
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_OK);
+    CHECK(breaker->state() == alsong::breaker_state::closed);
+    CHECK(server.requests() == 6);
+  }
+
+  // a run of queries the upstream rejects with a SOAP fault leaves the
+  // breaker closed, while plain 500 answers open it
+  void check_faults_keep_closed() {
+    std::atomic<bool> faults{true};
+    test::stand_in_server server([&](const std::string&) {
+        test::stand_in_server::response r;
+        r.status = 500;
+        if (faults)
+          r.body = test::soap_fault_response();
+        return r;
+      });
+    alsong::lyrics_fetcher fetcher(server.url());
+    fetcher.set_request_policy(single_attempt());
+    auto breaker = std::make_shared<alsong::circuit_breaker>(0.5, 4, 10000, 60000);
+    fetcher.set_circuit_breaker(breaker);
+
+    std::string output;
+    for (int i = 0; i < 10; ++i)
+      CHECK(fetcher.fetch_lyric("1", output) == CURLE_HTTP_RETURNED_ERROR);
+    std::vector<alsong::lyrics_fetcher::batch_request> requests(10);
+    for (size_t i = 0; i < requests.size(); ++i)
+      requests[i].lyric_id = std::to_string(i);
+    fetcher.fetch_batch(requests, [](size_t, CURLcode, std::string&) {});
+    CHECK(server.requests() == 20);
+    CHECK(breaker->state() == alsong::breaker_state::closed);
+    CHECK(breaker->trips() == 0);
+
+    // the successes above keep the failure rate below one half for a
+    // while; plain 500 answers still open it eventually
+    faults = false;
+    for (int i = 0; i < 30 && breaker->state() == alsong::breaker_state::closed; ++i)
+      fetcher.fetch_lyric("1", output);
+    CHECK(breaker->state() == alsong::breaker_state::open);
+    CHECK(server.requests() == 40);
+  }
+
+  // two slow batch transfers admitted while closed finish while a probe
+  // is out; their successes must not close the breaker under the probe,
+  // whose failure opens it again
+  void check_late_batch_results() {
+    test::stand_in_server server([](const std::string& body) {
+        test::stand_in_server::response r;
+        if (body.find("slow") != std::string::npos) {
+          r.body = test::lyric_list_response(1);
+          r.delay_ms = 400;
+        } else if (body.find("probe") != std::string::npos) {
+          r.status = 503;
+          r.delay_ms = 400;
+        } else {
+          r.status = 503;
+        }
+        return r;
+      });
+    alsong::lyrics_fetcher fetcher(server.url());
+    fetcher.set_request_policy(single_attempt());
+    auto breaker = std::make_shared<alsong::circuit_breaker>(0.5, 4, 10000, 150);
+    fetcher.set_circuit_breaker(breaker);
+
+    std::vector<alsong::lyrics_fetcher::batch_request> requests(8);
+    requests[0].query = {"slow", "a"};
+    requests[1].query = {"slow", "b"};
+    for (size_t i = 2; i < requests.size(); ++i)
+      requests[i].query = {"fails " + std::to_string(i), "c"};
+
+    CURLcode probe_result = CURLE_OK;
+    std::thread probe([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        std::string output;
+        probe_result = fetcher.fetch_lyric("probe", output);
+      });
+    size_t succeeded = 0;
+    fetcher.fetch_batch(requests, [&](size_t, CURLcode result, std::string&) {
+        if (result == CURLE_OK)
+          ++succeeded;
+      }, 8);
+    CHECK(succeeded == 2);
+    CHECK(breaker->trips() == 1);
+    CHECK(breaker->state() == alsong::breaker_state::half_open);
+    std::string output;
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_COULDNT_CONNECT);
+    probe.join();
+    CHECK(probe_result == CURLE_HTTP_RETURNED_ERROR);
+    CHECK(breaker->trips() == 2);
+    CHECK(breaker->state() == alsong::breaker_state::open);
+  }
+}
+
+int main()
+{
+  check_permits();
+  check_down_and_up();
+  check_faults_keep_closed();
+  check_late_batch_results();
+  return test::test_result();
+}
@@ -0,0 +1,120 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the batch limit against a stand-in upstream with a capacity ceiling:
+// CAPACITY requests are served at once, QUEUE more wait for a worker and
+// anything beyond is answered 503 at once. A fixed window far above the
+// ceiling mostly fails, while the limiter of -j auto settles near it
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  const size_t CAPACITY = 8;
+  const size_t QUEUE = 4;
+  const long SERVICE_MS = 20;
+  const size_t SONGS = 600;
+
+  class bounded_upstream
+  {
+    public:
+      bounded_upstream()
+        : server([this](const std::string&) { return serve(); }) {
+      }
+
+      std::string url() const {
+        return server.url();
+      }
+
+      size_t peak() {
+        std::lock_guard<std::mutex> guard(mutex);
+        return busy_peak;
+      }
+
+    private:
+      test::stand_in_server::response serve() {
+        test::stand_in_server::response r;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          if (busy >= CAPACITY && queued >= QUEUE) {
+            r.status = 503;
+            return r;
+          }
+          ++queued;
+          idle.wait(lock, [this]() { return busy < CAPACITY; });
+          --queued;
+          busy_peak = std::max(busy_peak, ++busy);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(SERVICE_MS));
+        {
+          std::lock_guard<std::mutex> guard(mutex);
+          --busy;
+        }
+        idle.notify_one();
+        r.body = test::lyric_list_response(1);
+        return r;
+      }
+
+      std::mutex mutex;
+      std::condition_variable idle;
+      size_t busy = 0;
+      size_t queued = 0;
+      size_t busy_peak = 0;
+      test::stand_in_server server;
+  };
+
+  struct batch_outcome
+  {
+    size_t failed = 0;
+    // mean limit over the second half of the batch, once it has settled
+    double settled_limit = 0;
+  };
+
+  batch_outcome run(alsong::lyrics_fetcher& fetcher,
+      const std::shared_ptr<alsong::concurrency_limiter>& limiter) {
+    std::vector<alsong::lyrics_fetcher::batch_request> requests(SONGS);
+    for (size_t i = 0; i < SONGS; ++i)
+      requests[i].query = {"title " + std::to_string(i), "artist"};
+    batch_outcome outcome;
+    size_t done = 0, sampled = 0;
+    double limit_sum = 0;
+    fetcher.fetch_batch(requests, [&](size_t, CURLcode result, std::string&) {
+        if (result != CURLE_OK)
+          ++outcome.failed;
+        if (limiter && ++done > SONGS / 2) {
+          limit_sum += double(limiter->limit());
+          ++sampled;
+        }
+      }, 64);
+    if (sampled > 0)
+      outcome.settled_limit = limit_sum / double(sampled);
+    return outcome;
+  }
+}
+
+int main()
+{
+  bounded_upstream upstream;
+  alsong::lyrics_fetcher fetcher(upstream.url());
+
+  // -j 64: most requests land beyond the queue
+  batch_outcome fixed = run(fetcher, nullptr);
+  std::cout << "fixed 64: " << fixed.failed << " of " << SONGS << " failed\n";
+  CHECK(fixed.failed > SONGS / 4);
+
+  // -j auto: the same limiter and window as the command line
+  auto limiter = std::make_shared<alsong::concurrency_limiter>();
+  fetcher.set_concurrency_limiter(limiter);
+  batch_outcome adaptive = run(fetcher, limiter);
+  std::cout << "auto: " << adaptive.failed << " of " << SONGS
+    << " failed, settled limit " << adaptive.settled_limit << " ("
+    << limiter->increases() << " increases, " << limiter->decreases()
+    << " decreases)\n";
+  CHECK(adaptive.failed < SONGS / 10);
+  CHECK(adaptive.settled_limit >= CAPACITY / 2.0);
+  CHECK(adaptive.settled_limit <= double(CAPACITY + QUEUE) * 1.5);
+  CHECK(limiter->decreases() > 0);
+  CHECK(upstream.peak() <= CAPACITY);
+  return test::test_result();
+}
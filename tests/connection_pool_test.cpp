@@ -0,0 +1,41 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// searches and lyric fetches reuse pooled handles and one warm connection
+int main()
+{
+  test::stand_in_server server;
+  moonk5::alsong::lyrics_fetcher fetcher(server.url());
+
+  for (int i = 0; i < 20; ++i) {
+    std::string list, lyric;
+    CHECK(fetcher.fetch_lyric_list("dead boy's poem", "nightwish", list) == CURLE_OK);
+    CHECK(list.find("ST_SEARCHLYRIC_LIST") != std::string::npos);
+    CHECK(fetcher.fetch_lyric("1", lyric) == CURLE_OK);
+    CHECK(lyric.find("GetLyricByID2Result") != std::string::npos);
+  }
+  CHECK(server.requests() == 40);
+  CHECK(server.connections_accepted() == 1);
+  CHECK(fetcher.connection_open_count() == 1);
+  CHECK(fetcher.connection_reuse_count() == 39);
+
+  // concurrent callers share the pool; connections are bounded by the
+  // number of callers, not the number of requests
+  std::vector<std::thread> callers;
+  for (int t = 0; t < 4; ++t) {
+    callers.emplace_back([&fetcher]() {
+        for (int i = 0; i < 25; ++i) {
+          std::string lyric;
+          CHECK(fetcher.fetch_lyric("1", lyric) == CURLE_OK);
+        }
+      });
+  }
+  for (std::thread& t : callers)
+    t.join();
+  CHECK(server.requests() == 140);
+  CHECK(server.connections_accepted() <= 5);
+  CHECK(fetcher.connection_reuse_count() + fetcher.connection_open_count() == 140);
+
+  return test::test_result();
+}
@@ -0,0 +1,88 @@
+#include <random>
+
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the SIMD delimiter finders must produce the scalar index for every
+// length and alignment, and the line index must split like '<br>'/'\n'
+
+namespace
+{
+  std::vector<uint32_t> scalar(std::string_view text) {
+    std::vector<uint32_t> positions;
+    moonk5::delimiter_scan::find_lyric_delimiters_scalar(text, 0, positions);
+    return positions;
+  }
+
+  // lines as the regex parser saw them: the text between terminators,
+  // without the unterminated tail
+  std::vector<std::string> split(std::string text) {
+    std::vector<std::string> lines;
+    size_t pos;
+    while ((pos = text.find("<br>")) != std::string::npos)
+      text.replace(pos, 4, "\n");
+    size_t begin = 0;
+    while ((pos = text.find('\n', begin)) != std::string::npos) {
+      lines.push_back(text.substr(begin, pos - begin));
+      begin = pos + 1;
+    }
+    return lines;
+  }
+}
+
+int main()
+{
+  const char alphabet[] = "ab[]<>\nbr:0.가";
+  std::mt19937 random(6);
+  std::uniform_int_distribution<size_t> pick(0, sizeof(alphabet) - 2);
+
+  for (size_t size = 0; size < 300; ++size) {
+    std::string text;
+    for (size_t i = 0; i < size + 40; ++i)
+      text += alphabet[pick(random)];
+    // every alignment of the SIMD loads
+    for (size_t offset = 0; offset < 33; offset += 7) {
+      std::string_view view(text.data() + offset, size);
+      std::vector<uint32_t> expected = scalar(view), actual;
+      moonk5::delimiter_scan::find_lyric_delimiters(view, actual);
+      CHECK(actual == expected);
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+      std::vector<uint32_t> sse2;
+      moonk5::delimiter_scan::find_lyric_delimiters_sse2(view, sse2);
+      CHECK(sse2 == expected);
+      if (__builtin_cpu_supports("avx2")) {
+        std::vector<uint32_t> avx2;
+        moonk5::delimiter_scan::find_lyric_delimiters_avx2(view, avx2);
+        CHECK(avx2 == expected);
+      }
+#endif
+    }
+  }
+
+  for (int n = 0; n < 2000; ++n) {
+    std::string text;
+    std::uniform_int_distribution<int> length(0, 80);
+    for (int i = length(random); i > 0; --i) {
+      switch (random() % 5) {
+        case 0: text += "<br>"; break;
+        case 1: text += "[00:01.00]"; break;
+        default: text += alphabet[pick(random)];
+      }
+    }
+    std::vector<moonk5::delimiter_scan::line_span> spans;
+    moonk5::delimiter_scan::index_lyric_lines(text, spans);
+    std::vector<std::string> lines = split(text);
+    CHECK(spans.size() == lines.size());
+    for (size_t i = 0; i < spans.size() && i < lines.size(); ++i) {
+      std::string line = text.substr(spans[i].begin, spans[i].end - spans[i].begin);
+      CHECK(line == lines[i]);
+      size_t bracket = line.find('[');
+      CHECK(bracket == std::string::npos
+          ? spans[i].first_bracket == UINT32_MAX
+          : spans[i].first_bracket == spans[i].begin + bracket);
+    }
+  }
+
+  return test::test_result();
+}
@@ -0,0 +1,90 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// a mixed batch runs requests appended by its own callback on the same
+// event loop, so a lyric fetch goes out while slower searches are still
+// in flight. Scheduler tokens only go to requests that are sent
+
+int main()
+{
+  test::stand_in_server server([](const std::string& body) {
+      test::stand_in_server::response r;
+      if (body.find("GetResembleLyricList2") == std::string::npos) {
+        r.body = test::lyric_response("1");
+      } else {
+        r.body = test::lyric_list_response(1);
+        if (body.find("slow") != std::string::npos)
+          r.delay_ms = 300;
+      }
+      return r;
+    });
+  moonk5::alsong::lyrics_fetcher fetcher(server.url());
+
+  typedef moonk5::alsong::lyrics_fetcher::batch_request batch_request;
+  std::vector<batch_request> requests(3);
+  requests[0].query = {"fast", "a"};
+  requests[1].query = {"slow", "b"};
+  requests[2].query = {"", "invalid"};
+
+  std::vector<std::string> completed;
+  std::vector<CURLcode> results;
+  fetcher.fetch_batch(requests, [&](size_t i, CURLcode result, std::string& output) {
+      results.resize(std::max(results.size(), i + 1), CURLE_OK);
+      results[i] = result;
+      if (requests[i].lyric_id.empty()) {
+        completed.push_back("search " + requests[i].query.title);
+        if (result == CURLE_OK) {
+          CHECK(output.find("GetResembleLyricList2Response") != std::string::npos);
+          batch_request lyric;
+          lyric.lyric_id = "1";
+          requests.push_back(lyric);
+        }
+      } else {
+        completed.push_back("lyric");
+        CHECK(output.find("GetLyricByID2Response") != std::string::npos);
+      }
+    }, 4);
+
+  for (const std::string& c : completed)
+    std::cout << c << "\n";
+  CHECK(requests.size() == 5);
+  CHECK(results.size() == 5);
+  CHECK(results[2] == CURLE_BAD_FUNCTION_ARGUMENT);
+  CHECK(server.requests() == 4);
+  // the lyric fetch following the fast search beat the slow search
+  auto position = [&](const std::string& name) {
+    return std::find(completed.begin(), completed.end(), name) - completed.begin();
+  };
+  CHECK(position("search fast") < position("lyric"));
+  CHECK(position("lyric") < position("search slow"));
+  CHECK(std::count(completed.begin(), completed.end(), "lyric") == 2);
+  CHECK(completed.back() == "lyric");
+
+  // invalid requests and requests refused by an open breaker cost no token
+  auto scheduler = std::make_shared<moonk5::alsong::request_scheduler>(1000, 1000);
+  fetcher.set_scheduler(scheduler);
+  std::vector<batch_request> mixed(4);
+  mixed[0].query = {"", "invalid"};
+  mixed[1].query = {"one", "a"};
+  mixed[2].query = {"", "invalid"};
+  mixed[3].query = {"two", "b"};
+  size_t before = server.requests();
+  fetcher.fetch_batch(mixed, [](size_t, CURLcode, std::string&) {}, 4);
+  CHECK(server.requests() - before == 2);
+  CHECK(scheduler->stats(moonk5::alsong::request_priority::bulk).admitted == 2);
+
+  auto breaker = std::make_shared<moonk5::alsong::circuit_breaker>(0.5, 1, 10000, 60000);
+  breaker->record(breaker->allow(), true);
+  CHECK(breaker->state() == moonk5::alsong::breaker_state::open);
+  fetcher.set_circuit_breaker(breaker);
+  size_t refused = 0;
+  fetcher.fetch_batch(mixed, [&](size_t, CURLcode result, std::string&) {
+      if (result == CURLE_COULDNT_CONNECT)
+        ++refused;
+    }, 4);
+  CHECK(refused == 2);
+  CHECK(server.requests() - before == 2);
+  CHECK(scheduler->stats(moonk5::alsong::request_priority::bulk).admitted == 2);
+  return test::test_result();
+}
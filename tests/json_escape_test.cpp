@@ -0,0 +1,116 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// JSON strings escape quotes, backslashes and every control character,
+// pass any other byte through unchanged, and read back as the original
+// text, also for whole songs written and read by lyrics_serializer
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  std::string json_string(std::string_view text) {
+    std::string output;
+    alsong::append_json_string(output, text);
+    return output;
+  }
+
+  std::string parsed(const std::string& json) {
+    nlohmann::json j = nlohmann::json::parse(json, nullptr, false);
+    CHECK(j.is_string());
+    return j.is_string() ? j.get<std::string>() : std::string();
+  }
+
+  void check_escapes() {
+    CHECK(json_string("") == "\"\"");
+    CHECK(json_string("plain text") == "\"plain text\"");
+    CHECK(json_string("say \"hi\"") == "\"say \\\"hi\\\"\"");
+    CHECK(json_string("C:\\music\\") == "\"C:\\\\music\\\\\"");
+    CHECK(json_string("a\nb\rc\td\be\ff") == "\"a\\nb\\rc\\td\\be\\ff\"");
+    CHECK(json_string(std::string_view("\0", 1)) == "\"\\u0000\"");
+    CHECK(json_string("\x01\x1f") == "\"\\u0001\\u001f\"");
+    // DEL and '/' need no escape
+    CHECK(json_string("\x7f/") == "\"\x7f/\"");
+
+    // every control character escapes and reads back as itself
+    for (int c = 0; c < 0x20; ++c) {
+      std::string text(1, char(c));
+      std::string json = json_string(text);
+      CHECK(json.size() > 3 && json[1] == '\\');
+      CHECK(parsed(json) == text);
+    }
+
+    // non-ASCII text is copied as UTF-8
+    for (std::string text : {"아이유", "Beyoncé", "Ναι", "🎤 live", "Pokémon \"X\"\n"}) {
+      std::string json = json_string(text);
+      CHECK(parsed(json) == text);
+    }
+    CHECK(json_string("아이유") == "\"아이유\"");
+  }
+
+  alsong::song_info awkward_song() {
+    alsong::song_info song;
+    song.lyric_id = "77";
+    song.title = "Title";
+    song.artist = "Artist";
+    song.album = "\"Quoted\" \\ Album\t1";
+    song.written_by = std::string("nul\0byte", 8) + " \x1b[0m";
+    song.delay = -3;
+    song.add_lyrics("00:00.50", "첫 줄 \"인용\"");
+    song.add_lyrics("00:00.50", "second\\line");
+    song.add_lyrics("00:02.00", "tab\there\r\n");
+    song.add_lyrics("01:00.00", "");
+    return song;
+  }
+
+  bool same_song(const alsong::song_info& a, const alsong::song_info& b) {
+    if (a.lyric_id != b.lyric_id || a.title != b.title || a.artist != b.artist
+        || a.album != b.album || a.written_by != b.written_by
+        || a.delay != b.delay
+        || a.lyrics_collection.size() != b.lyrics_collection.size())
+      return false;
+    for (size_t i = 0; i < a.lyrics_collection.size(); ++i)
+      if (a.lyrics_collection[i].time != b.lyrics_collection[i].time
+          || a.lyrics_collection[i].lyrics != b.lyrics_collection[i].lyrics)
+        return false;
+    return true;
+  }
+
+  void check_song_json() {
+    alsong::song_info song = awkward_song();
+    nlohmann::json j = nlohmann::json::parse(song.to_json_string(), nullptr, false);
+    CHECK(!j.is_discarded());
+    CHECK(j["album"] == song.album);
+    CHECK(j["written_by"] == song.written_by);
+    CHECK(j["delay"] == -3);
+    CHECK(j["lyrics"].size() == 3);
+    CHECK(j["lyrics"][0]["lyrics"][0] == "첫 줄 \"인용\"");
+    CHECK(j["lyrics"][0]["lyrics"][1] == "second\\line");
+    CHECK(j["lyrics"][1]["lyrics"][0] == "tab\there\r\n");
+  }
+
+  void check_serializer_round_trip(const std::string& folder) {
+    alsong::song_info song = awkward_song();
+    {
+      alsong::lyrics_serializer serializer(folder);
+      serializer.set_lyrics_format(alsong::lyrics_format::json);
+      serializer.song_collection.push_back(song);
+      CHECK(serializer.write(song.title, song.artist));
+    }
+    alsong::lyrics_serializer serializer(folder);
+    CHECK(serializer.read(song.title, song.artist));
+    CHECK(serializer.song_collection.size() == 1);
+    if (serializer.song_collection.size() == 1)
+      CHECK(same_song(serializer.song_collection[0], song));
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-json-escape");
+  check_escapes();
+  check_song_json();
+  check_serializer_round_trip(dir.str());
+  return test::test_result();
+}
@@ -0,0 +1,123 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// spellings of one search fold to one key, and different searches keep
+// different keys
+
+namespace
+{
+  std::string normalised(std::string_view text) {
+    std::string output;
+    moonk5::key_normalization::normalise(text, output);
+    return output;
+  }
+
+  void check_folding() {
+    CHECK(normalised("Dead Boy's Poem") == "dead boys poem");
+    CHECK(normalised("  DEAD   boy’s\tpoem!! ") == "dead boys poem");
+    CHECK(normalised("Ｄｅａｄ　Ｂｏｙ") == "dead boy");
+    CHECK(normalised("Beyonce\xcc\x81") == "beyoncé");
+    CHECK(normalised("BEYONCÉ") == "beyoncé");
+    CHECK(normalised("ΑΒΓ Ωμέγα") == "αβγ ωμέγα");
+    CHECK(normalised("ПРИВЕТ Ёж") == "привет ёж");
+    // conjoining jamo compose to the syllable
+    CHECK(normalised("\xe1\x84\x92\xe1\x85\xa1\xe1\x86\xab") == "한");
+    CHECK(normalised("ｶﾞｰﾙ") == "ガール");
+    CHECK(normalised("") == "");
+    CHECK(normalised("...") == "");
+  }
+
+  void check_dotted_i() {
+    CHECK(normalised("İstanbul") == "istanbul");
+    CHECK(normalised("İSTANBUL") == normalised("istanbul"));
+    // the dotless i stays its own letter
+    CHECK(normalised("ı") == "ı");
+    CHECK(normalised("Iı") == "iı");
+  }
+
+  void check_featured_credits() {
+    CHECK(normalised("Song (feat. Someone)") == "song");
+    CHECK(normalised("Song (Feat Someone)") == "song");
+    CHECK(normalised("Song [ft. Someone]") == "song");
+    CHECK(normalised("Song feat. Someone") == "song");
+    CHECK(normalised("Song Ft. Someone") == "song");
+    CHECK(normalised("Song featuring Someone") == "song");
+    CHECK(normalised("Artist ｆｔ． Other") == "artist");
+
+    // feat and ft as plain words are part of the title
+    CHECK(normalised("Heroic Feat of Strength") == "heroic feat of strength");
+    CHECK(normalised("Six Ft Under") == "six ft under");
+    CHECK(normalised("Feat. Intro") == "feat intro");
+    CHECK(normalised("Defeat (Live)") == "defeat live");
+  }
+
+  void check_query_keys() {
+    using moonk5::alsong::query_key;
+    CHECK(query_key("Dead Boy's Poem", "Nightwish")
+        == query_key("dead boys poem", "NIGHTWISH"));
+    CHECK(query_key("Song (feat. X)", "A") == query_key("Song", "A"));
+    CHECK(query_key("Heroic Feat of X", "A") != query_key("Heroic", "A"));
+    CHECK(query_key("a", "b c") != query_key("b a", "c"));
+  }
+
+  // the code points decode_utf8 reads from text, -1 for each ill-formed
+  // part
+  std::vector<int32_t> decoded(std::string_view text) {
+    std::vector<int32_t> cps;
+    for (size_t i = 0; i < text.size(); )
+      cps.push_back(moonk5::key_normalization::decode_utf8(text, i));
+    return cps;
+  }
+
+  void check_utf8_decoding() {
+    using cps = std::vector<int32_t>;
+    // the first and last code point of every length, around the surrogates
+    CHECK(decoded("\x7f\xc2\x80\xdf\xbf") == cps({0x7F, 0x80, 0x7FF}));
+    CHECK(decoded("\xe0\xa0\x80\xef\xbf\xbf") == cps({0x800, 0xFFFF}));
+    CHECK(decoded("\xed\x9f\xbf\xee\x80\x80") == cps({0xD7FF, 0xE000}));
+    CHECK(decoded("\xf0\x90\x80\x80\xf4\x8f\xbf\xbf")
+        == cps({0x10000, 0x10FFFF}));
+
+    // overlong forms, e.g. of '/', never decode
+    CHECK(decoded("\xc0\xaf") == cps({-1, -1}));
+    CHECK(decoded("\xc1\xbf") == cps({-1, -1}));
+    CHECK(decoded("\xe0\x80\xaf") == cps({-1, -1, -1}));
+    CHECK(decoded("\xf0\x80\x80\xaf") == cps({-1, -1, -1, -1}));
+    // surrogates and values past U+10FFFF
+    CHECK(decoded("\xed\xa0\x80") == cps({-1, -1, -1}));
+    CHECK(decoded("\xed\xbf\xbf") == cps({-1, -1, -1}));
+    CHECK(decoded("\xf4\x90\x80\x80") == cps({-1, -1, -1, -1}));
+    CHECK(decoded("\xf5\x80\x80\x80") == cps({-1, -1, -1, -1}));
+    // a sequence cut short is skipped as one maximal subpart
+    CHECK(decoded("\xe1\x80" "A") == cps({-1, 'A'}));
+    CHECK(decoded("\xf0\x9f\x8e") == cps({-1}));
+    CHECK(decoded("\xf0\x9f\x8e" "A\xbf") == cps({-1, 'A', -1}));
+    CHECK(decoded("\xe2\x82") == cps({-1}));
+
+    // ill-formed bytes are kept, not read as the character they spell
+    CHECK(normalised("a\xc0\xaf" "b") == "a\xc0\xaf" "b");
+    CHECK(normalised("A\xe1\x80" "B") == "a\xe1\x80" "b");
+    CHECK(normalised("\xed\xa0\x80") != normalised("\xed\xa0\x81"));
+  }
+
+  void check_hash() {
+    using moonk5::key_normalization::hash;
+    // FNV-1a 64 reference values
+    CHECK(hash("") == 0xcbf29ce484222325ULL);
+    CHECK(hash("a") == 0xaf63dc4c8601ec8cULL);
+    CHECK(hash("foobar") == 0x85944171f73967e8ULL);
+    CHECK(hash("bar", hash("foo")) == hash("foobar"));
+  }
+}
+
+int main()
+{
+  check_folding();
+  check_dotted_i();
+  check_featured_credits();
+  check_query_keys();
+  check_utf8_decoding();
+  check_hash();
+  return test::test_result();
+}
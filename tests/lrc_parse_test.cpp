@@ -0,0 +1,123 @@
+#include <random>
+#include <regex>
+
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// differential test of the single-pass LRC scanner against the regex
+// parser it replaced, over hand-picked lyrics and random token mixes
+
+namespace
+{
+  void replace_all(std::string& text, const std::string& from,
+      const std::string& to) {
+    size_t pos = 0;
+    while ((pos = text.find(from, pos)) != std::string::npos) {
+      text.replace(pos, from.size(), to);
+      pos += to.size();
+    }
+  }
+
+  // lyrics_serializer::parse_lyrics before the scanner, minus the '"'
+  // escaping that moved into the JSON writer
+  void regex_parse_lyrics(std::string input, moonk5::alsong::song_info& output) {
+    const std::string REGEX_TIME =
+      "\\[([0-5][0-9]:[0-5][0-9].[0-9][0-9])\\]";
+    const std::string REGEX_TIME_LYRICS =
+      "(" + REGEX_TIME + ")(.*)(\n)";
+    std::regex reg_ex(REGEX_TIME_LYRICS);
+    std::smatch match;
+
+    replace_all(input, "<br>", "\n");
+    replace_all(input, "[00:00.00]\n", "");
+
+    while (std::regex_search(input, match, reg_ex)) {
+      output.add_lyrics(match[2].str(), match[3].str());
+      input = match.suffix().str();
+    }
+  }
+
+  // the scanner, reached through a GetLyricByID2 response
+  bool scan_parse_lyrics(moonk5::alsong::lyrics_serializer& serializer,
+      const std::string& lyric, moonk5::alsong::song_info& output) {
+    std::string escaped;
+    moonk5::alsong::append_xml_escaped(escaped, lyric);
+    replace_all(escaped, "\r", "&#13;");
+    serializer.song_collection.clear();
+    if (!serializer.parse_lyric(test::lyric_response("1", escaped))
+        || serializer.song_collection.size() != 1)
+      return false;
+    output = serializer.song_collection[0];
+    return true;
+  }
+
+  bool same_lyrics(const moonk5::alsong::song_info& a,
+      const moonk5::alsong::song_info& b) {
+    if (a.lyrics_collection.size() != b.lyrics_collection.size())
+      return false;
+    for (size_t i = 0; i < a.lyrics_collection.size(); ++i) {
+      if (a.lyrics_collection[i].time != b.lyrics_collection[i].time
+          || a.lyrics_collection[i].lyrics != b.lyrics_collection[i].lyrics)
+        return false;
+    }
+    return true;
+  }
+
+  bool agrees(moonk5::alsong::lyrics_serializer& serializer,
+      const std::string& lyric) {
+    moonk5::alsong::song_info expected, actual;
+    regex_parse_lyrics(lyric, expected);
+    if (!scan_parse_lyrics(serializer, lyric, actual) || !same_lyrics(expected, actual)) {
+      std::cerr << "differs on: " << lyric << "\n";
+      return false;
+    }
+    return true;
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-lrc-parse");
+  moonk5::alsong::lyrics_serializer serializer(dir.str());
+
+  const std::vector<std::string> corpus = {
+    "",
+    "[00:00.00]<br>[00:01.50]Line \"one\"<br>[00:01.50]두번째<br>"
+      "[00:03.20]three [x]<br>[01:04.99]end",
+    "[00:03.00]駆けてくあなたの背中は<br>[00:03.00]그라운도 카케테쿠<br>"
+      "[00:03.00]그라운드를 달리는 당신의 등은<br>[00:09.01]空に<br>",
+    "no stamps at all<br>still none<br>",
+    "[00:00.00][00:00.00]<br>[00:00.00]<br>[00:05.00]after empties<br>",
+    "[00:00.00][00:12.00]merged<br>[00:13.00]x<br>",
+    "[00:01.00]carriage\r<br>[00:02.00]fine<br>",
+    "prefix [00:07.07]mid-line stamp<br>[00:08.00]a[00:09.00]b<br>",
+    "[60:00.00]bad minute<br>[00:61.00]bad second<br>[0:1.00]short<br>",
+    "[00:01x00]any separator<br>[00:02.00]<br>",
+    "[00:01.00]no trailing break",
+    "[00:01.00]newline\n[00:02.00]mixed<br>[00:03.00]breaks\n",
+  };
+  for (const std::string& lyric : corpus)
+    CHECK(agrees(serializer, lyric));
+
+  // random mixes of the tokens both parsers react to
+  const std::vector<std::string> tokens = {
+    "<br>", "<br>", "<br>", "[00:00.00]", "[00:00.00]", "[01:23.45]",
+    "[59:59.99]", "[60:00.00]", "[1:2.3]", "[00:01.5]", "[", "]", "\n", "\r",
+    "\"", "<", "br>", " ", "text", "가사", "[00:01.50]", "[00:01.50]", "00:00.00]",
+  };
+  std::mt19937 random(5);
+  std::uniform_int_distribution<size_t> pick(0, tokens.size() - 1);
+  std::uniform_int_distribution<int> length(0, 40);
+  int disagreements = 0;
+  for (int i = 0; i < 5000 && disagreements < 5; ++i) {
+    std::string lyric;
+    for (int n = length(random); n > 0; --n)
+      lyric += tokens[pick(random)];
+    if (!agrees(serializer, lyric))
+      ++disagreements;
+  }
+  CHECK(disagreements == 0);
+
+  return test::test_result();
+}
@@ -0,0 +1,144 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// misses go upstream concurrently rather than a few at a time, identical
+// misses share one upstream request, and a client that half-closes its
+// connection after sending still gets its answers
+
+namespace
+{
+  const long UPSTREAM_DELAY_MS = 200;
+
+  std::atomic<int> upstream_in_flight{0};
+  std::atomic<int> upstream_peak{0};
+
+  std::string between(const std::string& body, const std::string& open,
+      const std::string& close) {
+    size_t begin = body.find(open);
+    if (begin == std::string::npos)
+      return "";
+    begin += open.size();
+    return body.substr(begin, body.find(close, begin) - begin);
+  }
+
+  // 'song N' searches find lyric id N
+  test::stand_in_server::response upstream(const std::string& body) {
+    int now = ++upstream_in_flight;
+    int peak = upstream_peak;
+    while (now > peak && !upstream_peak.compare_exchange_weak(peak, now)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(UPSTREAM_DELAY_MS));
+    --upstream_in_flight;
+
+    test::stand_in_server::response r;
+    if (body.find("GetResembleLyricList2") != std::string::npos) {
+      std::string title = between(body, "<ns1:title>", "</ns1:title>");
+      std::string id = title.compare(0, 5, "song ") == 0 ? title.substr(5) : "";
+      r.body = test::lyric_list_response(id.empty() ? 0 : 1);
+      size_t at = r.body.find("<lyricID>1<");
+      if (at != std::string::npos)
+        r.body.replace(at + 9, 1, id);
+    } else {
+      r.body = test::lyric_response(between(body, "<ns1:lyricID>", "</ns1:lyricID>"));
+    }
+    return r;
+  }
+
+  std::string target(int song) {
+    return "/lyrics?title=song%20" + std::to_string(song) + "&artist=tester";
+  }
+
+  void check_concurrent_misses(const std::string& socket_path) {
+    const int clients = 16;
+    upstream_peak = 0;
+    std::vector<int> statuses(clients);
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < clients; ++c)
+      threads.emplace_back([&, c]() {
+          test::unix_http_client client(socket_path);
+          test::unix_http_client::response r = client.get(target(100 + c));
+          statuses[size_t(c)] = r.status;
+          CHECK(r.body.find("\"lyric_id\":\"" + std::to_string(100 + c) + "\"")
+              != std::string::npos);
+        });
+    for (std::thread& t : threads)
+      t.join();
+    long elapsed = long(std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - started).count());
+
+    std::cout << clients << " misses in " << elapsed << " ms, upstream peak "
+      << upstream_peak << " in flight\n";
+    for (int status : statuses)
+      CHECK(status == 200);
+    // a search and a lyric fetch each; four at a time would take 8 rounds
+    CHECK(upstream_peak >= clients / 2);
+    CHECK(elapsed < 6 * UPSTREAM_DELAY_MS);
+  }
+
+  void check_shared_misses(const std::string& socket_path,
+      test::stand_in_server& server) {
+    uint64_t before = server.requests();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < 8; ++c)
+      threads.emplace_back([&]() {
+          test::unix_http_client client(socket_path);
+          CHECK(client.get(target(200)).status == 200);
+        });
+    for (std::thread& t : threads)
+      t.join();
+    CHECK(server.requests() - before == 2);
+
+    // now a cache hit
+    test::unix_http_client client(socket_path);
+    CHECK(client.get(target(200)).status == 200);
+    CHECK(client.get("/lyrics/200").status == 200);
+    CHECK(server.requests() - before == 2);
+  }
+
+  void check_half_close(const std::string& socket_path) {
+    // two pipelined requests, the second a miss, then no more input
+    test::unix_http_client client(socket_path);
+    CHECK(client.send_request(target(300)));
+    CHECK(client.send_request(target(301)));
+    client.finish_sending();
+    test::unix_http_client::response first = client.read_response();
+    test::unix_http_client::response second = client.read_response();
+    CHECK(first.status == 200);
+    CHECK(first.body.find("\"lyric_id\":\"300\"") != std::string::npos);
+    CHECK(second.status == 200);
+    CHECK(second.body.find("\"lyric_id\":\"301\"") != std::string::npos);
+    CHECK(client.closed_by_peer());
+
+    test::unix_http_client hit(socket_path);
+    CHECK(hit.send_request(target(300)));
+    hit.finish_sending();
+    CHECK(hit.read_response().status == 200);
+    CHECK(hit.closed_by_peer());
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-daemon");
+  test::stand_in_server server(upstream);
+  moonk5::alsong::lyrics_fetcher fetcher(server.url());
+  std::string socket_path = dir.str() + "/alsongd.sock";
+
+  moonk5::alsong::lyrics_daemon daemon(fetcher, dir.str() + "/lyrics");
+  CHECK(daemon.listen_unix(socket_path));
+  std::thread loop([&]() { daemon.run(); });
+
+  check_concurrent_misses(socket_path);
+  check_shared_misses(socket_path, server);
+  check_half_close(socket_path);
+
+  test::unix_http_client client(socket_path);
+  CHECK(client.get("/lyrics?title=nothing&artist=tester").status == 404);
+  CHECK(client.get("/other").status == 404);
+
+  daemon.stop();
+  loop.join();
+  return test::test_result();
+}
@@ -0,0 +1,202 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the pack store keeps the newest value of every key across reopening
+// and compaction, views it handed out stay readable, values start on an
+// 8 byte boundary whatever the key length, a table that cannot grow
+// refuses new keys instead of overfilling, and a segment file cut short
+// turns the records it lost into misses instead of SIGBUS
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  std::string value_of(int key, int version) {
+    return "value " + std::to_string(key) + " v" + std::to_string(version)
+      + std::string(size_t(key % 37) * 11, 'x');
+  }
+
+  void check_compact_keeps_views(const std::filesystem::path& folder) {
+    alsong::lyrics_pack pack(folder, 4096);
+    for (int key = 0; key < 200; ++key)
+      CHECK(pack.put("key" + std::to_string(key), value_of(key, 1)));
+
+    std::vector<std::string_view> views;
+    for (int key = 0; key < 200; ++key)
+      views.push_back(pack.get("key" + std::to_string(key)));
+    for (int key = 0; key < 200; key += 2)
+      CHECK(pack.put("key" + std::to_string(key), value_of(key, 2)));
+
+    size_t segments_before = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(folder))
+      segments_before += entry.path().extension() == ".seg";
+    CHECK(pack.compact());
+    size_t segments_after = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(folder))
+      segments_after += entry.path().extension() == ".seg";
+    CHECK(segments_after < segments_before);
+
+    // views from before compaction still read the old bytes
+    for (int key = 0; key < 200; ++key)
+      CHECK(views[size_t(key)] == value_of(key, 1));
+    CHECK(pack.size() == 200);
+    for (int key = 0; key < 200; ++key)
+      CHECK(pack.get("key" + std::to_string(key)) == value_of(key, key % 2 ? 1 : 2));
+
+    CHECK(pack.put("key0", value_of(0, 3)));
+    CHECK(pack.get("key0") == value_of(0, 3));
+  }
+
+  void check_reopen(const std::filesystem::path& folder) {
+    alsong::lyrics_pack pack(folder, 4096);
+    CHECK(pack.size() == 200);
+    CHECK(pack.get("key0") == value_of(0, 3));
+    for (int key = 1; key < 200; ++key)
+      CHECK(pack.get("key" + std::to_string(key)) == value_of(key, key % 2 ? 1 : 2));
+    CHECK(pack.get("missing").empty());
+  }
+
+  // binary images are read in place, also behind keys of odd length
+  void check_aligned_values(const std::filesystem::path& folder) {
+    alsong::song_info song;
+    song.lyric_id = "42";
+    song.title = "Title";
+    song.artist = "Artist";
+    song.add_lyrics("00:01.50", "line");
+    song.add_lyrics("00:02.00", "next line");
+    std::string image;
+    alsong::lyrics_binary::encode({song}, image);
+
+    {
+      alsong::lyrics_pack pack(folder);
+      for (size_t length = 1; length <= 17; ++length)
+        CHECK(pack.put(std::string(length, 'k'), image));
+    }
+    alsong::lyrics_pack pack(folder);
+    for (size_t length = 1; length <= 17; ++length) {
+      std::string_view bytes = pack.get(std::string(length, 'k'));
+      CHECK(bytes == image);
+      CHECK(reinterpret_cast<uintptr_t>(bytes.data()) % 8 == 0);
+      alsong::lyrics_binary::view view;
+      CHECK(view.open(bytes));
+      CHECK(view.song_count() == 1);
+      if (view.song_count() == 1) {
+        alsong::song_info read;
+        view.to_song_info(0, read);
+        CHECK(read.lyric_id == "42");
+        CHECK(read.lyrics_collection.size() == 2);
+        CHECK(view.group(1).time == 2000);
+      }
+    }
+
+    // a misaligned image is refused rather than read
+    std::string shifted = " " + image;
+    alsong::lyrics_binary::view view;
+    CHECK(!view.open(std::string_view(shifted).substr(1)));
+  }
+
+  std::vector<std::filesystem::path> segment_files(const std::filesystem::path& folder) {
+    std::vector<std::filesystem::path> files;
+    for (const auto& entry : std::filesystem::directory_iterator(folder))
+      if (entry.path().extension() == ".seg")
+        files.push_back(entry.path());
+    std::sort(files.begin(), files.end());
+    return files;
+  }
+
+  // counts the keys that read back intact; any other value fails a check
+  int readable_keys(alsong::lyrics_pack& pack, int count) {
+    int readable = 0;
+    for (int key = 0; key < count; ++key) {
+      std::string_view value = pack.get("key" + std::to_string(key));
+      if (value.empty())
+        continue;
+      CHECK(value == value_of(key, 1));
+      ++readable;
+    }
+    return readable;
+  }
+
+  // a directory in the way of the grown table makes growing fail
+  void check_failed_grow(const std::filesystem::path& folder) {
+    std::filesystem::create_directories(folder / "index.tmp" / "blocker");
+    int stored = 0, refused = 0;
+    {
+      alsong::lyrics_pack pack(folder);
+      for (int key = 0; key < 2000; ++key) {
+        if (pack.put("key" + std::to_string(key), value_of(key, 1)))
+          ++stored;
+        else
+          ++refused;
+      }
+      CHECK(stored > 500 && stored < 1024);
+      CHECK(refused == 2000 - stored);
+      CHECK(pack.size() == size_t(stored));
+      CHECK(readable_keys(pack, 2000) == stored);
+      CHECK(pack.get("missing").empty());
+
+      // the first refused record was written; it is indexed once the
+      // table can grow
+      std::filesystem::remove_all(folder / "index.tmp");
+      CHECK(pack.put("after", "value"));
+      CHECK(pack.get("key" + std::to_string(stored)) == value_of(stored, 1));
+      CHECK(pack.size() == size_t(stored) + 2);
+    }
+    alsong::lyrics_pack pack(folder);
+    CHECK(readable_keys(pack, 2000) == stored + 1);
+    CHECK(pack.get("after") == "value");
+  }
+
+  // the last segment, the one the index checkpoint covers, is cut in half
+  void check_truncated_last_segment(const std::filesystem::path& folder) {
+    {
+      alsong::lyrics_pack pack(folder);
+      for (int key = 0; key < 5000; ++key)
+        CHECK(pack.put("key" + std::to_string(key), value_of(key, 1)));
+    }
+    std::vector<std::filesystem::path> files = segment_files(folder);
+    CHECK(files.size() == 1);
+    std::filesystem::resize_file(files.back(),
+        std::filesystem::file_size(files.back()) / 2);
+
+    alsong::lyrics_pack pack(folder);
+    CHECK(pack.get("key4999").empty());
+    CHECK(pack.get("key10") == value_of(10, 1));
+    int readable = readable_keys(pack, 5000);
+    CHECK(readable > 2000 && readable < 5000);
+    CHECK(pack.size() == size_t(readable));
+
+    // the rebuilt pack takes new records
+    CHECK(pack.put("key4999", value_of(4999, 1)));
+    CHECK(pack.get("key4999") == value_of(4999, 1));
+  }
+
+  // an earlier segment is cut short while the index still looks current
+  void check_truncated_earlier_segment(const std::filesystem::path& folder) {
+    {
+      alsong::lyrics_pack pack(folder, 4096);
+      for (int key = 0; key < 1000; ++key)
+        CHECK(pack.put("key" + std::to_string(key), value_of(key, 1)));
+    }
+    std::vector<std::filesystem::path> files = segment_files(folder);
+    CHECK(files.size() > 2);
+    std::filesystem::resize_file(files[1], 100);
+
+    alsong::lyrics_pack pack(folder, 4096);
+    int readable = readable_keys(pack, 1000);
+    CHECK(readable > 900 && readable < 1000);
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-lyrics-pack");
+  check_compact_keeps_views(dir.path / "compact");
+  check_reopen(dir.path / "compact");
+  check_aligned_values(dir.path / "aligned");
+  check_failed_grow(dir.path / "failed-grow");
+  check_truncated_last_segment(dir.path / "truncated-last");
+  check_truncated_earlier_segment(dir.path / "truncated-earlier");
+  return test::test_result();
+}
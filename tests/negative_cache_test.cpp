@@ -0,0 +1,121 @@
+#include <AlsongLyricsFetcher.h>
+
+#include <sys/wait.h>
+
+#include "test_support.h"
+
+// negative search entries survive reopening, removals are replayed,
+// several processes appending to one file lose nothing, also after one
+// of them rewrote it, and storing results for a search drops it from the
+// negative cache
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  void check_add_remove(const std::filesystem::path& path) {
+    {
+      alsong::negative_cache cache(path);
+      CHECK(!cache.contains("Title", "Artist"));
+      cache.add("Title", "Artist");
+      cache.add("Other", "Artist");
+      CHECK(cache.contains("Title", "Artist"));
+      // searches are folded before hashing
+      CHECK(cache.contains("  TITLE ", "artist"));
+      cache.remove("Other", "Artist");
+      CHECK(!cache.contains("Other", "Artist"));
+      CHECK(cache.size() == 1);
+      CHECK(cache.hits() == 2);
+    }
+    alsong::negative_cache reopened(path);
+    CHECK(reopened.contains("Title", "Artist"));
+    CHECK(!reopened.contains("Other", "Artist"));
+    CHECK(reopened.size() == 1);
+
+    alsong::negative_cache expired(path.string() + "-expired", 0);
+    expired.add("Title", "Artist");
+    CHECK(!expired.contains("Title", "Artist"));
+  }
+
+  void check_processes_share(const std::filesystem::path& path) {
+    const int processes = 4, entries = 500;
+    std::vector<pid_t> children;
+    for (int p = 0; p < processes; ++p) {
+      pid_t pid = ::fork();
+      if (pid == 0) {
+        alsong::negative_cache cache(path);
+        for (int i = 0; i < entries; ++i)
+          cache.add("title " + std::to_string(p) + "-" + std::to_string(i), "artist");
+        std::_Exit(0);
+      }
+      children.push_back(pid);
+    }
+    for (pid_t pid : children) {
+      int status = 0;
+      ::waitpid(pid, &status, 0);
+      CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    CHECK(std::filesystem::file_size(path)
+        == size_t(processes * entries) * 2 * sizeof(uint64_t));
+    alsong::negative_cache cache(path);
+    CHECK(cache.size() == size_t(processes * entries));
+    CHECK(cache.contains("title 3-499", "artist"));
+  }
+
+  // the second instance rewrites the file while the first has it open
+  void check_append_after_rewrite(const std::filesystem::path& path) {
+    alsong::negative_cache first(path);
+    for (int i = 0; i < 1100; ++i)
+      first.add("gone " + std::to_string(i), "Artist");
+    for (int i = 0; i < 1100; ++i)
+      first.remove("gone " + std::to_string(i), "Artist");
+    first.add("Kept", "Artist");
+    uintmax_t before = std::filesystem::file_size(path);
+
+    alsong::negative_cache second(path);
+    CHECK(std::filesystem::file_size(path) < before);
+    CHECK(second.contains("Kept", "Artist"));
+    first.add("After", "First");
+    second.add("After", "Second");
+
+    alsong::negative_cache reloaded(path);
+    CHECK(reloaded.contains("Kept", "Artist"));
+    CHECK(reloaded.contains("After", "First"));
+    CHECK(reloaded.contains("After", "Second"));
+    CHECK(!reloaded.contains("gone 0", "Artist"));
+    CHECK(reloaded.size() == 3);
+  }
+
+  void check_store_search_removes(const std::string& folder) {
+    alsong::lyrics_serializer serializer(folder);
+    std::shared_ptr<alsong::negative_cache> negatives = serializer.negative_searches();
+    negatives->add("Dead Boy's Poem", "Nightwish");
+    negatives->add("Sleeping Sun", "Nightwish");
+
+    alsong::song_list list;
+    list.lyric_id = "1";
+    list.title = "Dead Boy's Poem";
+    list.artist = "Nightwish";
+    serializer.store_search("Dead Boy's Poem", "Nightwish", {list});
+    CHECK(!negatives->contains("Dead Boy's Poem", "Nightwish"));
+    CHECK(negatives->contains("Sleeping Sun", "Nightwish"));
+    serializer.song_list_collection.clear();
+    CHECK(serializer.find_search("Dead Boy's Poem", "Nightwish"));
+
+    // the removal is in the file too
+    negatives.reset();
+    alsong::negative_cache reopened(std::filesystem::path(folder) / "negative");
+    CHECK(!reopened.contains("Dead Boy's Poem", "Nightwish"));
+    CHECK(reopened.contains("Sleeping Sun", "Nightwish"));
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-negative-cache");
+  check_add_remove(dir.path / "negative");
+  check_processes_share(dir.path / "shared");
+  check_append_after_rewrite(dir.path / "rewritten");
+  check_store_search_removes(dir.str() + "/lyrics");
+  return test::test_result();
+}
@@ -0,0 +1,230 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the request policy against a stand-in upstream that fails, stalls and
+// cuts responses short: retries, their limits, the deadline, hedging and
+// the rollback of partial output
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  long elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return long(std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start).count());
+  }
+
+  alsong::request_policy fast_retries(unsigned attempts) {
+    alsong::request_policy policy;
+    policy.max_attempts = attempts;
+    policy.backoff_base_ms = 1;
+    policy.backoff_max_ms = 5;
+    return policy;
+  }
+
+  // answers 503 to two requests out of three
+  void check_retries() {
+    std::atomic<int> n{0};
+    test::stand_in_server server([&](const std::string&) {
+        test::stand_in_server::response r;
+        if (n++ % 3 != 2)
+          r.status = 503;
+        else
+          r.body = test::lyric_response("1");
+        return r;
+      });
+    alsong::lyrics_fetcher fetcher(server.url());
+    fetcher.set_request_policy(fast_retries(3));
+    for (int call = 0; call < 10; ++call) {
+      std::string output;
+      CHECK(fetcher.fetch_lyric("1", output) == CURLE_OK);
+      CHECK(output == test::lyric_response("1"));
+    }
+    CHECK(fetcher.retry_count() == 20);
+    CHECK(server.requests() == 30);
+
+    // two attempts are not enough
+    fetcher.set_request_policy(fast_retries(2));
+    n = 0;
+    std::string output;
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_HTTP_RETURNED_ERROR);
+    CHECK(server.requests() == 32);
+  }
+
+  void check_no_retry_on_client_errors() {
+    test::stand_in_server server([](const std::string&) {
+        test::stand_in_server::response r;
+        r.status = 404;
+        return r;
+      });
+    alsong::lyrics_fetcher fetcher(server.url());
+    fetcher.set_request_policy(fast_retries(3));
+    std::string output;
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_HTTP_RETURNED_ERROR);
+    CHECK(server.requests() == 1);
+    CHECK(fetcher.retry_count() == 0);
+  }
+
+  // a SOAP fault comes back as a 500 and is final; 502, 503, 504 and 429
+  // are retried, other 5xx answers are not
+  void check_soap_faults() {
+    std::atomic<int> status{500};
+    test::stand_in_server server([&](const std::string&) {
+        test::stand_in_server::response r;
+        r.status = status;
+        r.body = status == 500 ? test::soap_fault_response() : "busy";
+        return r;
+      });
+    alsong::lyrics_fetcher fetcher(server.url());
+    fetcher.set_request_policy(fast_retries(3));
+    std::string output;
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_HTTP_RETURNED_ERROR);
+    CHECK(server.requests() == 1);
+    CHECK(output.empty());
+
+    // the same through a streaming parser, which never sees the fault
+    test::temp_dir dir("alsong-fault");
+    alsong::lyrics_serializer serializer(dir.str());
+    alsong::soap_stream_parser parser = serializer.lyric_stream();
+    CHECK(fetcher.fetch_lyric("1", parser) == CURLE_HTTP_RETURNED_ERROR);
+    CHECK(server.requests() == 2);
+    CHECK(!parser.result_found());
+
+    uint64_t requests = server.requests();
+    for (int code : {429, 502, 503, 504}) {
+      status = code;
+      CHECK(fetcher.fetch_lyric("1", output) == CURLE_HTTP_RETURNED_ERROR);
+      CHECK(server.requests() - requests == 3);
+      requests = server.requests();
+    }
+    CHECK(output.empty());
+    status = 501;
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_HTTP_RETURNED_ERROR);
+    CHECK(server.requests() - requests == 1);
+    CHECK(fetcher.retry_count() == 8);
+
+    // batches report the fault the same way and leave no output
+    status = 500;
+    std::vector<alsong::lyrics_fetcher::batch_request> requests_batch(2);
+    requests_batch[0].lyric_id = "1";
+    requests_batch[1].lyric_id = "2";
+    size_t faults = 0;
+    fetcher.fetch_batch(requests_batch, [&](size_t, CURLcode result,
+          std::string& batch_output) {
+        faults += result == CURLE_HTTP_RETURNED_ERROR && batch_output.empty();
+      });
+    CHECK(faults == 2);
+  }
+
+  void check_deadline() {
+    test::stand_in_server server([](const std::string&) {
+        test::stand_in_server::response r;
+        r.body = test::lyric_response("1");
+        r.delay_ms = 2000;
+        return r;
+      });
+    alsong::lyrics_fetcher fetcher(server.url());
+    alsong::request_policy policy = fast_retries(3);
+    policy.deadline_ms = 200;
+    fetcher.set_request_policy(policy);
+    auto start = std::chrono::steady_clock::now();
+    std::string output;
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_OPERATION_TIMEDOUT);
+    long elapsed = elapsed_ms(start);
+    CHECK(elapsed >= 190 && elapsed < 600);
+    CHECK(output.empty());
+
+    // a backoff that would outlast the deadline ends the call instead
+    server.set_down(true);
+    policy.backoff_base_ms = 1000;
+    policy.backoff_max_ms = 1000;
+    policy.max_attempts = 10;
+    fetcher.set_request_policy(policy);
+    start = std::chrono::steady_clock::now();
+    uint64_t before = server.requests();
+    int result = fetcher.fetch_lyric("1", output);
+    CHECK(result == CURLE_HTTP_RETURNED_ERROR);
+    CHECK(elapsed_ms(start) < 200);
+    CHECK(server.requests() - before < 10);
+  }
+
+  // every other request stalls, so each call's first attempt is slow and
+  // its hedge is fast
+  void check_hedging() {
+    std::atomic<int> n{0};
+    test::stand_in_server server([&](const std::string&) {
+        test::stand_in_server::response r;
+        r.body = test::lyric_response("1");
+        if (n++ % 2 == 0)
+          r.delay_ms = 1000;
+        return r;
+      });
+    alsong::lyrics_fetcher fetcher(server.url());
+    alsong::request_policy policy;
+    policy.hedge = true;
+    policy.hedge_min_delay_ms = 50;
+    fetcher.set_request_policy(policy);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int call = 0; call < 4; ++call) {
+      std::string output;
+      CHECK(fetcher.fetch_lyric("1", output) == CURLE_OK);
+      CHECK(output == test::lyric_response("1"));
+    }
+    // the streaming parser gets the winner's buffered answer once
+    test::temp_dir dir("alsong-request-policy");
+    alsong::lyrics_serializer serializer(dir.str());
+    std::vector<alsong::song_info> songs;
+    alsong::soap_stream_parser parser = serializer.lyric_stream(songs);
+    CHECK(fetcher.fetch_lyric("1", parser) == CURLE_OK);
+    CHECK(parser.finish() && songs.size() == 1);
+
+    long elapsed = elapsed_ms(start);
+    std::cout << "5 hedged calls in " << elapsed << " ms, " << fetcher.hedge_count()
+      << " hedges, " << fetcher.hedge_win_count() << " won\n";
+    CHECK(elapsed < 900);
+    CHECK(fetcher.hedge_count() == 5);
+    CHECK(fetcher.hedge_win_count() == 5);
+  }
+
+  // the first answer breaks off halfway
+  void check_rollback() {
+    std::atomic<int> n{0};
+    test::stand_in_server server([&](const std::string&) {
+        test::stand_in_server::response r;
+        r.body = test::lyric_response("1");
+        r.cut_short = n++ == 0;
+        return r;
+      });
+    alsong::lyrics_fetcher fetcher(server.url());
+    fetcher.set_request_policy(fast_retries(3));
+
+    // the partial body is dropped before the retry
+    std::string output = "kept|";
+    CHECK(fetcher.fetch_lyric("1", output) == CURLE_OK);
+    CHECK(output == "kept|" + test::lyric_response("1"));
+    CHECK(fetcher.retry_count() == 1);
+
+    // a streaming parser cannot take back what it was fed, so no retry
+    n = 0;
+    test::temp_dir dir("alsong-request-policy");
+    alsong::lyrics_serializer serializer(dir.str());
+    std::vector<alsong::song_info> songs;
+    alsong::soap_stream_parser parser = serializer.lyric_stream(songs);
+    CHECK(fetcher.fetch_lyric("1", parser) == CURLE_PARTIAL_FILE);
+    CHECK(fetcher.retry_count() == 1);
+    CHECK(server.requests() == 3);
+  }
+}
+
+int main()
+{
+  check_retries();
+  check_no_retry_on_client_errors();
+  check_soap_faults();
+  check_deadline();
+  check_hedging();
+  check_rollback();
+  return test::test_result();
+}
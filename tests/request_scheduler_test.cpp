@@ -0,0 +1,98 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the token bucket admits a burst at once and then rate requests per
+// second; an interactive request that arrives behind queued bulk ones
+// goes first, bulk requests keep their arrival order, and try_acquire
+// never jumps a queue
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  long elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return long(std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start).count());
+  }
+
+  void check_rate_and_burst() {
+    alsong::request_scheduler scheduler(20, 3);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 3; ++i)
+      CHECK(scheduler.try_acquire(alsong::request_priority::bulk, start));
+    CHECK(!scheduler.try_acquire(alsong::request_priority::bulk, start));
+    std::chrono::milliseconds delay = scheduler.next_token_delay();
+    CHECK(delay.count() > 0 && delay.count() <= 50);
+
+    // five more at 20 per second take about 250 ms
+    for (int i = 0; i < 5; ++i)
+      scheduler.acquire(alsong::request_priority::bulk);
+    long elapsed = elapsed_ms(start);
+    CHECK(elapsed >= 220 && elapsed < 400);
+
+    alsong::request_scheduler::queue_stats stats =
+      scheduler.stats(alsong::request_priority::bulk);
+    CHECK(stats.admitted == 8);
+    CHECK(stats.waiting == 0);
+    CHECK(stats.max_wait_ms >= 40);
+    CHECK(stats.p99_wait_ms <= stats.max_wait_ms);
+    CHECK(scheduler.stats(alsong::request_priority::interactive).admitted == 0);
+
+    // an idle bucket fills up to the burst again, not beyond it
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    CHECK(scheduler.next_token_delay().count() == 0);
+    auto now = std::chrono::steady_clock::now();
+    for (int i = 0; i < 3; ++i)
+      CHECK(scheduler.try_acquire(alsong::request_priority::interactive, now));
+    CHECK(!scheduler.try_acquire(alsong::request_priority::interactive, now));
+  }
+
+  void check_priority() {
+    alsong::request_scheduler scheduler(10, 1);
+    auto start = std::chrono::steady_clock::now();
+    CHECK(scheduler.try_acquire(alsong::request_priority::bulk, start));
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto waiter = [&](const std::string& name, alsong::request_priority priority) {
+      return std::thread([&, name, priority]() {
+          scheduler.acquire(priority);
+          std::lock_guard<std::mutex> guard(mutex);
+          order.push_back(name);
+        });
+    };
+    std::vector<std::thread> threads;
+    for (const char *name : {"bulk 1", "bulk 2", "bulk 3"}) {
+      threads.push_back(waiter(name, alsong::request_priority::bulk));
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK(scheduler.stats(alsong::request_priority::bulk).waiting == 3);
+    // a free token would still go to the queue first
+    CHECK(!scheduler.try_acquire(alsong::request_priority::bulk,
+          std::chrono::steady_clock::now()));
+    threads.push_back(waiter("interactive", alsong::request_priority::interactive));
+    for (std::thread& t : threads)
+      t.join();
+
+    CHECK(order.size() == 4);
+    CHECK(order == std::vector<std::string>({"interactive", "bulk 1", "bulk 2",
+          "bulk 3"}));
+    // one token per 100 ms after the first
+    long elapsed = elapsed_ms(start);
+    CHECK(elapsed >= 370 && elapsed < 600);
+    alsong::request_scheduler::queue_stats interactive =
+      scheduler.stats(alsong::request_priority::interactive);
+    CHECK(interactive.admitted == 1);
+    CHECK(interactive.max_wait_ms < 100);
+    CHECK(scheduler.stats(alsong::request_priority::bulk).admitted == 4);
+    CHECK(scheduler.stats(alsong::request_priority::bulk).max_wait_ms >= 300);
+  }
+}
+
+int main()
+{
+  check_rate_and_burst();
+  check_priority();
+  return test::test_result();
+}
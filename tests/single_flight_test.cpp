@@ -0,0 +1,124 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// concurrent calls for one key run the work once: N serializers asking
+// for the same lyric or search against a slow stand-in send a single
+// upstream request and N - 1 of them attach to it. A failure or an
+// exception of that one call reaches every caller waiting on it
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  const size_t CALLERS = 8;
+
+  // runs call(i) on CALLERS threads released together
+  void run_together(const std::function<void(size_t)>& call) {
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < CALLERS; ++i)
+      threads.emplace_back([&, i]() {
+          while (!go)
+            std::this_thread::yield();
+          call(i);
+        });
+    go = true;
+    for (std::thread& t : threads)
+      t.join();
+  }
+
+  void check_exceptions_reach_waiters() {
+    alsong::single_flight<int> flight;
+    std::atomic<size_t> thrown{0}, empty{0};
+    run_together([&](size_t) {
+        try {
+          alsong::single_flight<int>::value v = flight.run("key", []() {
+              std::this_thread::sleep_for(std::chrono::milliseconds(200));
+              throw std::runtime_error("upstream went away");
+              return alsong::single_flight<int>::value();
+            });
+          if (!v)
+            ++empty;
+        } catch (const std::runtime_error&) {
+          ++thrown;
+        }
+      });
+    CHECK(flight.leaders() == 1);
+    CHECK(flight.collapsed() == CALLERS - 1);
+    CHECK(thrown == 1);
+    CHECK(empty == CALLERS - 1);
+
+    // the key is free again afterwards
+    alsong::single_flight<int>::value v = flight.run("key", []() {
+        return std::make_shared<const int>(7);
+      });
+    CHECK(v && *v == 7);
+    CHECK(flight.leaders() == 2);
+  }
+
+  void check_serializer_calls(const std::string& folder) {
+    std::atomic<bool> failing{false};
+    test::stand_in_server server([&](const std::string& body) {
+        test::stand_in_server::response r;
+        r.delay_ms = 300;
+        if (failing)
+          r.status = 503;
+        else if (body.find("GetResembleLyricList2") != std::string::npos)
+          r.body = test::lyric_list_response(3);
+        else
+          r.body = test::lyric_response("1");
+        return r;
+      });
+    alsong::lyrics_fetcher fetcher(server.url());
+    alsong::request_policy policy;
+    policy.max_attempts = 1;
+    fetcher.set_request_policy(policy);
+
+    uint64_t collapsed = alsong::lyrics_serializer::collapsed_fetches();
+    std::vector<alsong::song_cache::entry> songs(CALLERS);
+    run_together([&](size_t i) {
+        alsong::lyrics_serializer serializer(folder);
+        songs[i] = serializer.fetch(fetcher, "1");
+      });
+    CHECK(server.requests() == 1);
+    CHECK(alsong::lyrics_serializer::collapsed_fetches() - collapsed == CALLERS - 1);
+    for (const alsong::song_cache::entry& song : songs) {
+      CHECK(song && song->lyric_id == "1");
+      CHECK(song == songs[0]);
+    }
+
+    collapsed = alsong::lyrics_serializer::collapsed_searches();
+    std::atomic<size_t> found{0};
+    run_together([&](size_t) {
+        alsong::lyrics_serializer serializer(folder);
+        if (serializer.search(fetcher, "Dead Boy's Poem", "Nightwish")
+            && serializer.song_list_collection.size() == 3)
+          ++found;
+      });
+    CHECK(server.requests() == 2);
+    CHECK(alsong::lyrics_serializer::collapsed_searches() - collapsed == CALLERS - 1);
+    CHECK(found == CALLERS);
+
+    // a failed fetch fails every caller attached to it
+    failing = true;
+    collapsed = alsong::lyrics_serializer::collapsed_fetches();
+    std::atomic<size_t> failed{0};
+    run_together([&](size_t) {
+        alsong::lyrics_serializer serializer(folder);
+        if (!serializer.fetch(fetcher, "2"))
+          ++failed;
+      });
+    CHECK(server.requests() == 3);
+    CHECK(alsong::lyrics_serializer::collapsed_fetches() - collapsed == CALLERS - 1);
+    CHECK(failed == CALLERS);
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-single-flight");
+  check_exceptions_reach_waiters();
+  check_serializer_calls(dir.str());
+  return test::test_result();
+}
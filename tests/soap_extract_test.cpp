@@ -0,0 +1,134 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the DOM-free extractor must agree with the tinyxml2 path on every shape
+// it accepts and hand anything else to it instead of guessing
+
+namespace
+{
+  std::string through_dom(std::string response) {
+    size_t body = response.find("<soap:Body>") + 11;
+    return response.insert(body, "<!-- recorded -->");
+  }
+
+  std::string list_response(const std::string& items) {
+    std::string response = test::lyric_list_response(0);
+    size_t result = response.find("</GetResembleLyricList2Result>");
+    return response.insert(result, items);
+  }
+
+  bool same(const std::vector<moonk5::alsong::song_list>& a,
+      const std::vector<moonk5::alsong::song_list>& b) {
+    if (a.size() != b.size())
+      return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+      if (a[i].lyric_id != b[i].lyric_id || a[i].title != b[i].title
+          || a[i].artist != b[i].artist || a[i].album != b[i].album)
+        return false;
+    }
+    return true;
+  }
+
+  std::string unescaped(std::string_view text) {
+    std::string output;
+    moonk5::alsong::append_xml_unescaped(output, text);
+    return output;
+  }
+
+  // character references decode to UTF-8 only when they name a
+  // character; anything else is kept as written
+  void check_character_references() {
+    CHECK(unescaped("&#65;&#x41;&#X42;") == "AAB");
+    CHECK(unescaped("&#xAC00;&#44032;") == "가가");
+    CHECK(unescaped("&#x1F3A4;") == "🎤");
+    CHECK(unescaped("&#x10FFFF;") == "\xF4\x8F\xBF\xBF");
+    for (std::string kept : {"&#0;", "&#x0;", "&#xD800;", "&#56319;",
+        "&#xDFFF;", "&#x110000;", "&#1114112;", "&#99999999999999999999;",
+        "&#12ab;", "&#x;", "&#;", "&#-1;", "&#x+41;"})
+      CHECK(unescaped("a" + kept + "b") == "a" + kept + "b");
+
+    // the shared encoder never writes a surrogate or a value past U+10FFFF
+    std::string encoded;
+    moonk5::key_normalization::append_utf8(encoded, 0xD800);
+    moonk5::key_normalization::append_utf8(encoded, 0x110000);
+    CHECK(encoded == "\xEF\xBF\xBD\xEF\xBF\xBD");
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-soap-extract");
+  check_character_references();
+  moonk5::alsong::lyrics_serializer serializer(dir.str(), 50);
+
+  const std::vector<std::string> accepted = {
+    "",
+    "<ST_SEARCHLYRIC_LIST><lyricID>7</lyricID><title>A &amp; B &lt;live&gt;"
+      "</title><artist>&#xAC00;&#44032;</artist><album>&quot;x&apos;</album>"
+      "</ST_SEARCHLYRIC_LIST>",
+    "<ST_SEARCHLYRIC_LIST><lyricID>8</lyricID><title/><artist></artist>"
+      "<album /></ST_SEARCHLYRIC_LIST>",
+    "<ST_SEARCHLYRIC_LIST><lyricID>9</lyricID><title>no album</title>"
+      "<artist>x</artist></ST_SEARCHLYRIC_LIST>",
+    "\n  <ST_SEARCHLYRIC_LIST>\n    <lyricID>10</lyricID>\n    <title>spaced"
+      "</title>\n  </ST_SEARCHLYRIC_LIST>\n",
+  };
+  for (const std::string& items : accepted) {
+    std::string response = list_response(items + items);
+    std::vector<moonk5::alsong::song_list> extracted;
+    CHECK(moonk5::alsong::soap_extract::lyric_list(response, extracted, 50));
+    serializer.song_list_collection.clear();
+    CHECK(serializer.parse_lyric_list(through_dom(response)));
+    CHECK(same(extracted, serializer.song_list_collection));
+  }
+
+  // shapes the extractor does not know fall back to the DOM and never
+  // crash, whether the DOM can read them or not
+  const std::vector<std::string> anomalies = {
+    "<ST_SEARCHLYRIC_LIST><lyricID>1</lyricID><title><b>bold</b></title>"
+      "</ST_SEARCHLYRIC_LIST>",
+    "<ST_SEARCHLYRIC_LIST><lyricID><![CDATA[2]]></lyricID>"
+      "</ST_SEARCHLYRIC_LIST>",
+    "<ST_SEARCHLYRIC_LIST><lyricID lang=\"ko\">3</lyricID>"
+      "</ST_SEARCHLYRIC_LIST>",
+    "<ST_SEARCHLYRIC_LIST><lyricID>4</lyricID><title>unclosed",
+  };
+  for (const std::string& items : anomalies) {
+    std::string response = list_response(items);
+    std::vector<moonk5::alsong::song_list> extracted;
+    CHECK(!moonk5::alsong::soap_extract::lyric_list(response, extracted, 50));
+    CHECK(extracted.empty());
+    serializer.song_list_collection.clear();
+    serializer.parse_lyric_list(response);
+  }
+
+  // lyric responses, including ones the old find_child walk crashed on
+  std::string lyric = test::lyric_response("42");
+  moonk5::alsong::song_info song;
+  std::string raw;
+  CHECK(moonk5::alsong::soap_extract::lyric(lyric, song, raw));
+  CHECK(song.lyric_id == "42" && song.title == "Dead Boy's Poem"
+      && song.written_by == "tester");
+  serializer.song_collection.clear();
+  CHECK(serializer.parse_lyric(through_dom(lyric)));
+  CHECK(serializer.song_collection.size() == 1
+      && serializer.song_collection[0].title == song.title
+      && serializer.song_collection[0].lyrics_collection.size() == 2);
+
+  const std::vector<std::string> broken_lyrics = {
+    "<soap:Envelope><soap:Body><GetLyricByID2Response><GetLyricByID2Result>"
+      "false</GetLyricByID2Result></GetLyricByID2Response></soap:Body>"
+      "</soap:Envelope>",
+    "<GetLyricByID2Result>true</GetLyricByID2Result>",
+    "<x><GetLyricByID2Result>true</GetLyricByID2Result><output><lyric>"
+      "[00:01.00]a&lt;br&gt;</lyric></output></x>",
+  };
+  for (const std::string& response : broken_lyrics) {
+    serializer.song_collection.clear();
+    serializer.parse_lyric(response);
+    CHECK(serializer.song_collection.size() <= 1);
+  }
+
+  return test::test_result();
+}
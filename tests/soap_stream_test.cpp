@@ -0,0 +1,201 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the streaming parser must read every envelope the same whether it
+// arrives whole, a byte at a time or split at any position, inside tags
+// and entities included, and agree with soap_extract and the tinyxml2
+// path; faults and empty results are reported the same way too
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  std::string through_dom(std::string response) {
+    size_t body = response.find("<soap:Body>") + 11;
+    return response.insert(body, "<!-- recorded -->");
+  }
+
+  std::string list_response(const std::string& items) {
+    std::string response = test::lyric_list_response(0);
+    size_t result = response.find("</GetResembleLyricList2Result>");
+    return response.insert(result, items);
+  }
+
+  bool same_lists(const std::vector<alsong::song_list>& a,
+      const std::vector<alsong::song_list>& b) {
+    if (a.size() != b.size())
+      return false;
+    for (size_t i = 0; i < a.size(); ++i)
+      if (a[i].lyric_id != b[i].lyric_id || a[i].title != b[i].title
+          || a[i].artist != b[i].artist || a[i].album != b[i].album)
+        return false;
+    return true;
+  }
+
+  bool same_song(const alsong::song_info& a, const alsong::song_info& b) {
+    if (a.lyric_id != b.lyric_id || a.title != b.title || a.artist != b.artist
+        || a.album != b.album || a.written_by != b.written_by
+        || a.delay != b.delay
+        || a.lyrics_collection.size() != b.lyrics_collection.size())
+      return false;
+    for (size_t i = 0; i < a.lyrics_collection.size(); ++i)
+      if (a.lyrics_collection[i].time != b.lyrics_collection[i].time
+          || a.lyrics_collection[i].lyrics != b.lyrics_collection[i].lyrics)
+        return false;
+    return true;
+  }
+
+  // the ways a response may be cut into chunks: whole, byte by byte and
+  // in two at every position
+  std::vector<std::vector<size_t>> chunkings(size_t size) {
+    std::vector<std::vector<size_t>> result;
+    result.push_back({size});
+    result.push_back(std::vector<size_t>(size, 1));
+    for (size_t split = 1; split < size; ++split)
+      result.push_back({split, size - split});
+    return result;
+  }
+
+  void feed(alsong::soap_stream_parser& parser, const std::string& response,
+      const std::vector<size_t>& chunks) {
+    size_t offset = 0;
+    for (size_t chunk : chunks) {
+      parser.feed(response.data() + offset, chunk);
+      offset += chunk;
+    }
+  }
+
+  struct list_result
+  {
+    bool found = false;
+    std::vector<alsong::song_list> lists;
+  };
+
+  list_result stream_lists(const std::string& response,
+      const std::vector<size_t>& chunks) {
+    list_result result;
+    alsong::soap_stream_parser parser =
+      alsong::lyrics_serializer::lyric_list_stream(result.lists);
+    feed(parser, response, chunks);
+    result.found = parser.result_found();
+    return result;
+  }
+
+  void check_lists(alsong::lyrics_serializer& serializer) {
+    const std::vector<std::string> items = {
+      "",
+      "<ST_SEARCHLYRIC_LIST><lyricID>7</lyricID><title>A &amp; B &lt;live&gt;"
+        "</title><artist>&#xAC00;&#44032;</artist><album>&quot;x&apos;</album>"
+        "</ST_SEARCHLYRIC_LIST>",
+      "<ST_SEARCHLYRIC_LIST><lyricID>8</lyricID><title/><artist></artist>"
+        "<album /></ST_SEARCHLYRIC_LIST>",
+      "<ST_SEARCHLYRIC_LIST><lyricID>9</lyricID><title>no album</title>"
+        "<artist>x</artist></ST_SEARCHLYRIC_LIST>",
+      "\n  <ST_SEARCHLYRIC_LIST>\n    <lyricID>10</lyricID>\n    <title>spaced"
+        "</title>\n  </ST_SEARCHLYRIC_LIST>\n",
+    };
+    for (const std::string& item : items) {
+      std::string response = list_response(item + item);
+      std::vector<alsong::song_list> extracted;
+      CHECK(alsong::soap_extract::lyric_list(response, extracted, 50));
+      serializer.song_list_collection.clear();
+      CHECK(serializer.parse_lyric_list(through_dom(response)));
+      CHECK(same_lists(extracted, serializer.song_list_collection));
+
+      size_t mismatches = 0;
+      for (const std::vector<size_t>& chunks : chunkings(response.size())) {
+        list_result streamed = stream_lists(response, chunks);
+        if (!streamed.found || !same_lists(streamed.lists, extracted))
+          ++mismatches;
+      }
+      CHECK(mismatches == 0);
+    }
+
+    // the recorded three result response, and one without results
+    for (size_t count : {size_t(3), size_t(0)}) {
+      std::string response = test::lyric_list_response(count);
+      serializer.song_list_collection.clear();
+      CHECK(serializer.parse_lyric_list(through_dom(response)));
+      CHECK(serializer.song_list_collection.size() == count);
+      size_t mismatches = 0;
+      for (const std::vector<size_t>& chunks : chunkings(response.size())) {
+        list_result streamed = stream_lists(response, chunks);
+        if (!streamed.found
+            || !same_lists(streamed.lists, serializer.song_list_collection))
+          ++mismatches;
+      }
+      CHECK(mismatches == 0);
+    }
+  }
+
+  void check_lyrics(alsong::lyrics_serializer& serializer) {
+    const std::vector<std::string> responses = {
+      test::lyric_response("42"),
+      test::lyric_response("43", "[00:01.00]&amp;&lt;tag&gt; &#xAC00;&#44032;"
+          "&lt;br&gt;[00:01.00]second &quot;line&quot;&lt;br&gt;"
+          "[00:02.50]&apos;quoted&apos;"),
+      test::lyric_response("44", ""),
+    };
+    for (const std::string& response : responses) {
+      alsong::song_info extracted;
+      std::string raw;
+      CHECK(alsong::soap_extract::lyric(response, extracted, raw));
+      serializer.song_collection.clear();
+      CHECK(serializer.parse_lyric(through_dom(response)));
+      CHECK(serializer.song_collection.size() == 1);
+      if (serializer.song_collection.size() != 1)
+        continue;
+      alsong::song_info dom = serializer.song_collection[0];
+      CHECK(extracted.lyric_id == dom.lyric_id && extracted.title == dom.title
+          && extracted.written_by == dom.written_by);
+
+      size_t mismatches = 0;
+      for (const std::vector<size_t>& chunks : chunkings(response.size())) {
+        std::vector<alsong::song_info> songs;
+        alsong::soap_stream_parser parser = serializer.lyric_stream(songs);
+        feed(parser, response, chunks);
+        if (!parser.result_found() || songs.size() != 1
+            || !same_song(songs[0], dom))
+          ++mismatches;
+      }
+      CHECK(mismatches == 0);
+    }
+  }
+
+  // no result element: every path reports the fault and no records
+  void check_faults(alsong::lyrics_serializer& serializer) {
+    std::string fault = test::soap_fault_response();
+    serializer.song_list_collection.clear();
+    CHECK(!serializer.parse_lyric_list(fault));
+    CHECK(serializer.song_list_collection.empty());
+    serializer.song_collection.clear();
+    CHECK(!serializer.parse_lyric(fault));
+    CHECK(serializer.song_collection.empty());
+
+    size_t mismatches = 0;
+    for (const std::vector<size_t>& chunks : chunkings(fault.size())) {
+      list_result streamed = stream_lists(fault, chunks);
+      std::vector<alsong::song_info> songs;
+      alsong::soap_stream_parser parser = serializer.lyric_stream(songs);
+      feed(parser, fault, chunks);
+      if (streamed.found || !streamed.lists.empty() || parser.result_found()
+          || !songs.empty())
+        ++mismatches;
+    }
+    CHECK(mismatches == 0);
+    alsong::soap_stream_parser parser("GetLyricByID2Result");
+    parser.feed(fault.data(), fault.size());
+    CHECK(!parser.finish());
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-soap-stream");
+  alsong::lyrics_serializer serializer(dir.str(), 50);
+  check_lists(serializer);
+  check_lyrics(serializer);
+  check_faults(serializer);
+  return test::test_result();
+}
@@ -0,0 +1,63 @@
+#include <regex>
+
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+namespace
+{
+  // how fetch_lyric_list built its envelope before soap_template
+  std::string regex_lyric_list(const moonk5::alsong::lyrics_fetcher& fetcher,
+      const std::string& title, const std::string& artist) {
+    std::string soap(fetcher.SOAP_TEMPLATE_LYRIC_LIST);
+    soap = std::regex_replace(soap, std::regex("\\$encdata"), fetcher.ENC_DATA);
+    soap = std::regex_replace(soap, std::regex("\\$title"), title);
+    soap = std::regex_replace(soap, std::regex("\\$artist"), artist);
+    return soap;
+  }
+
+  std::string regex_lyric(const moonk5::alsong::lyrics_fetcher& fetcher,
+      const std::string& lyric_id) {
+    std::string soap(fetcher.SOAP_TEMPLATE_LYRIC_BY_ID);
+    soap = std::regex_replace(soap, std::regex("\\$encdata"), fetcher.ENC_DATA);
+    soap = std::regex_replace(soap, std::regex("\\$lyricId"), lyric_id);
+    return soap;
+  }
+}
+
+int main()
+{
+  using moonk5::alsong::soap_template;
+
+  // placeholders at the edges, next to each other, repeated and unknown
+  soap_template t("$a<x>$b$a</x>$c $unknown $", {"a", "b", "c"});
+  CHECK(t.render({"1", "2", "3"}) == "1<x>21</x>3 $unknown $");
+  CHECK(t.render({"", "", ""}) == "<x></x> $unknown $");
+  // values are escaped, and '$' in a value is never expanded again
+  CHECK(t.render({"A&B", "<$b>", "\"'"})
+      == "A&amp;B<x>&lt;$b&gt;A&amp;B</x>&quot;&apos; $unknown $");
+
+  // the real envelopes render as the regex path did for plain values
+  std::string body;
+  std::mutex body_mutex;
+  test::stand_in_server server([&](const std::string& request) {
+      std::lock_guard<std::mutex> guard(body_mutex);
+      body = request;
+      test::stand_in_server::response r;
+      r.body = test::lyric_list_response(1);
+      return r;
+    });
+  moonk5::alsong::lyrics_fetcher fetcher(server.url());
+  std::string output;
+  CHECK(fetcher.fetch_lyric_list("dead boy's poem", "nightwish", output) == CURLE_OK);
+  CHECK(body == regex_lyric_list(fetcher, "dead boy&apos;s poem", "nightwish"));
+  CHECK(fetcher.fetch_lyric("12345", output) == CURLE_OK);
+  CHECK(body == regex_lyric(fetcher, "12345"));
+
+  // and values the regex path broke on go out escaped
+  CHECK(fetcher.fetch_lyric_list("$1 & <co>", "AC/DC $artist", output) == CURLE_OK);
+  CHECK(body.find("<ns1:title>$1 &amp; &lt;co&gt;</ns1:title>") != std::string::npos);
+  CHECK(body.find("<ns1:artist>AC/DC $artist</ns1:artist>") != std::string::npos);
+
+  return test::test_result();
+}
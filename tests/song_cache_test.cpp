@@ -0,0 +1,90 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the song cache stays within its byte budget by dropping the least
+// recently used songs, keeps the ones just read, and its size and
+// counters follow every insert, hit, miss and eviction
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  alsong::song_cache::entry make_song(const std::string& id) {
+    auto song = std::make_shared<alsong::song_info>();
+    song->lyric_id = id;
+    song->title = "Title " + id;
+    song->artist = "Artist";
+    song->add_lyrics("00:01.00", std::string(200, 'x'));
+    return song;
+  }
+
+  size_t entry_bytes(const std::string& key) {
+    return key.size() + make_song(key)->memory_size();
+  }
+
+  void check_eviction() {
+    // every key has the same length, so every entry the same size
+    size_t bytes = entry_bytes("song0");
+    alsong::song_cache cache(bytes * 4);
+    for (int i = 0; i < 4; ++i)
+      cache.put("song" + std::to_string(i), make_song("song" + std::to_string(i)));
+    CHECK(cache.size() == 4);
+    CHECK(cache.bytes() == bytes * 4);
+    CHECK(cache.evictions() == 0);
+
+    // song0 is the oldest but was just read, so song1 goes first
+    CHECK(cache.get("song0") != nullptr);
+    cache.put("song4", make_song("song4"));
+    CHECK(cache.size() == 4);
+    CHECK(cache.bytes() == bytes * 4);
+    CHECK(cache.evictions() == 1);
+    CHECK(cache.get("song1") == nullptr);
+    CHECK(cache.get("song0") != nullptr);
+
+    // two more push out song2 and song3, never song0 or song4
+    CHECK(cache.get("song4") != nullptr);
+    cache.put("song5", make_song("song5"));
+    cache.put("song6", make_song("song6"));
+    CHECK(cache.evictions() == 3);
+    CHECK(cache.get("song2") == nullptr);
+    CHECK(cache.get("song3") == nullptr);
+    for (const char *key : {"song0", "song4", "song5", "song6"})
+      CHECK(cache.get(key) != nullptr);
+    CHECK(cache.hits() == 7);
+    CHECK(cache.misses() == 3);
+
+    // replacing a key reuses its budget
+    cache.put("song6", make_song("song6"));
+    CHECK(cache.size() == 4);
+    CHECK(cache.evictions() == 3);
+
+    // a song larger than the whole cache is not kept
+    auto large = std::make_shared<alsong::song_info>();
+    large->add_lyrics("00:01.00", std::string(bytes * 5, 'y'));
+    cache.put("large", large);
+    CHECK(cache.get("large") == nullptr);
+    CHECK(cache.size() == 4);
+
+    // shrinking evicts down to the new budget, oldest first
+    cache.set_capacity(bytes * 2);
+    CHECK(cache.size() == 2);
+    CHECK(cache.bytes() == bytes * 2);
+    CHECK(cache.evictions() == 5);
+    CHECK(cache.get("song6") != nullptr);
+    CHECK(cache.get("song5") != nullptr);
+
+    cache.erase("song5");
+    CHECK(cache.size() == 1);
+    CHECK(cache.bytes() == bytes);
+    cache.clear();
+    CHECK(cache.size() == 0);
+    CHECK(cache.bytes() == 0);
+  }
+}
+
+int main()
+{
+  check_eviction();
+  return test::test_result();
+}
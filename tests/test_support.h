@@ -0,0 +1,389 @@
+#ifndef ALSONG_TEST_SUPPORT_H
+#define ALSONG_TEST_SUPPORT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// minimal checks for the single-file test programs registered with ctest;
+// a test's main returns test_result()
+namespace test
+{
+  int& failures() {
+    static int count = 0;
+    return count;
+  }
+
+  int test_result() {
+    if (failures() == 0)
+      std::cout << "all checks passed\n";
+    else
+      std::cout << failures() << " checks failed\n";
+    return failures() == 0 ? 0 : 1;
+  }
+
+  // a fresh directory under the system temp path, removed on destruction
+  struct temp_dir
+  {
+    std::filesystem::path path;
+
+    explicit temp_dir(const std::string& name) {
+      path = std::filesystem::temp_directory_path()
+        / (name + "-" + std::to_string(::getpid()));
+      std::filesystem::remove_all(path);
+      std::filesystem::create_directories(path);
+    }
+
+    ~temp_dir() {
+      std::error_code ec;
+      std::filesystem::remove_all(path, ec);
+    }
+
+    std::string str() const {
+      return path.string();
+    }
+  };
+
+  // the response shapes of the ALSong service, as recorded from it
+  std::string lyric_list_response(size_t count) {
+    std::string items;
+    for (size_t i = 1; i <= count; ++i)
+      items += "<ST_SEARCHLYRIC_LIST><lyricID>" + std::to_string(i)
+        + "</lyricID><title>Dead Boy&apos;s Poem</title><artist>Nightwish"
+        "</artist><album>Wishmaster &amp; co</album></ST_SEARCHLYRIC_LIST>";
+    return "<?xml version=\"1.0\" encoding=\"utf-8\"?><soap:Envelope "
+      "xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\" "
+      "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
+      "xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\"><soap:Body>"
+      "<GetResembleLyricList2Response xmlns=\"ALSongWebServer\">"
+      "<GetResembleLyricList2Result>" + items + "</GetResembleLyricList2Result>"
+      "</GetResembleLyricList2Response></soap:Body></soap:Envelope>";
+  }
+
+  std::string lyric_response(const std::string& lyric_id,
+      const std::string& lyric="[00:00.00]&lt;br&gt;[00:01.50]Line &quot;one&quot;"
+        "&lt;br&gt;[00:01.50]두번째&lt;br&gt;[00:03.20]three [x]&lt;br&gt;"
+        "[01:04.99]end") {
+    return "<?xml version=\"1.0\" encoding=\"utf-8\"?><soap:Envelope "
+      "xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\"><soap:Body>"
+      "<GetLyricByID2Response xmlns=\"ALSongWebServer\"><GetLyricByID2Result>"
+      "true</GetLyricByID2Result><output><lyricID>" + lyric_id + "</lyricID>"
+      "<title>Dead Boy&apos;s Poem</title><artist>Nightwish</artist>"
+      "<album>Wishmaster</album><registerName>tester</registerName><lyric>"
+      + lyric + "</lyric></output></GetLyricByID2Response></soap:Body>"
+      "</soap:Envelope>";
+  }
+
+  // what the service answers, with HTTP status 500, to a request it
+  // cannot process
+  std::string soap_fault_response(const std::string& reason=
+        "Server was unable to process request. ---&gt; bad encData") {
+    return "<?xml version=\"1.0\" encoding=\"utf-8\"?><soap:Envelope "
+      "xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\"><soap:Body>"
+      "<soap:Fault><soap:Code><soap:Value>soap:Receiver</soap:Value>"
+      "</soap:Code><soap:Reason><soap:Text xml:lang=\"en\">" + reason
+      + "</soap:Text></soap:Reason><soap:Detail /></soap:Fault></soap:Body>"
+      "</soap:Envelope>";
+  }
+
+  // a local HTTP/1.1 stand-in for the ALSong endpoint. Every connection
+  // gets a thread and keep-alive; the handler sees each request body and
+  // decides the answer, so tests can inject faults, delays and capacity
+  // limits
+  class stand_in_server
+  {
+    public:
+      struct response
+      {
+        int status = 200;
+        std::string body;
+        long delay_ms = 0;     // before answering
+        bool cut_short = false; // drop the connection halfway through the body
+      };
+
+      typedef std::function<response(const std::string& body)> handler;
+
+      explicit stand_in_server(handler on_request)
+        : on_request(std::move(on_request)) {
+        listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        socklen_t length = sizeof(address);
+        if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&address), length) != 0
+            || ::listen(listen_fd, 256) != 0
+            || ::getsockname(listen_fd, reinterpret_cast<sockaddr *>(&address),
+              &length) != 0) {
+          std::perror("stand_in_server");
+          std::exit(2);
+        }
+        port = ntohs(address.sin_port);
+        acceptor = std::thread([this]() { accept_loop(); });
+      }
+
+      // answers every request with a lyric list or a lyric by shape
+      stand_in_server() : stand_in_server([](const std::string& body) {
+            response r;
+            r.body = body.find("GetResembleLyricList2") != std::string::npos
+              ? lyric_list_response(3) : lyric_response("1");
+            return r;
+          }) {
+      }
+
+      stand_in_server(const stand_in_server&) = delete;
+      stand_in_server& operator=(const stand_in_server&) = delete;
+
+      ~stand_in_server() {
+        {
+          std::lock_guard<std::mutex> guard(mutex);
+          stopping = true;
+          for (int fd : connections)
+            ::shutdown(fd, SHUT_RDWR);
+        }
+        wake.notify_all();
+        ::shutdown(listen_fd, SHUT_RDWR);
+        acceptor.join();
+        ::close(listen_fd);
+        for (std::thread& t : workers)
+          t.join();
+      }
+
+      std::string url() const {
+        return "http://127.0.0.1:" + std::to_string(port) + "/";
+      }
+
+      uint64_t requests() const {
+        return request_count.load();
+      }
+
+      uint64_t connections_accepted() const {
+        return accept_count.load();
+      }
+
+      // a down server answers 503 at once
+      void set_down(bool is_down) {
+        down = is_down;
+      }
+
+    private:
+      void accept_loop() {
+        for (;;) {
+          int fd = ::accept(listen_fd, nullptr, nullptr);
+          if (fd < 0)
+            return;
+          int one = 1;
+          ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+          std::lock_guard<std::mutex> guard(mutex);
+          if (stopping) {
+            ::close(fd);
+            return;
+          }
+          ++accept_count;
+          connections.push_back(fd);
+          workers.emplace_back([this, fd]() {
+              serve(fd);
+              std::lock_guard<std::mutex> guard(mutex);
+              connections.erase(std::find(connections.begin(),
+                    connections.end(), fd));
+              ::close(fd);
+            });
+        }
+      }
+
+      void serve(int fd) {
+        std::string buffer;
+        char chunk[16384];
+        for (;;) {
+          size_t end;
+          while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+              return;
+            buffer.append(chunk, size_t(n));
+          }
+          size_t length = 0;
+          std::string headers = buffer.substr(0, end);
+          for (char& c : headers)
+            c = char(std::tolower(static_cast<unsigned char>(c)));
+          size_t field = headers.find("content-length:");
+          if (field != std::string::npos)
+            length = std::strtoul(headers.c_str() + field + 15, nullptr, 10);
+          // curl holds larger bodies back until it is told to go on
+          if (headers.find("expect: 100-continue") != std::string::npos
+              && buffer.size() < end + 4 + length)
+            ::send(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL);
+          while (buffer.size() < end + 4 + length) {
+            ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+              return;
+            buffer.append(chunk, size_t(n));
+          }
+          std::string body = buffer.substr(end + 4, length);
+          buffer.erase(0, end + 4 + length);
+          ++request_count;
+
+          response r;
+          if (down)
+            r.status = 503;
+          else
+            r = on_request(body);
+          if (r.delay_ms > 0) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (wake.wait_for(lock, std::chrono::milliseconds(r.delay_ms),
+                  [this]() { return stopping; }))
+              return;
+          }
+          std::string out = "HTTP/1.1 " + std::to_string(r.status)
+            + (r.status == 200 ? " OK" : " Error")
+            + "\r\nContent-Type: application/soap+xml; charset=utf-8"
+            + "\r\nContent-Length: " + std::to_string(r.body.size())
+            + "\r\n\r\n" + r.body;
+          if (r.cut_short)
+            out.resize(out.size() - r.body.size() / 2);
+          size_t sent = 0;
+          while (sent < out.size()) {
+            ssize_t n = ::send(fd, out.data() + sent, out.size() - sent,
+                MSG_NOSIGNAL);
+            if (n <= 0)
+              return;
+            sent += size_t(n);
+          }
+          if (r.cut_short)
+            return;
+        }
+      }
+
+      handler on_request;
+      int listen_fd = -1;
+      uint16_t port = 0;
+      std::thread acceptor;
+      std::mutex mutex;
+      std::condition_variable wake;
+      bool stopping = false;
+      std::vector<int> connections;
+      std::vector<std::thread> workers;
+      std::atomic<bool> down{false};
+      std::atomic<uint64_t> request_count{0};
+      std::atomic<uint64_t> accept_count{0};
+  }; // class test::stand_in_server
+
+  // a keep-alive HTTP/1.1 client over a Unix socket, as used against
+  // lyrics_daemon
+  class unix_http_client
+  {
+    public:
+      struct response
+      {
+        int status = 0;       // 0 if the connection failed
+        std::string body;
+      };
+
+      explicit unix_http_client(const std::string& path) {
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        if (::connect(fd, reinterpret_cast<sockaddr *>(&address),
+              sizeof(address)) != 0) {
+          ::close(fd);
+          fd = -1;
+        }
+      }
+
+      unix_http_client(const unix_http_client&) = delete;
+      unix_http_client& operator=(const unix_http_client&) = delete;
+
+      ~unix_http_client() {
+        if (fd >= 0)
+          ::close(fd);
+      }
+
+      bool send_request(const std::string& target) {
+        std::string request = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        return fd >= 0 && ::send(fd, request.data(), request.size(), MSG_NOSIGNAL)
+          == ssize_t(request.size());
+      }
+
+      // the next response on the connection
+      response read_response() {
+        response r;
+        size_t end;
+        while ((end = buffer.find("\r\n\r\n")) == std::string::npos)
+          if (!receive())
+            return r;
+        size_t length = 0;
+        size_t field = buffer.find("Content-Length: ");
+        if (field != std::string::npos && field < end)
+          length = std::strtoul(buffer.c_str() + field + 16, nullptr, 10);
+        while (buffer.size() < end + 4 + length)
+          if (!receive())
+            return r;
+        r.status = std::atoi(buffer.c_str() + 9);
+        r.body = buffer.substr(end + 4, length);
+        buffer.erase(0, end + 4 + length);
+        return r;
+      }
+
+      response get(const std::string& target) {
+        if (!send_request(target))
+          return response();
+        return read_response();
+      }
+
+      // shuts down the sending side, as `nc -N` does after its input
+      void finish_sending() {
+        ::shutdown(fd, SHUT_WR);
+      }
+
+      // whether the server closed the connection with nothing left unread
+      bool closed_by_peer() {
+        return buffer.empty() && !receive();
+      }
+
+    private:
+      bool receive() {
+        char chunk[16384];
+        ssize_t n = fd >= 0 ? ::recv(fd, chunk, sizeof(chunk), 0) : -1;
+        if (n <= 0)
+          return false;
+        buffer.append(chunk, size_t(n));
+        return true;
+      }
+
+      int fd = -1;
+      std::string buffer;
+  }; // class test::unix_http_client
+}
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " \
+        << #condition << "\n"; \
+      ++test::failures(); \
+    } \
+  } while (0)
+
+#endif // ALSONG_TEST_SUPPORT_H
@@ -0,0 +1,110 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// the span rings: a full ring keeps exactly its newest spans, an
+// export taken while another thread keeps writing is valid JSON with
+// no torn or repeated spans, and the rings of exited threads are kept
+// only for the newest 16 of them
+
+namespace
+{
+  namespace alsong = moonk5::alsong;
+
+  // spans named name in an export, as (ts, dur) in export order
+  std::vector<std::pair<int64_t, int64_t>> spans(const nlohmann::json& trace,
+      const std::string& name) {
+    std::vector<std::pair<int64_t, int64_t>> found;
+    for (const nlohmann::json& e : trace["traceEvents"])
+      if (e["name"] == name)
+        found.emplace_back(e["ts"].get<int64_t>(), e["dur"].get<int64_t>());
+    return found;
+  }
+
+  nlohmann::json export_trace() {
+    std::ostringstream os;
+    alsong::tracer::write_chrome_trace(os);
+    nlohmann::json trace = nlohmann::json::parse(os.str(), nullptr, false);
+    CHECK(!trace.is_discarded());
+    return trace;
+  }
+
+  void check_wrap_around() {
+    const int64_t total = 5000, ring = 4096;
+    for (int64_t i = 0; i < total; ++i)
+      alsong::tracer::record("wrap", i, 2 * i);
+    std::vector<std::pair<int64_t, int64_t>> kept = spans(export_trace(), "wrap");
+    CHECK(int64_t(kept.size()) == ring);
+    for (size_t i = 0; i < kept.size(); ++i) {
+      CHECK(kept[i].first == total - ring + int64_t(i));
+      CHECK(kept[i].second == kept[i].first);
+    }
+
+    // exactly one lap
+    for (int64_t i = total; i < total + ring - int64_t(total % ring); ++i)
+      alsong::tracer::record("wrap", i, 2 * i);
+    kept = spans(export_trace(), "wrap");
+    CHECK(int64_t(kept.size()) == ring);
+    CHECK(!kept.empty() && kept.front().first % ring == 0);
+  }
+
+  void check_export_while_writing() {
+    std::atomic<bool> stop{false};
+    std::thread writer([&]() {
+        for (int64_t i = 1; !stop.load(std::memory_order_relaxed); ++i)
+          alsong::tracer::record("live", i, 2 * i);
+      });
+    size_t seen = 0;
+    for (int round = 0; round < 50; ++round) {
+      std::vector<std::pair<int64_t, int64_t>> live = spans(export_trace(), "live");
+      CHECK(live.size() <= 4096);
+      seen += live.size();
+      for (size_t i = 0; i < live.size(); ++i) {
+        CHECK(live[i].second == live[i].first);
+        if (i > 0)
+          CHECK(live[i].first > live[i - 1].first);
+      }
+    }
+    stop = true;
+    writer.join();
+    CHECK(seen > 0);
+    // the finished thread's spans are still exported
+    CHECK(spans(export_trace(), "live").size() == 4096);
+  }
+
+  void check_thread_churn() {
+    const size_t threads = 100, retired = 16;
+    uint64_t dropped = alsong::tracer::dropped_spans();
+    for (size_t i = 0; i < threads; ++i)
+      std::thread([i]() {
+          for (int64_t j = 0; j < 3; ++j)
+            alsong::tracer::record("churn", int64_t(i), int64_t(i) + j);
+        }).join();
+
+    nlohmann::json trace = export_trace();
+    std::set<int64_t> tids;
+    std::vector<int64_t> begins;
+    for (const nlohmann::json& e : trace["traceEvents"])
+      if (e["name"] == "churn") {
+        tids.insert(e["tid"].get<int64_t>());
+        begins.push_back(e["ts"].get<int64_t>());
+      }
+    // the newest threads' rings are kept, every older one is released
+    CHECK(tids.size() == retired);
+    CHECK(begins.size() == 3 * retired);
+    CHECK(*std::min_element(begins.begin(), begins.end())
+        == int64_t(threads - retired));
+    CHECK(spans(trace, "live").empty());
+    // the churn threads' spans plus the ring of the earlier writer
+    CHECK(alsong::tracer::dropped_spans() - dropped
+        == 3 * (threads - retired) + 4096);
+  }
+}
+
+int main()
+{
+  check_wrap_around();
+  check_export_while_writing();
+  check_thread_churn();
+  return test::test_result();
+}
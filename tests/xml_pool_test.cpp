@@ -0,0 +1,59 @@
+#include <AlsongLyricsFetcher.h>
+
+#include "test_support.h"
+
+// once its pools are warm, the per-thread parse document serves a stream
+// of responses without going back to the heap
+
+namespace
+{
+  // a comment sends a response past the DOM-free extractor to tinyxml2
+  std::string through_dom(std::string response) {
+    size_t body = response.find("<soap:Body>") + 11;
+    return response.insert(body, "<!-- recorded -->");
+  }
+}
+
+int main()
+{
+  test::temp_dir dir("alsong-xml-pool");
+  moonk5::alsong::lyrics_serializer serializer(dir.str(), 50);
+
+  std::vector<std::string> responses;
+  for (size_t count = 1; count <= 20; ++count)
+    responses.push_back(through_dom(test::lyric_list_response(count)));
+  for (int id = 1; id <= 20; ++id)
+    responses.push_back(through_dom(test::lyric_response(std::to_string(id))));
+
+  auto parse_all = [&]() {
+    for (const std::string& response : responses) {
+      if (response.find("GetResembleLyricList2") != std::string::npos) {
+        serializer.song_list_collection.clear();
+        CHECK(serializer.parse_lyric_list(response));
+        CHECK(!serializer.song_list_collection.empty());
+      } else {
+        serializer.song_collection.clear();
+        CHECK(serializer.parse_lyric(response));
+        CHECK(serializer.song_collection.size() == 1);
+      }
+    }
+  };
+
+  parse_all();
+  int warm = moonk5::alsong::lyrics_serializer::xml_heap_allocations();
+  CHECK(warm > 0);
+  for (int pass = 0; pass < 100; ++pass)
+    parse_all();
+  int after = moonk5::alsong::lyrics_serializer::xml_heap_allocations();
+  std::cout << "xml heap allocations: " << warm << " after warm-up, " << after
+    << " after 100 more passes of " << responses.size() << " responses\n";
+  CHECK(after == warm);
+
+  // a document on another thread keeps its own pools
+  std::thread other([&]() {
+      CHECK(moonk5::alsong::lyrics_serializer::xml_heap_allocations() == 0);
+    });
+  other.join();
+
+  return test::test_result();
+}